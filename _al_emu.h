@@ -0,0 +1,101 @@
+/*
+Copyright (C) 1994-1995 Apogee Software, Ltd.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+/**********************************************************************
+   module: _AL_EMU.H
+
+   Private header for AL_EMU.C
+**********************************************************************/
+
+#ifndef ___AL_EMU_H
+#define ___AL_EMU_H
+
+// The chip has two banks of registers, each with 9 channels of two
+// operators.  The second bank is only heard in OPL3 mode or on cards
+// with two OPL2 chips.
+#define EMU_NumBanks 2
+#define EMU_BankChannels 9
+#define EMU_BankOperators 18
+#define EMU_NumChannels (EMU_NumBanks * EMU_BankChannels)
+#define EMU_NumOperators (EMU_NumBanks * EMU_BankOperators)
+
+// Clock rate of the chip's output
+#define EMU_ChipRate 49716L
+
+// Envelopes and the LFOs are updated once for this many samples
+#define EMU_BlockSize 16
+
+// Waveforms are EMU_WaveLength samples of 13 bits
+#define EMU_NumWaves 8
+#define EMU_WaveLength 1024
+#define EMU_WaveShift 22
+#define EMU_WaveMask (EMU_WaveLength - 1)
+#define EMU_WaveAmplitude 4095
+
+// Attenuation is in steps of 0.1875 dB.  The envelope level keeps a
+// 16 bit fraction.
+#define EMU_MaxAttenuation 511
+#define EMU_LevelShift 16
+#define EMU_Silent ((long)EMU_MaxAttenuation << EMU_LevelShift)
+
+#define EMU_NumRates 64
+#define EMU_InstantAttack 60
+
+// Time to go through the full range of the envelope at rate 4, in
+// milliseconds.  Each step of 4 in the rate halves the time.
+#define EMU_AttackTime 2826.24
+#define EMU_DecayTime 39280.64
+
+// LFO rates in Hz and depths
+#define EMU_TremoloRate 3.7
+#define EMU_VibratoRate 6.07
+#define EMU_TremoloDepth 26
+
+// Envelope states
+#define EMU_Off 0
+#define EMU_Attack 1
+#define EMU_Decay 2
+#define EMU_Sustain 3
+#define EMU_Release 4
+
+// Register bits
+#define EMU_WaveSelectEnable 0x20
+#define EMU_NoteSelectFlag 0x40
+#define EMU_OPL3Enable 0x01
+#define EMU_DeepTremolo 0x80
+#define EMU_DeepVibrato 0x40
+#define EMU_KeyOn 0x20
+#define EMU_Tremolo 0x80
+#define EMU_Vibrato 0x40
+#define EMU_Sustained 0x20
+#define EMU_KeyScaleRate 0x10
+#define EMU_LeftOutput 0x10
+#define EMU_RightOutput 0x20
+
+static void EMU_CalcTables(void);
+static unsigned long EMU_CalcPhase(unsigned long base);
+static long EMU_RateStep(double time, int rate);
+static void EMU_UpdateOperator(int op);
+static void EMU_UpdateChannel(int channel);
+static void EMU_StepEnvelopes(int count);
+static void EMU_StepLFOs(int count);
+static void EMU_RenderChannel(int channel, int count);
+static void EMU_ServiceStream(char *buffer, int length);
+
+#endif
@@ -30,6 +30,19 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #define AL_VoiceNotFound -1
 
+/* Copy of the registers written to each port.  Writes that wouldn't
+   change a register are skipped, except to the timer registers,
+   where each write is a command. */
+#define AL_NumPorts 2
+#define AL_NumRegisters 256
+#define AL_RegisterUnknown -1
+#define AL_FirstTimerRegister 2
+#define AL_LastTimerRegister 4
+
+/* Writes queued while the sequencer plays a tick */
+#define AL_QueueSize 256
+#define AL_KeyOnBit 0x20
+
 #define alFreqH 0xb0
 #define alEffects 0xbd
 
@@ -160,10 +173,22 @@ typedef struct
     unsigned char Key;
 } DRUM_MAP;
 
+typedef struct
+{
+    unsigned char bank;
+    unsigned char reg;
+    unsigned char data;
+} ALWRITE;
+
 extern TIMBRE ADLIB_TimbreBank[174];
 extern DRUM_MAP PercussionTable[128];
 
 static void AL_ResetVoices(void);
+static void AL_ClearShadow(void);
+static void AL_WriteRegister(int port, int reg, int data);
+static void AL_WaitForCard(int port);
+static void AL_QueueWrite(int bank, int reg, int data);
+static void AL_SendQueue(void);
 static void AL_CalcPitchInfo(void);
 static void AL_SetVoiceTimbre(int voice);
 static void AL_SetVoiceVolume(int voice);
@@ -0,0 +1,138 @@
+/*
+Copyright (C) 1994-1995 Apogee Software, Ltd.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+/**********************************************************************
+   module: _FX_MAN.H
+
+   Private header for FX_MAN.C
+**********************************************************************/
+
+#ifndef ___FX_MAN_H
+#define ___FX_MAN_H
+
+#define FX_MixRate 10000
+
+// Polyphase low-pass filter used when resampling to the device rate.
+// Each of the FX_FilterPhases rows holds FX_FilterTaps coefficients
+// in FX_FilterShift fixed point, normalized for unity gain at DC.
+#define FX_FilterPhases 32
+#define FX_FilterPhaseShift 11
+#define FX_FilterTaps 16
+#define FX_FilterShift 14
+#define FX_FilterCutoff 0.9
+
+// The loader task converts this many samples each time it runs.
+#define FX_LoaderRate 70
+#define FX_LoaderChunk 512
+
+// Largest number of sounds FX_PlayBatch starts in one critical section
+#define FX_MaxBatch 16
+
+// VOC block types and sample formats
+#define FX_VOCTerminator 0
+#define FX_VOCSoundData 1
+#define FX_VOCSoundDataNew 9
+#define FX_VOC8Bit 0
+#define FX_VOC16Bit 4
+
+// A VOC or WAV file that has not been prepared still starts with its
+// original signature.
+#define FX_Unprepared(voc) \
+    (((voc)->unk0 == 'C') || ((voc)->unk0 == 'R'))
+
+// A prepared file starts with the sample size of its data instead.
+#define FX_Prepared8Bit 0
+#define FX_Prepared16Bit 16
+
+// Reads a source sample scaled to 16 bits.  8 bit sources are
+// unsigned, 16 bit sources are signed.
+#define FX_SourceSample(ptr, offset, bits)                \
+    (((bits) == 16) ? (long)((short huge *)(ptr))[offset] \
+                    : ((long)((int)(unsigned char)(ptr)[offset] - 0x80) << 8))
+
+// Number of playing voices tracked for each sound
+#define FX_MaxInstances 8
+
+#define SAMPLE_UNLOADED 0
+#define SAMPLE_LOADING 1
+#define SAMPLE_READY 2
+
+typedef struct fx_sample
+{
+    struct fx_sample *next;
+    struct fx_sample *prev;
+
+    int handle;
+    int status;
+    fx_voc *voc;
+    char header[sizeof(fx_voc)];
+
+    char huge *source;
+    unsigned long sourcelength;
+    unsigned long samplerate;
+    int bits;
+
+    char huge *data;
+    unsigned long length;
+    unsigned long converted;
+    unsigned long index;
+    unsigned long fraction;
+
+    int voices[FX_MaxInstances];
+    int instances;
+    int volume;
+    int maxinstances;
+    int policy;
+
+    int queued;
+    int priority;
+} fx_sample;
+
+typedef struct
+{
+    fx_sample *start;
+    fx_sample *end;
+} fx_samplelist;
+
+static void FX_CalcFilter(unsigned long step);
+static unsigned long FX_ResampledLength(unsigned long length,
+                                        unsigned inrate, unsigned outrate);
+static unsigned long FX_Resample(char huge *to, char huge *from,
+                                 unsigned long length, unsigned long step, unsigned long *index,
+                                 unsigned long *fraction, unsigned long count, int bits);
+static int FX_ParseVOC(fx_sample *sample);
+static int FX_ParseWAV(fx_sample *sample);
+static fx_sample *FX_GetSample(int handle);
+static fx_sample *FX_FindVOC(fx_voc *voc);
+static fx_sample *FX_NewSample(fx_voc *voc);
+static int FX_EvictSamples(unsigned long length);
+static int FX_LoadSampleData(fx_sample *sample);
+static void FX_UnloadSampleData(fx_sample *sample);
+static void FX_ConvertSample(fx_sample *sample, unsigned long count);
+static int FX_CountInstances(fx_sample *sample);
+static void FX_AddInstance(fx_sample *sample, int voice, int volume);
+static int FX_CheckInstances(fx_sample *sample, int volume, int pending);
+static void FX_StartQueued(void);
+static void FX_ServiceLoader(task *Task);
+static void FX_StartLoader(void);
+static int FX_StopLoader(void);
+static void FX_FinishSample(fx_sample *sample);
+static void FX_FreeSamples(void);
+
+#endif
@@ -38,25 +38,121 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 // #define GENMIDI_DefaultVolume 100
 #define GENMIDI_DefaultVolume 90
 
-#define MAX_FORMAT 1
+#define MAX_FORMAT 2
 
 #define NUM_MIDI_CHANNELS 16
 
 #define TIME_PRECISION 16
 
+// Number of beats between the checkpoints used for seeking
+#define CHECKPOINT_BEATS 16
+
+// The sequence used by the single song functions
+#define MIDI_PrimarySequence 0
+
+#define MIDI_AllChannels 0xffff
+
+#define MIDI_NumKeys 128
+
+// Number of timbres a song can use: the melodic instruments followed
+// by the rhythm instruments
+#define MIDI_NumTimbres 256
+
+// Controllers that mark loop points: RPG Maker's loop start, and the
+// song loop start and end of Apogee's Extended MIDI
+#define MIDI_LOOP_START_ALT 111
+#define EMIDI_SONG_LOOP_START 118
+#define EMIDI_SONG_LOOP_END 119
+
+// Controllers used by Extended MIDI
+#define EMIDI_FIRST_CONTROLLER 110
+#define EMIDI_LAST_CONTROLLER 119
+
+// Marker texts that set the loop points
+#define MIDI_LoopStartMarker "loopStart"
+#define MIDI_LoopEndMarker "loopEnd"
+
+// How often the volume is updated during a fade
+#define MIDI_FadeRate 35
+#define MIDI_FadeStep (MIDI_TimerRate / MIDI_FadeRate)
+
+#define MIDI_NoVolume -1
+#define MIDI_NoValue -1
+
+#define MIDI_DefaultTempo 500000L
+
+// Frequency of the 8253 timer
+#define MIDI_TimerRate 1193182L
+
+// Longest wait between services, in ticks, so the fraction of a timer
+// count carried from one wait to the next can't overflow
+#define MIDI_MaxSleepTicks 0x7fffL
+
+// Most samples a synthesizer is asked to render at once
+#define MIDI_RenderChunk 0x1000
+#define MIDI_NoProgram 0xff
+
 #define MIDI_HEADER_SIGNATURE 0x6468544d // "MThd"
 #define MIDI_TRACK_SIGNATURE 0x6b72544d  // "MTrk"
 
+// id MUS files.  The header holds the length and start of the score.
+#define MUS_HEADER_SIGNATURE 0x1a53554d // "MUS\x1a"
+#define MUS_SCORE_LENGTH 4
+#define MUS_SCORE_START 6
+#define MUS_DIVISION 70
+#define MUS_RHYTHM_CHANNEL 15
+#define MUS_DefaultVelocity 127
+#define MUS_DELAY_FOLLOWS 0x80
+#define MUS_RELEASE_NOTE 0
+#define MUS_PLAY_NOTE 1
+#define MUS_PITCH_BEND 2
+#define MUS_SYSTEM_EVENT 3
+#define MUS_CONTROLLER 4
+#define MUS_MEASURE_END 5
+#define MUS_SCORE_END 6
+#define MUS_PROGRAM_CHANGE 0
+#define MUS_LAST_CONTROLLER 9
+#define MUS_FIRST_SYSTEM_EVENT 10
+#define MUS_LAST_SYSTEM_EVENT 14
+
+// XMIDI files are IFF files with big endian chunk lengths
+#define XMI_FORM_SIGNATURE 0x4d524f46 // "FORM"
+#define XMI_CAT_SIGNATURE 0x20544143  // "CAT "
+#define XMI_XDIR_SIGNATURE 0x52494458 // "XDIR"
+#define XMI_XMID_SIGNATURE 0x44494d58 // "XMID"
+#define XMI_EVNT_SIGNATURE 0x544e5645 // "EVNT"
+#define XMI_DIVISION 60
+
+// Most XMIDI notes that can be playing at once
+#define XMI_MaxNotes 256
+
+#define MIDI_BANK_SELECT_MSB 0
+#define MIDI_MODULATION 1
+#define MIDI_BREATH 2
+#define MIDI_FOOT 4
 #define MIDI_VOLUME 7
+#define MIDI_BALANCE 8
 #define MIDI_PAN 10
+#define MIDI_EXPRESSION 11
+#define MIDI_BANK_SELECT_LSB 32
+#define MIDI_SUSTAIN 64
+#define MIDI_SOFT_PEDAL 67
+#define MIDI_REVERB 91
+#define MIDI_CHORUS 93
 #define MIDI_DETUNE 94
 #define MIDI_RHYTHM_CHANNEL 9
 #define MIDI_RPN_MSB 100
 #define MIDI_RPN_LSB 101
+#define MIDI_DATA_INCREMENT 96
+#define MIDI_DATA_DECREMENT 97
+#define MIDI_NRPN_LSB 98
+#define MIDI_NRPN_MSB 99
+#define MIDI_FIRST_MODE_MESSAGE 120
 #define MIDI_DATAENTRY_MSB 6
 #define MIDI_DATAENTRY_LSB 38
 #define MIDI_PITCHBEND_MSB 0
 #define MIDI_PITCHBEND_LSB 0
+#define MIDI_RPN_NULL 127
 #define MIDI_RUNNING_STATUS 0x80
 #define MIDI_NOTE_OFF 0x8
 #define MIDI_NOTE_ON 0x9
@@ -68,13 +164,20 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define MIDI_SPECIAL 0xF
 #define MIDI_SYSEX 0xF0
 #define MIDI_SYSEX_CONTINUE 0xF7
+#define MIDI_MaxSysExLength 0x7fff
 #define MIDI_META_EVENT 0xFF
 #define MIDI_END_OF_TRACK 0x2F
 #define MIDI_TEMPO_CHANGE 0x51
 #define MIDI_TIME_SIGNATURE 0x58
+#define MIDI_TEXT 0x01
+#define MIDI_LYRIC 0x05
+#define MIDI_MARKER 0x06
+#define MIDI_CUE_POINT 0x07
+#define MIDI_ALL_SOUNDS_OFF 0x78
 #define MIDI_RESET_ALL_CONTROLLERS 0x79
 #define MIDI_ALL_NOTES_OFF 0x7b
 #define MIDI_MONO_MODE_ON 0x7E
+#define MIDI_POLY_MODE_ON 0x7F
 #define MIDI_SYSTEM_RESET 0xFF
 
 #define GET_NEXT_EVENT(track, data) (data) = (*(track->pos++))
@@ -82,23 +185,262 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define GET_MIDI_CHANNEL(event) ((event) & 0xf)
 #define GET_MIDI_COMMAND(event) ((event) >> 4)
 
+// Thinning marks the events it removes with this status before it
+// packs the event list.
+#define MIDI_THINNED_EVENT 0
+
+// Controllers tracked by the thinning pass: the 128 controllers,
+// followed by pitch bend
+#define MIDI_NumControls 129
+#define MIDI_BendControl 128
+
+// Number of text meta events that can wait for the game to collect
+// them.  Must be a power of two.
+#define MIDI_MetaQueueSize 32
+
+// Number of controls that are thinned out when they change quickly
+#define MIDI_NumRampControls 8
+
+// A MIDI event with its absolute time in ticks.  Channel events keep
+// their status and data bytes.  Meta events have a status of
+// MIDI_META_EVENT and the meta type in data1, with any value in param.
 typedef struct
 {
-    void *next;
-    void *prev;
-    long delay;
+    unsigned long time;
+    unsigned char status;
+    unsigned char data1;
+    unsigned char data2;
+    unsigned long param;
+} midievent;
+
+typedef struct
+{
+    unsigned long base;
+    unsigned long time;
     short active;
+    short pending;
     short RunningStatus;
     unsigned char *start;
     unsigned char *pos;
+    unsigned char *end;
+    midievent event;
 } track;
 
+// A note of an XMIDI song waiting for its note off
+typedef struct
+{
+    unsigned long time;
+    unsigned char channel;
+    unsigned char key;
+} xminote;
+
+// The time at which the song changes tempo.  The remainder holds the
+// part of a millisecond left over, in 1/(1000 * division) milliseconds.
+typedef struct
+{
+    unsigned long tick;
+    unsigned long tempo;
+    unsigned long milliseconds;
+    unsigned long remainder;
+} tempoentry;
+
+// Settings of a MIDI channel that have to be restored after a seek
+typedef struct
+{
+    unsigned char program;
+    unsigned char volume;
+    unsigned char pan;
+    unsigned char bendlsb;
+    unsigned char bendmsb;
+    unsigned char rpnmsb;
+    unsigned char rpnlsb;
+    unsigned char rangemsb;
+    unsigned char rangelsb;
+} midichannel;
+
+// The state of the song at a given tick
+typedef struct
+{
+    unsigned long tick;
+    long event;
+    unsigned long tempo;
+    unsigned int measure;
+    unsigned int beat;
+    unsigned int beattick;
+    unsigned int beatspermeasure;
+    unsigned int ticksperbeat;
+    midichannel channel[NUM_MIDI_CHANNELS];
+} midistate;
+
+// A volume fade.  Times are in timer counts.  The volume is only
+// updated every MIDI_FadeStep counts, however often the task runs.
+typedef struct
+{
+    int active;
+    int stop;
+    int start;
+    int target;
+    unsigned long length;
+    unsigned long elapsed;
+    unsigned long wait;
+} midifade;
+
+// Channels of a sequence that don't play notes, either because they
+// are muted or because other channels are soloed.
+#define MIDI_SilentChannels(Song) \
+    ((Song)->muted | (((Song)->solo != 0) ? ~(Song)->solo : 0))
+
+// The state of the thinning pass.  The value of each control is the
+// one the device will have, from the last event kept.  Controls that
+// ramp also remember when their last event was kept, and which event
+// was last removed from the ramp, so that the final value of a ramp
+// can be put back.
+typedef struct
+{
+    int value[NUM_MIDI_CHANNELS][MIDI_NumControls];
+    unsigned long kept[NUM_MIDI_CHANNELS][MIDI_NumRampControls];
+    long pending[NUM_MIDI_CHANNELS][MIDI_NumRampControls];
+} midithin;
+
+// A song compiled and ready to play.  A song played straight from
+// its file is compiled into the sequence that plays it, while a
+// prepared song is kept until it is freed and can be played by any
+// number of sequences.
+typedef struct
+{
+    int loaded;
+    unsigned char *data;
+    int division;
+    unsigned channels;
+
+    midievent huge *Events;
+    long numevents;
+
+    tempoentry huge *TempoMap;
+    long numtempos;
+    midistate huge *Checkpoints;
+    long numcheckpoints;
+    unsigned long checkpointticks;
+
+    unsigned long loopstart;
+    unsigned long loopend;
+    midistate LoopStart;
+    midistate LoopEnd;
+
+    // One bit for each timbre the song uses
+    unsigned char timbres[MIDI_NumTimbres / 8];
+} midisong;
+
+// A prepared song waiting to replace the song of a sequence when it
+// reaches a given tick.  A song the sequence compiled itself is kept
+// as retired after the switch, until it can be freed outside of the
+// timer interrupt.
+typedef struct
+{
+    int active;
+    midisong *Music;
+    unsigned long tick;
+    int loop;
+    midistate Start;
+    midisong Retired;
+} miditransition;
+
+// A song playing on its own task.  Several songs can play at once,
+// each with its own volume.
+typedef struct
+{
+    int loaded;
+    int active;
+    int loop;
+    task *PlayRoutine;
+    midisong Music;
+    midisong *Prepared;
+    long eventindex;
+
+    unsigned long tick;
+    unsigned long sleepticks;
+    unsigned long clock;
+    unsigned long tempo;
+    unsigned long ticklength;
+    unsigned long tickfraction;
+    unsigned long timefraction;
+
+    int volume;
+    int ChannelVolume[NUM_MIDI_CHANNELS];
+    int ChannelGain[NUM_MIDI_CHANNELS];
+    unsigned muted;
+    unsigned solo;
+
+    // Transposition applied to each note that is playing, so that its
+    // note off goes to the same key after the transposition changes.
+    signed char NoteShift[NUM_MIDI_CHANNELS][MIDI_NumKeys];
+
+    midifade fade;
+    miditransition Transition;
+} sequence;
+
 static long _MIDI_ReadNumber(void *from, size_t size);
 static long _MIDI_ReadDelta(track *ptr);
-static void _MIDI_ResetTracks(void);
-static void _MIDI_SysEx(track *Track);
+static void _MIDI_ResetTrack(track *ptr);
+static int _MIDI_ReadEvent(midisong *Music, track *Track);
+static int _MIDI_CompileSong(midisong *Music, track *tracks, int numtracks, int format);
+static void _MIDI_EndSong(midisong *Music, unsigned long songend);
+static void _MIDI_StoreEvent(midisong *Music, midievent *Event);
+static int _MIDI_CompileSMF(midisong *Music, unsigned char *song);
+static unsigned long _MIDI_ReadMUS(midisong *Music, track *Track);
+static int _MIDI_CompileMUS(midisong *Music, unsigned char *song);
+static void _MIDI_XMINoteOffs(midisong *Music, xminote *Notes, int *numnotes, unsigned long time);
+static unsigned long _MIDI_ReadXMI(midisong *Music, track *Track, xminote *Notes);
+static int _MIDI_FindXMIEvents(unsigned char *song, track *Track);
+static int _MIDI_CompileXMI(midisong *Music, unsigned char *song);
+static int _MIDI_ThinControl(midievent huge *Event);
+static int _MIDI_RampSlot(int control);
+static void _MIDI_KeepThinned(midisong *Music, midithin *Thin, int channel, int slot);
+static int _MIDI_ThinEvents(midisong *Music);
+static void _MIDI_InitState(midisong *Music, midistate *state);
+static void _MIDI_AdvanceState(midistate *state, unsigned long tick);
+static void _MIDI_ApplyEvent(midisong *Music, midistate *state, midievent huge *Event);
+static int _MIDI_BuildCheckpoints(midisong *Music);
+static void _MIDI_GetState(midisong *Music, midistate *state, unsigned long tick);
+static void _MIDI_SendState(sequence *Song, midistate *from, midistate *to);
+static int _MIDI_MatchText(unsigned char *text, int length, char *name);
+static void _MIDI_FindLoop(midisong *Music);
+static void _MIDI_LoopSong(sequence *Song, midistate *from);
+static unsigned long _MIDI_NextBoundary(midisong *Music, unsigned long tick, int boundary);
+static void _MIDI_Transition(sequence *Song);
+static unsigned long _MIDI_MulDiv(unsigned long a, unsigned long b,
+                                  long offset, unsigned long divisor, unsigned long *remainder);
+static int _MIDI_BuildTempoMap(midisong *Music);
+static tempoentry huge *_MIDI_FindTempo(midisong *Music, unsigned long tick);
+static unsigned long _MIDI_TickToTime(midisong *Music, unsigned long tick);
+static unsigned long _MIDI_TimeToTick(midisong *Music, unsigned long milliseconds);
+static void _MIDI_SetTempo(sequence *Song, unsigned long tempo);
+static int _MIDI_TransposeNote(sequence *Song, int channel, int key, int noteon);
+static unsigned long _MIDI_CurrentTick(sequence *Song);
+static int _MIDI_SysEx(midisong *Music, track *Track);
+static void _MIDI_StartFade(midifade *Fade, int start, int target,
+                            int milliseconds, int stopflag);
+static int _MIDI_StepFade(midifade *Fade, unsigned long elapsed, int *volume);
+static void _MIDI_ServiceFade(sequence *Song, unsigned long elapsed);
+static void _MIDI_ApplyVolume(int volume);
 static void _MIDI_ServiceRoutine(task *Task);
-static void _MIDI_SetChannelVolume(int channel, int volume);
-static void _MIDI_SendChannelVolumes(void);
+static unsigned long _MIDI_ServiceSequence(sequence *Song, unsigned long elapsed);
+static void _MIDI_NotesOff(unsigned channels);
+static void _MIDI_ResetChannels(sequence *Song, unsigned channels);
+static void _MIDI_SetChannelVolume(sequence *Song, int channel, int volume);
+static void _MIDI_SendChannelVolumes(sequence *Song);
+static int _MIDI_ScaleVolume(sequence *Song, int channel, int volume);
+static void _MIDI_SetSilence(sequence *Song, unsigned muted, unsigned solo);
+static int _MIDI_PrepareSong(midisong *Music, unsigned char *song);
+static void _MIDI_FreeSong(midisong *Music);
+static int _MIDI_StartSequence(sequence *Song, int loopflag);
+static void _MIDI_InitSequence(sequence *Song, int loopflag);
+static void _MIDI_FreeSequence(sequence *Song);
+static void _MIDI_FindTimbres(midisong *Music);
+static void _MIDI_LoadTimbres(midisong *Music);
+static sequence *_MIDI_GetSequence(int handle);
+static void _MIDI_QueueMeta(sequence *Song, midievent huge *Event);
+static midisong *_MIDI_GetPreparedSong(int handle);
+static void _MIDI_WakeSooner(sequence *Song, unsigned long counts);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,91 @@
+/*
+Copyright (C) 1994-1995 Apogee Software, Ltd.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+/**********************************************************************
+   module: _MIDIREC.H
+
+   Private header for MIDIREC.C
+**********************************************************************/
+
+#ifndef ___MIDIREC_H
+#define ___MIDIREC_H
+
+// Number of calls kept.  Must be a power of 2.  Once it is full, the
+// oldest calls are overwritten.
+#define MIDIREC_BufferSize 1024
+
+// A trace starts with its signature and number of records.  Each
+// record is followed by the data of a system exclusive message.
+#define MIDIREC_TraceSignature 0x4d526563L // "MRec"
+#define MIDIREC_HeaderSize 8
+#define MIDIREC_RecordSize 13
+
+// Saved MIDI files have one tick for every 1193 timer counts, which
+// is one millisecond at this tempo and division.
+#define MIDIREC_CountsPerTick 1193
+#define MIDIREC_Division 1000
+#define MIDIREC_Tempo 999848L
+#define MIDIREC_MaxDelta 0x0fffffffL
+
+#define MIDIREC_MidiHeader 0x4d546864L // "MThd"
+#define MIDIREC_MidiTrack 0x4d54726bL  // "MTrk"
+
+#define MIDI_META_EVENT 0xFF
+#define MIDI_END_OF_TRACK 0x2F
+#define MIDI_TEMPO_CHANGE 0x51
+
+// A call to a MIDI routine.  The data of a system exclusive message
+// is not copied, so the song must stay loaded until it is saved.  Its
+// length is kept in the two data bytes.
+typedef struct
+{
+    unsigned long clock;
+    unsigned long tick;
+    signed char sequence;
+    unsigned char call;
+    unsigned char channel;
+    unsigned char data1;
+    unsigned char data2;
+    unsigned char *data;
+} midirecord;
+
+static void MIDIREC_AddRecord(int call, int channel, int data1, int data2, unsigned char *data);
+static void MIDIREC_RecordNoteOff(int channel, int key, int velocity);
+static void MIDIREC_RecordNoteOn(int channel, int key, int velocity);
+static void MIDIREC_RecordPolyAftertouch(int channel, int key, int pressure);
+static void MIDIREC_RecordControlChange(int channel, int number, int value);
+static void MIDIREC_RecordProgramChange(int channel, int program);
+static void MIDIREC_RecordChannelAftertouch(int channel, int pressure);
+static void MIDIREC_RecordPitchBend(int channel, int lsb, int msb);
+static void MIDIREC_RecordReleasePatches(void);
+static void MIDIREC_RecordLoadPatch(int number);
+static void MIDIREC_RecordSetVolume(int volume);
+static void MIDIREC_RecordSysEx(int status, unsigned char *data, int length);
+static midirecord *MIDIREC_GetRecord(long index);
+static unsigned char *MIDIREC_WriteNumber(unsigned char *ptr, unsigned long number, int size);
+static unsigned long MIDIREC_ReadNumber(unsigned char *ptr, int size);
+static unsigned char *MIDIREC_WriteDelta(unsigned char *ptr, unsigned long delta);
+static long MIDIREC_Output(unsigned char *buffer, long length, unsigned char *data, int count);
+static long MIDIREC_WriteTrace(unsigned char *buffer);
+static long MIDIREC_WriteMidi(unsigned char *buffer);
+static unsigned char *MIDIREC_ReadRecord(unsigned char *ptr, midirecord *record);
+static void MIDIREC_SendRecord(midifuncs *funcs, midirecord *record);
+static void MIDIREC_ServiceReplay(task *Task);
+
+#endif
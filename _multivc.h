@@ -49,6 +49,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define T_16BITSOURCE 4
 #define T_LEFTQUIET 8
 #define T_RIGHTQUIET 16
+#define T_STREAM 32
 #define T_DEFAULT T_SIXTEENBIT_STEREO
 
 #define SILENCE_16BIT 0
@@ -71,11 +72,22 @@ typedef struct VoiceNode
     int Active[NumberOfBuffers];
     int handle;
     int priority;
+    int volume;
+    int Volume[NumberOfBuffers];
+    int flags;
+
+    void (*StreamFunction)(char *buffer, int length);
 } VoiceNode;
 
 static void MV_ServiceVoc(void);
+static void MV_StopEngine(void);
 static VoiceNode *MV_GetVoice(int handle);
 static VoiceNode *MV_AllocVoice(int priority);
+static void MV_CalcVolume(void);
+static void MV_Mix8BitVolume(char *to, char *from, int len, short *table, int arg2);
+static void MV_Mix16BitVolume(short *to, char *from, int len, short *table, int arg2);
+static void MV_Mix8Bit16Source(char *to, short *from, int len, int volume, int arg2);
+static void MV_Mix16Bit16Source(short *to, short *from, int len, int volume, int shift, int arg2);
 void sub_2A110(char *to, char *from, int len);
 void sub_2A1B1(char *to, char *from, int len);
 void sub_2A252(char *to, char *from, int len, int shift);
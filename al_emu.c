@@ -0,0 +1,1119 @@
+/*
+Copyright (C) 1994-1995 Apogee Software, Ltd.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+/**********************************************************************
+   module: AL_EMU.C
+
+   Software emulation of the Yamaha OPL2 and OPL3 FM synthesizers.
+   AL_MIDI.C writes its registers here instead of to the card when no
+   FM chip is present, and the output is played as a MultiVoc stream.
+   EMU_Render can also be used directly by MIDI_RenderSong to turn a
+   song into a sample buffer.
+
+   Rhythm mode and 4 operator channels are not emulated since the
+   Adlib driver never uses them.
+**********************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <alloc.h>
+#include <dos.h>
+#include "interrup.h"
+#include "multivoc.h"
+#include "al_emu.h"
+#include "_al_emu.h"
+
+#define TRUE (1 == 1)
+#define FALSE (!TRUE)
+
+static int EMU_Installed = FALSE;
+static unsigned EMU_Rate = EMU_DefaultRate;
+static int EMU_StreamHandle = 0;
+static volatile int EMU_Paused = FALSE;
+static char EMU_StreamBuffer[MV_StreamBufferSize];
+
+// Tables
+static short *EMU_Waves = NULL;
+static unsigned short *EMU_Gain = NULL;
+static unsigned long EMU_PhaseStep;
+static unsigned long EMU_AttackStep[EMU_NumRates];
+static unsigned long EMU_DecayStep[EMU_NumRates];
+static unsigned long EMU_TremoloStep;
+static unsigned long EMU_VibratoStep;
+static long EMU_Mix[EMU_BlockSize];
+
+static const unsigned char EMU_Multiply[16] =
+{
+    1, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 20, 24, 24, 30, 30
+};
+
+static const unsigned char EMU_KSLTable[16] =
+{
+    0, 32, 40, 45, 48, 51, 53, 55, 56, 58, 59, 60, 61, 62, 63, 64
+};
+
+static const unsigned char EMU_KSLShift[4] =
+{
+    8, 1, 2, 0
+};
+
+// Operator register offsets within a bank, and the channel each
+// operator belongs to.
+static const signed char EMU_OffsetSlot[32] =
+{
+    0, 1, 2, 3, 4, 5, -1, -1, 6, 7, 8, 9, 10, 11, -1, -1,
+    12, 13, 14, 15, 16, 17, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+};
+
+static const unsigned char EMU_SlotOffset[EMU_BankOperators] =
+{
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x08, 0x09, 0x0a,
+    0x0b, 0x0c, 0x0d, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15
+};
+
+static const unsigned char EMU_SlotChannel[EMU_BankOperators] =
+{
+    0, 1, 2, 0, 1, 2, 3, 4, 5, 3, 4, 5, 6, 7, 8, 6, 7, 8
+};
+
+static const unsigned char EMU_ChannelSlot[EMU_BankChannels] =
+{
+    0, 1, 2, 6, 7, 8, 12, 13, 14
+};
+
+// Chip state
+static unsigned char EMU_Registers[EMU_NumBanks][256];
+static int EMU_OPL3;
+static int EMU_WaveSelect;
+static int EMU_NoteSelect;
+static int EMU_TremoloShift;
+static int EMU_VibratoShift;
+static unsigned long EMU_TremoloPhase;
+static unsigned long EMU_VibratoPhase;
+static int EMU_TremoloLevel;
+static int EMU_VibratoPosition;
+
+// Operators are kept as parallel arrays so that each pass over them
+// touches only the fields it needs.
+static unsigned long EMU_Phase[EMU_NumOperators];
+static unsigned long EMU_PhaseInc[EMU_NumOperators];
+static unsigned long EMU_VibratoInc[EMU_NumOperators];
+static int EMU_VibratoRange[EMU_NumOperators];
+static long EMU_Level[EMU_NumOperators];
+static long EMU_SustainLevel[EMU_NumOperators];
+static int EMU_TotalLevel[EMU_NumOperators];
+static unsigned char EMU_State[EMU_NumOperators];
+static unsigned char EMU_AttackRate[EMU_NumOperators];
+static unsigned char EMU_DecayRate[EMU_NumOperators];
+static unsigned char EMU_ReleaseRate[EMU_NumOperators];
+static unsigned char EMU_Flags[EMU_NumOperators];
+static short *EMU_Wave[EMU_NumOperators];
+static unsigned short EMU_OpGain[EMU_NumOperators];
+
+// Channels
+static int EMU_FNumber[EMU_NumChannels];
+static int EMU_Block[EMU_NumChannels];
+static int EMU_Keyed[EMU_NumChannels];
+static int EMU_Feedback[EMU_NumChannels];
+static int EMU_Additive[EMU_NumChannels];
+static int EMU_Weight[EMU_NumChannels];
+static int EMU_Previous1[EMU_NumChannels];
+static int EMU_Previous2[EMU_NumChannels];
+
+/*---------------------------------------------------------------------
+   Function: EMU_CalcPhase
+
+   Returns the phase increment per output sample for a frequency
+   number already shifted by the block and scaled by twice the
+   frequency multiplier.  The phase wraps at 2^32.
+---------------------------------------------------------------------*/
+
+static unsigned long EMU_CalcPhase(
+    unsigned long base)
+
+{
+    return (base * (EMU_PhaseStep >> 4) +
+            ((base * (EMU_PhaseStep & 15)) >> 4));
+}
+
+/*---------------------------------------------------------------------
+   Function: EMU_RateStep
+
+   Returns the change in envelope level per output sample for an
+   envelope that takes the specified time at rate 4 to cover the
+   whole range.
+---------------------------------------------------------------------*/
+
+static long EMU_RateStep(
+    double time,
+    int rate)
+
+{
+    double samples;
+
+    // Each step of 4 halves the time, and the two low bits go a
+    // quarter of the way to the next step.
+    samples = time * EMU_Rate / 1000.0;
+    samples /= (double)(1L << ((rate >> 2) - 1));
+    samples *= 4.0 / (4 + (rate & 3));
+
+    if (samples < 1.0)
+    {
+        samples = 1.0;
+    }
+
+    return ((long)((double)EMU_Silent / samples));
+}
+
+/*---------------------------------------------------------------------
+   Function: EMU_CalcTables
+
+   Builds the tables that depend on the output rate.
+---------------------------------------------------------------------*/
+
+static void EMU_CalcTables(
+    void)
+
+{
+    int rate;
+    double attack;
+
+    EMU_PhaseStep = (unsigned long)((EMU_ChipRate << 15) / EMU_Rate);
+    EMU_TremoloStep = (unsigned long)(EMU_TremoloRate * 4294967296.0 / EMU_Rate);
+    EMU_VibratoStep = (unsigned long)(EMU_VibratoRate * 4294967296.0 / EMU_Rate);
+
+    EMU_AttackStep[0] = 0;
+    EMU_DecayStep[0] = 0;
+    for (rate = 1; rate < 4; rate++)
+    {
+        EMU_AttackStep[rate] = 0;
+        EMU_DecayStep[rate] = 0;
+    }
+
+    for (rate = 4; rate < EMU_NumRates; rate++)
+    {
+        EMU_DecayStep[rate] = EMU_RateStep(EMU_DecayTime, rate);
+
+        // The attack is exponential.  The step is the fraction of the
+        // level removed each sample, in 16 bit fixed point.
+        attack = (double)EMU_RateStep(EMU_AttackTime, rate) / EMU_Silent;
+        attack *= 8.0;
+        if (attack > 1.0)
+        {
+            attack = 1.0;
+        }
+        EMU_AttackStep[rate] = (unsigned long)(attack * 65536.0);
+    }
+}
+
+/*---------------------------------------------------------------------
+   Function: EMU_Init
+
+   Allocates the waveform and gain tables and resets the chip.
+---------------------------------------------------------------------*/
+
+int EMU_Init(
+    void)
+
+{
+    int index;
+    int wave;
+    short *ptr;
+    short sample;
+    double value;
+
+    if (EMU_Installed)
+    {
+        EMU_Shutdown();
+    }
+
+    EMU_Waves = farmalloc(EMU_NumWaves * EMU_WaveLength * sizeof(short));
+    EMU_Gain = farmalloc((EMU_MaxAttenuation + 1) * sizeof(unsigned short));
+    if ((EMU_Waves == NULL) || (EMU_Gain == NULL))
+    {
+        farfree(EMU_Waves);
+        EMU_Waves = NULL;
+        farfree(EMU_Gain);
+        EMU_Gain = NULL;
+        return (EMU_NoMemory);
+    }
+
+    for (index = 0; index <= EMU_MaxAttenuation; index++)
+    {
+        value = pow(10.0, -index * 0.1875 / 20.0);
+        EMU_Gain[index] = (unsigned short)(value * 32767.0 + 0.5);
+    }
+    EMU_Gain[EMU_MaxAttenuation] = 0;
+
+    // The eight waveforms of the OPL3.  OPL2 only has the first four.
+    for (wave = 0; wave < EMU_NumWaves; wave++)
+    {
+        ptr = &EMU_Waves[wave * EMU_WaveLength];
+        for (index = 0; index < EMU_WaveLength; index++)
+        {
+            sample = (short)(sin(index * 2.0 * 3.14159265358979 /
+                                 EMU_WaveLength) *
+                                 EMU_WaveAmplitude +
+                             0.5);
+            switch (wave)
+            {
+            case 0:
+                // Sine
+                break;
+
+            case 1:
+                // Half sine
+                if (index >= EMU_WaveLength / 2)
+                {
+                    sample = 0;
+                }
+                break;
+
+            case 2:
+                // Absolute sine
+                sample = abs(sample);
+                break;
+
+            case 3:
+                // Quarter sine pulses
+                sample = abs(sample);
+                if (index & (EMU_WaveLength / 4))
+                {
+                    sample = 0;
+                }
+                break;
+
+            case 4:
+                // Double speed sine, first half only
+                sample = (short)(sin(index * 4.0 * 3.14159265358979 /
+                                     EMU_WaveLength) *
+                                     EMU_WaveAmplitude +
+                                 0.5);
+                if (index >= EMU_WaveLength / 2)
+                {
+                    sample = 0;
+                }
+                break;
+
+            case 5:
+                // Double speed absolute sine, first half only
+                sample = (short)(sin(index * 4.0 * 3.14159265358979 /
+                                     EMU_WaveLength) *
+                                     EMU_WaveAmplitude +
+                                 0.5);
+                sample = abs(sample);
+                if (index >= EMU_WaveLength / 2)
+                {
+                    sample = 0;
+                }
+                break;
+
+            case 6:
+                // Square
+                sample = (index < EMU_WaveLength / 2) ? EMU_WaveAmplitude
+                                                      : -EMU_WaveAmplitude;
+                break;
+
+            case 7:
+                // Exponential sawtooth
+                value = (index < EMU_WaveLength / 2) ? index
+                                                     : (EMU_WaveLength - 1 - index);
+                sample = (short)(pow(10.0, -value * 16.0 * 0.1875 / 20.0 /
+                                               (EMU_WaveLength / 2) * 8.0) *
+                                 EMU_WaveAmplitude);
+                if (index >= EMU_WaveLength / 2)
+                {
+                    sample = -sample;
+                }
+                break;
+            }
+            ptr[index] = sample;
+        }
+    }
+
+    EMU_Installed = TRUE;
+    EMU_SetRate(EMU_Rate);
+    EMU_Reset();
+
+    return (EMU_Ok);
+}
+
+/*---------------------------------------------------------------------
+   Function: EMU_Shutdown
+
+   Stops the stream and frees the tables.
+---------------------------------------------------------------------*/
+
+void EMU_Shutdown(
+    void)
+
+{
+    if (!EMU_Installed)
+    {
+        return;
+    }
+
+    EMU_StopStream();
+
+    farfree(EMU_Waves);
+    EMU_Waves = NULL;
+    farfree(EMU_Gain);
+    EMU_Gain = NULL;
+
+    EMU_Installed = FALSE;
+}
+
+/*---------------------------------------------------------------------
+   Function: EMU_Reset
+
+   Clears all of the registers and silences every operator.
+---------------------------------------------------------------------*/
+
+void EMU_Reset(
+    void)
+
+{
+    int op;
+    int channel;
+
+    if (!EMU_Installed)
+    {
+        return;
+    }
+
+    DISABLE_INTERRUPTS();
+
+    memset(EMU_Registers, 0, sizeof(EMU_Registers));
+    EMU_OPL3 = FALSE;
+    EMU_WaveSelect = FALSE;
+    EMU_NoteSelect = FALSE;
+    EMU_TremoloShift = 2;
+    EMU_VibratoShift = 1;
+    EMU_TremoloPhase = 0;
+    EMU_VibratoPhase = 0;
+    EMU_TremoloLevel = 0;
+    EMU_VibratoPosition = 0;
+
+    for (channel = 0; channel < EMU_NumChannels; channel++)
+    {
+        EMU_Keyed[channel] = FALSE;
+        EMU_Previous1[channel] = 0;
+        EMU_Previous2[channel] = 0;
+        EMU_UpdateChannel(channel);
+    }
+
+    for (op = 0; op < EMU_NumOperators; op++)
+    {
+        EMU_Phase[op] = 0;
+        EMU_Level[op] = EMU_Silent;
+        EMU_State[op] = EMU_Off;
+        EMU_OpGain[op] = 0;
+    }
+
+    ENABLE_INTERRUPTS();
+}
+
+/*---------------------------------------------------------------------
+   Function: EMU_SetRate
+
+   Sets the sample rate that EMU_Render produces.
+---------------------------------------------------------------------*/
+
+void EMU_SetRate(
+    unsigned rate)
+
+{
+    int op;
+
+    if (rate == 0)
+    {
+        rate = EMU_DefaultRate;
+    }
+
+    DISABLE_INTERRUPTS();
+
+    EMU_Rate = rate;
+    if (EMU_Installed)
+    {
+        EMU_CalcTables();
+        for (op = 0; op < EMU_NumOperators; op++)
+        {
+            EMU_UpdateOperator(op);
+        }
+    }
+
+    ENABLE_INTERRUPTS();
+}
+
+/*---------------------------------------------------------------------
+   Function: EMU_GetRate
+
+   Returns the sample rate that EMU_Render produces.
+---------------------------------------------------------------------*/
+
+unsigned EMU_GetRate(
+    void)
+
+{
+    return (EMU_Rate);
+}
+
+/*---------------------------------------------------------------------
+   Function: EMU_UpdateOperator
+
+   Recalculates the state of an operator from its registers and the
+   frequency of its channel.
+---------------------------------------------------------------------*/
+
+static void EMU_UpdateOperator(
+    int op)
+
+{
+    int bank;
+    int offset;
+    int channel;
+    int fnum;
+    int block;
+    int rof;
+    int rate;
+    int ksl;
+    int wave;
+    unsigned char *regs;
+
+    bank = op / EMU_BankOperators;
+    offset = EMU_SlotOffset[op % EMU_BankOperators];
+    channel = bank * EMU_BankChannels + EMU_SlotChannel[op % EMU_BankOperators];
+    regs = EMU_Registers[bank];
+
+    fnum = EMU_FNumber[channel];
+    block = EMU_Block[channel];
+
+    EMU_Flags[op] = regs[0x20 + offset];
+
+    // Frequency
+    rate = EMU_Multiply[regs[0x20 + offset] & 0x0f];
+    EMU_PhaseInc[op] = EMU_CalcPhase(((unsigned long)fnum << block) * rate);
+    EMU_VibratoInc[op] = EMU_CalcPhase((1UL << block) * rate);
+    EMU_VibratoRange[op] = (fnum >> 7) & 7;
+
+    // Envelope rates, scaled by the key
+    rof = (block << 1) | ((fnum >> (EMU_NoteSelect ? 8 : 9)) & 1);
+    if (!(regs[0x20 + offset] & EMU_KeyScaleRate))
+    {
+        rof >>= 2;
+    }
+
+    rate = regs[0x60 + offset] >> 4;
+    EMU_AttackRate[op] = (rate == 0) ? 0 : min(rate * 4 + rof, EMU_NumRates - 1);
+    rate = regs[0x60 + offset] & 0x0f;
+    EMU_DecayRate[op] = (rate == 0) ? 0 : min(rate * 4 + rof, EMU_NumRates - 1);
+    rate = regs[0x80 + offset] & 0x0f;
+    EMU_ReleaseRate[op] = (rate == 0) ? 0 : min(rate * 4 + rof, EMU_NumRates - 1);
+
+    rate = regs[0x80 + offset] >> 4;
+    if (rate == 15)
+    {
+        rate = 31;
+    }
+    EMU_SustainLevel[op] = (long)(rate << 4) << EMU_LevelShift;
+
+    // Output level and key scaling
+    ksl = (EMU_KSLTable[fnum >> 6] << 2) - ((8 - block) << 5);
+    if (ksl < 0)
+    {
+        ksl = 0;
+    }
+    EMU_TotalLevel[op] = ((regs[0x40 + offset] & 0x3f) << 2) +
+                         (ksl >> EMU_KSLShift[regs[0x40 + offset] >> 6]);
+
+    // Waveform
+    wave = 0;
+    if (EMU_OPL3)
+    {
+        wave = regs[0xe0 + offset] & 7;
+    }
+    else if (EMU_WaveSelect)
+    {
+        wave = regs[0xe0 + offset] & 3;
+    }
+    EMU_Wave[op] = &EMU_Waves[wave * EMU_WaveLength];
+}
+
+/*---------------------------------------------------------------------
+   Function: EMU_UpdateChannel
+
+   Recalculates the state of a channel from its registers, and starts
+   or releases its operators when the key changes.
+---------------------------------------------------------------------*/
+
+static void EMU_UpdateChannel(
+    int channel)
+
+{
+    int bank;
+    int index;
+    int op;
+    int keyon;
+    unsigned char *regs;
+
+    bank = channel / EMU_BankChannels;
+    index = channel % EMU_BankChannels;
+    regs = EMU_Registers[bank];
+
+    EMU_FNumber[channel] = regs[0xa0 + index] | ((regs[0xb0 + index] & 3) << 8);
+    EMU_Block[channel] = (regs[0xb0 + index] >> 2) & 7;
+    EMU_Feedback[channel] = (regs[0xc0 + index] >> 1) & 7;
+    EMU_Additive[channel] = regs[0xc0 + index] & 1;
+
+    // Weights are in half steps so that a voice played on both sides
+    // of an OPL3 is as loud as one played on an OPL2.
+    if (EMU_OPL3)
+    {
+        EMU_Weight[channel] = ((regs[0xc0 + index] & EMU_LeftOutput) ? 1 : 0) +
+                              ((regs[0xc0 + index] & EMU_RightOutput) ? 1 : 0);
+    }
+    else
+    {
+        // The second bank of an OPL2 pair is a separate chip
+        EMU_Weight[channel] = 2;
+    }
+
+    op = bank * EMU_BankOperators + EMU_ChannelSlot[index];
+    EMU_UpdateOperator(op);
+    EMU_UpdateOperator(op + 3);
+
+    keyon = (regs[0xb0 + index] & EMU_KeyOn) != 0;
+    if (keyon && !EMU_Keyed[channel])
+    {
+        EMU_Phase[op] = 0;
+        EMU_Phase[op + 3] = 0;
+        EMU_State[op] = EMU_Attack;
+        EMU_State[op + 3] = EMU_Attack;
+        EMU_Previous1[channel] = 0;
+        EMU_Previous2[channel] = 0;
+    }
+    else if (!keyon && EMU_Keyed[channel])
+    {
+        if (EMU_State[op] != EMU_Off)
+        {
+            EMU_State[op] = EMU_Release;
+        }
+        if (EMU_State[op + 3] != EMU_Off)
+        {
+            EMU_State[op + 3] = EMU_Release;
+        }
+    }
+    EMU_Keyed[channel] = keyon;
+}
+
+/*---------------------------------------------------------------------
+   Function: EMU_WritePort
+
+   Writes a value to a register of the emulated chip.  Ports with bit
+   1 set address the second register bank, as the right port of an
+   OPL3 does.
+---------------------------------------------------------------------*/
+
+void EMU_WritePort(
+    int port,
+    int reg,
+    int data)
+
+{
+    int bank;
+    int slot;
+    int channel;
+
+    if (!EMU_Installed)
+    {
+        return;
+    }
+
+    bank = (port & 2) ? 1 : 0;
+    reg &= 0xff;
+    data &= 0xff;
+
+    DISABLE_INTERRUPTS();
+
+    EMU_Registers[bank][reg] = data;
+
+    switch (reg & 0xe0)
+    {
+    case 0x00:
+        if ((bank == 0) && (reg == 0x01))
+        {
+            EMU_WaveSelect = (data & EMU_WaveSelectEnable) != 0;
+            for (slot = 0; slot < EMU_NumOperators; slot++)
+            {
+                EMU_UpdateOperator(slot);
+            }
+        }
+        else if ((bank == 0) && (reg == 0x08))
+        {
+            EMU_NoteSelect = (data & EMU_NoteSelectFlag) != 0;
+            for (slot = 0; slot < EMU_NumOperators; slot++)
+            {
+                EMU_UpdateOperator(slot);
+            }
+        }
+        else if ((bank == 1) && (reg == 0x05))
+        {
+            EMU_OPL3 = (data & EMU_OPL3Enable) != 0;
+            for (channel = 0; channel < EMU_NumChannels; channel++)
+            {
+                EMU_UpdateChannel(channel);
+            }
+        }
+        break;
+
+    case 0x20:
+    case 0x40:
+    case 0x60:
+    case 0x80:
+    case 0xe0:
+        slot = EMU_OffsetSlot[reg & 0x1f];
+        if (slot >= 0)
+        {
+            EMU_UpdateOperator(bank * EMU_BankOperators + slot);
+        }
+        break;
+
+    case 0xa0:
+        if ((bank == 0) && (reg == 0xbd))
+        {
+            EMU_TremoloShift = (data & EMU_DeepTremolo) ? 0 : 2;
+            EMU_VibratoShift = (data & EMU_DeepVibrato) ? 0 : 1;
+        }
+        else if ((reg & 0x0f) < EMU_BankChannels)
+        {
+            EMU_UpdateChannel(bank * EMU_BankChannels + (reg & 0x0f));
+        }
+        break;
+
+    case 0xc0:
+        if ((reg & 0x1f) < EMU_BankChannels)
+        {
+            EMU_UpdateChannel(bank * EMU_BankChannels + (reg & 0x1f));
+        }
+        break;
+    }
+
+    ENABLE_INTERRUPTS();
+}
+
+/*---------------------------------------------------------------------
+   Function: EMU_StepLFOs
+
+   Advances the tremolo and vibrato oscillators.
+---------------------------------------------------------------------*/
+
+static void EMU_StepLFOs(
+    int count)
+
+{
+    int position;
+
+    EMU_TremoloPhase += EMU_TremoloStep * count;
+    EMU_VibratoPhase += EMU_VibratoStep * count;
+
+    // Tremolo is a triangle, vibrato a coarse eight step sine
+    position = (int)(EMU_TremoloPhase >> 24);
+    if (position >= 128)
+    {
+        position = 255 - position;
+    }
+    EMU_TremoloLevel = ((position * EMU_TremoloDepth) >> 7) >> EMU_TremoloShift;
+
+    EMU_VibratoPosition = (int)(EMU_VibratoPhase >> 29);
+}
+
+/*---------------------------------------------------------------------
+   Function: EMU_StepEnvelopes
+
+   Advances the envelope of every operator by the specified number of
+   samples and calculates the gain each will use for them.
+---------------------------------------------------------------------*/
+
+static void EMU_StepEnvelopes(
+    int count)
+
+{
+    int op;
+    int attenuation;
+    long level;
+    unsigned long step;
+
+    for (op = 0; op < EMU_NumOperators; op++)
+    {
+        level = EMU_Level[op];
+
+        switch (EMU_State[op])
+        {
+        case EMU_Off:
+            EMU_OpGain[op] = 0;
+            continue;
+
+        case EMU_Attack:
+            if (EMU_AttackRate[op] >= EMU_InstantAttack)
+            {
+                level = 0;
+            }
+            else
+            {
+                step = EMU_AttackStep[EMU_AttackRate[op]] * count;
+                if (step > 0x10000L)
+                {
+                    step = 0x10000L;
+                }
+                level -= (long)((((unsigned long)level >> 9) * step) >> 7);
+                if (level < (1L << EMU_LevelShift))
+                {
+                    level = 0;
+                }
+            }
+            if (level == 0)
+            {
+                EMU_State[op] = EMU_Decay;
+            }
+            break;
+
+        case EMU_Decay:
+            level += EMU_DecayStep[EMU_DecayRate[op]] * count;
+            if (level >= EMU_SustainLevel[op])
+            {
+                level = EMU_SustainLevel[op];
+                EMU_State[op] = EMU_Sustain;
+            }
+            break;
+
+        case EMU_Sustain:
+            // Percussive sounds keep decaying at the release rate
+            if (!(EMU_Flags[op] & EMU_Sustained))
+            {
+                level += EMU_DecayStep[EMU_ReleaseRate[op]] * count;
+            }
+            break;
+
+        case EMU_Release:
+            level += EMU_DecayStep[EMU_ReleaseRate[op]] * count;
+            break;
+        }
+
+        if (level >= EMU_Silent)
+        {
+            level = EMU_Silent;
+            if (EMU_State[op] != EMU_Attack)
+            {
+                EMU_State[op] = EMU_Off;
+            }
+        }
+        EMU_Level[op] = level;
+
+        attenuation = (int)(level >> EMU_LevelShift) + EMU_TotalLevel[op];
+        if (EMU_Flags[op] & EMU_Tremolo)
+        {
+            attenuation += EMU_TremoloLevel;
+        }
+        if (attenuation > EMU_MaxAttenuation)
+        {
+            attenuation = EMU_MaxAttenuation;
+        }
+        EMU_OpGain[op] = EMU_Gain[attenuation];
+    }
+}
+
+/*---------------------------------------------------------------------
+   Function: EMU_RenderChannel
+
+   Adds the output of a channel to the mix buffer.
+---------------------------------------------------------------------*/
+
+static void EMU_RenderChannel(
+    int channel,
+    int count)
+
+{
+    int op;
+    int index;
+    int range;
+    int feedback;
+    int modulator;
+    int carrier;
+    int previous1;
+    int previous2;
+    int weight;
+    unsigned long phase1;
+    unsigned long phase2;
+    unsigned long inc1;
+    unsigned long inc2;
+    int gain1;
+    int gain2;
+    short *wave1;
+    short *wave2;
+    long *mix;
+
+    op = (channel / EMU_BankChannels) * EMU_BankOperators +
+         EMU_ChannelSlot[channel % EMU_BankChannels];
+
+    inc1 = EMU_PhaseInc[op];
+    inc2 = EMU_PhaseInc[op + 3];
+
+    // Vibrato moves the frequency number by up to 1/128 of its value
+    range = 0;
+    if (EMU_VibratoPosition & 3)
+    {
+        range = EMU_VibratoRange[op];
+        if (EMU_VibratoPosition & 1)
+        {
+            range >>= 1;
+        }
+        range >>= EMU_VibratoShift;
+        if (EMU_VibratoPosition & 4)
+        {
+            range = -range;
+        }
+    }
+    if (range != 0)
+    {
+        if (EMU_Flags[op] & EMU_Vibrato)
+        {
+            inc1 += EMU_VibratoInc[op] * range;
+        }
+        if (EMU_Flags[op + 3] & EMU_Vibrato)
+        {
+            inc2 += EMU_VibratoInc[op + 3] * range;
+        }
+    }
+
+    gain1 = EMU_OpGain[op];
+    gain2 = EMU_OpGain[op + 3];
+    weight = EMU_Weight[channel];
+
+    // Skip channels that can't be heard, but keep their phase moving
+    if ((weight == 0) || ((gain2 == 0) &&
+                          ((gain1 == 0) || !EMU_Additive[channel])))
+    {
+        EMU_Phase[op] += inc1 * count;
+        EMU_Phase[op + 3] += inc2 * count;
+        return;
+    }
+
+    phase1 = EMU_Phase[op];
+    phase2 = EMU_Phase[op + 3];
+    wave1 = EMU_Wave[op];
+    wave2 = EMU_Wave[op + 3];
+    previous1 = EMU_Previous1[channel];
+    previous2 = EMU_Previous2[channel];
+    feedback = EMU_Feedback[channel];
+    mix = EMU_Mix;
+
+    for (index = 0; index < count; index++)
+    {
+        phase1 += inc1;
+        phase2 += inc2;
+
+        modulator = 0;
+        if (feedback)
+        {
+            modulator = (previous1 + previous2) >> (9 - feedback);
+        }
+        modulator = (int)(((long)wave1[((int)(phase1 >> EMU_WaveShift) + modulator) &
+                                       EMU_WaveMask] *
+                           gain1) >>
+                          15);
+        previous2 = previous1;
+        previous1 = modulator;
+
+        if (EMU_Additive[channel])
+        {
+            carrier = (int)(((long)wave2[(int)(phase2 >> EMU_WaveShift)] * gain2) >> 15);
+            carrier += modulator;
+        }
+        else
+        {
+            carrier = (int)(((long)wave2[((int)(phase2 >> EMU_WaveShift) + modulator) &
+                                         EMU_WaveMask] *
+                             gain2) >>
+                            15);
+        }
+
+        *mix++ += (long)carrier * weight;
+    }
+
+    EMU_Phase[op] = phase1;
+    EMU_Phase[op + 3] = phase2;
+    EMU_Previous1[channel] = previous1;
+    EMU_Previous2[channel] = previous2;
+}
+
+/*---------------------------------------------------------------------
+   Function: EMU_Render
+
+   Generates the specified number of 16 bit signed mono samples from
+   the current state of the chip.
+---------------------------------------------------------------------*/
+
+void EMU_Render(
+    char huge *buffer,
+    unsigned samples)
+
+{
+    short huge *to;
+    int count;
+    int index;
+    int channel;
+    int channels;
+    long sample;
+
+    to = (short huge *)buffer;
+
+    if (!EMU_Installed)
+    {
+        for (; samples > 0; samples--)
+        {
+            *to++ = 0;
+        }
+        return;
+    }
+
+    channels = EMU_OPL3 ? EMU_NumChannels : EMU_BankChannels;
+
+    while (samples > 0)
+    {
+        count = (int)min(samples, EMU_BlockSize);
+
+        EMU_StepLFOs(count);
+        EMU_StepEnvelopes(count);
+
+        memset(EMU_Mix, 0, count * sizeof(long));
+        for (channel = 0; channel < channels; channel++)
+        {
+            EMU_RenderChannel(channel, count);
+        }
+
+        for (index = 0; index < count; index++)
+        {
+            sample = EMU_Mix[index];
+            if (sample > 32767L)
+            {
+                sample = 32767L;
+            }
+            else if (sample < -32768L)
+            {
+                sample = -32768L;
+            }
+            *to++ = (short)sample;
+        }
+
+        samples -= count;
+    }
+}
+
+/*---------------------------------------------------------------------
+   Function: EMU_ServiceStream
+
+   Called by MultiVoc to fill the next part of the stream.
+---------------------------------------------------------------------*/
+
+static void EMU_ServiceStream(
+    char *buffer,
+    int length)
+
+{
+    if (EMU_Paused)
+    {
+        memset(buffer, 0, length * sizeof(short));
+        return;
+    }
+
+    EMU_Render(buffer, length);
+}
+
+/*---------------------------------------------------------------------
+   Function: EMU_StartStream
+
+   Begins playing the output of the emulator through MultiVoc at its
+   mixing rate.
+---------------------------------------------------------------------*/
+
+int EMU_StartStream(
+    int priority)
+
+{
+    int handle;
+
+    if (!EMU_Installed)
+    {
+        return (EMU_NotInstalled);
+    }
+
+    EMU_StopStream();
+
+    // Stay silent until the rate is known
+    EMU_Paused = TRUE;
+    handle = MV_PlayStream(EMU_StreamBuffer, EMU_ServiceStream, priority);
+    if (handle < MV_Ok)
+    {
+        EMU_Paused = FALSE;
+        return (EMU_NoStream);
+    }
+
+    EMU_StreamHandle = handle;
+    EMU_SetRate(MV_GetMixRate());
+    EMU_Paused = FALSE;
+
+    return (EMU_Ok);
+}
+
+/*---------------------------------------------------------------------
+   Function: EMU_StopStream
+
+   Ends the MultiVoc stream started by EMU_StartStream.  If MultiVoc
+   was shut down or restarted since, the handle may now belong to
+   another voice, so only a stream is stopped.
+---------------------------------------------------------------------*/
+
+void EMU_StopStream(
+    void)
+
+{
+    if (EMU_StreamHandle != 0)
+    {
+        if (MV_StreamPlaying(EMU_StreamHandle))
+        {
+            MV_Kill(EMU_StreamHandle);
+        }
+        EMU_StreamHandle = 0;
+    }
+}
+
+/*---------------------------------------------------------------------
+   Function: EMU_PauseStream
+
+   Silences the stream without changing the state of the chip, so
+   that EMU_Render can be called directly.
+---------------------------------------------------------------------*/
+
+void EMU_PauseStream(
+    int pause)
+
+{
+    EMU_Paused = pause;
+}
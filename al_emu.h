@@ -0,0 +1,53 @@
+/*
+Copyright (C) 1994-1995 Apogee Software, Ltd.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+/**********************************************************************
+   module: AL_EMU.H
+
+   Public header for AL_EMU.C
+**********************************************************************/
+
+#ifndef __AL_EMU_H
+#define __AL_EMU_H
+
+enum EMU_Errors
+{
+    EMU_Warning = -2,
+    EMU_Error = -1,
+    EMU_Ok = 0,
+    EMU_NoMemory,
+    EMU_NotInstalled,
+    EMU_NoStream
+};
+
+// Sample rate used when there is no digitized sound device to stream to
+#define EMU_DefaultRate 22050
+
+int EMU_Init(void);
+void EMU_Shutdown(void);
+void EMU_Reset(void);
+void EMU_SetRate(unsigned rate);
+unsigned EMU_GetRate(void);
+void EMU_WritePort(int port, int reg, int data);
+void EMU_Render(char huge *buffer, unsigned samples);
+int EMU_StartStream(int priority);
+void EMU_StopStream(void);
+void EMU_PauseStream(int pause);
+
+#endif
@@ -37,6 +37,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "interrup.h"
 #include "sndcards.h"
 #include "blaster.h"
+#include "al_emu.h"
 #include "al_midi.h"
 #include "_al_midi.h"
 #include "ll_man.h"
@@ -105,6 +106,18 @@ static int AL_LeftPort = ADLIB_PORT;
 static int AL_RightPort = ADLIB_PORT;
 static int AL_SendStereo = FALSE;
 static int AL_OPL3 = FALSE;
+static int AL_Emulated = FALSE;
+
+static int AL_ShadowActive = FALSE;
+static short AL_Shadow[AL_NumPorts][AL_NumRegisters];
+static unsigned long AL_WritesIssued = 0;
+static unsigned long AL_WritesSuppressed = 0;
+
+static int AL_QueueMode = FALSE;
+static int AL_Queueing = FALSE;
+static int AL_QueueCount = 0;
+static ALWRITE AL_Queue[AL_QueueSize];
+static short AL_QueueSlot[AL_NumPorts][AL_NumRegisters];
 
 static unsigned int PitchBendRange;
 static int VoiceKsl[NumChipSlots];
@@ -116,19 +129,29 @@ static unsigned NoteDiv12[MAX_NOTE + 1];
 static VOICE Voice[NUM_VOICES];
 
 /*---------------------------------------------------------------------
-   Function: AL_SendOutputToPort
+   Function: AL_WriteRegister
 
-   Sends data to the Adlib using a specified port.
+   Writes a register on the card, or in the emulator when there is no
+   FM chip.  Must be called with interrupts disabled.  On the card,
+   the caller must wait with AL_WaitForCard before the next write.
 ---------------------------------------------------------------------*/
 
-void AL_SendOutputToPort(
+static void AL_WriteRegister(
     int port,
     int reg,
     int data)
 
 {
     int delay;
-    DISABLE_INTERRUPTS();
+
+    AL_WritesIssued++;
+
+    if (AL_Emulated)
+    {
+        EMU_WritePort(port, reg, data);
+        return;
+    }
+
     outp(port, reg);
 
     for (delay = 6; delay > 0; delay--)
@@ -137,7 +160,24 @@ void AL_SendOutputToPort(
     }
 
     outp(port + 1, data);
-    ENABLE_INTERRUPTS()
+}
+
+/*---------------------------------------------------------------------
+   Function: AL_WaitForCard
+
+   Gives the card time to take a register write.
+---------------------------------------------------------------------*/
+
+static void AL_WaitForCard(
+    int port)
+
+{
+    int delay;
+
+    if (AL_Emulated)
+    {
+        return;
+    }
 
     for (delay = 35; delay > 0; delay--)
     {
@@ -145,6 +185,272 @@ void AL_SendOutputToPort(
     }
 }
 
+/*---------------------------------------------------------------------
+   Function: AL_QueueWrite
+
+   Adds a register write to the queue, replacing a queued write to the
+   same register.  Key on and key off are never merged, so that every
+   note the card was told to play still starts.  Must be called with
+   interrupts disabled.
+---------------------------------------------------------------------*/
+
+static void AL_QueueWrite(
+    int bank,
+    int reg,
+    int data)
+
+{
+    ALWRITE *write;
+    int slot;
+
+    slot = AL_QueueSlot[bank][reg];
+    if (slot != 0)
+    {
+        write = &AL_Queue[slot - 1];
+        if ((reg < alFreqH) || (reg >= alFreqH + NUM_VOICES) ||
+            (((write->data ^ data) & AL_KeyOnBit) == 0))
+        {
+            write->data = data;
+            AL_WritesSuppressed++;
+            return;
+        }
+    }
+
+    if (AL_QueueCount >= AL_QueueSize)
+    {
+        AL_SendQueue();
+    }
+
+    write = &AL_Queue[AL_QueueCount];
+    write->bank = bank;
+    write->reg = reg;
+    write->data = data;
+    AL_QueueCount++;
+    AL_QueueSlot[bank][reg] = AL_QueueCount;
+}
+
+/*---------------------------------------------------------------------
+   Function: AL_SendQueue
+
+   Writes the queued registers to the card in the order they were
+   first queued, and empties the queue.  The emulator takes all of
+   them at once, so it never plays half of a tick's changes.  The card
+   is written with interrupts enabled between registers.
+---------------------------------------------------------------------*/
+
+static void AL_SendQueue(
+    void)
+
+{
+    ALWRITE *write;
+    int index;
+    int port;
+
+    DISABLE_INTERRUPTS();
+
+    for (index = 0; index < AL_QueueCount; index++)
+    {
+        write = &AL_Queue[index];
+        AL_QueueSlot[write->bank][write->reg] = 0;
+
+        port = (write->bank == 0) ? AL_LeftPort : AL_RightPort;
+        AL_WriteRegister(port, write->reg, write->data);
+
+        if (!AL_Emulated)
+        {
+            ENABLE_INTERRUPTS();
+            AL_WaitForCard(port);
+            DISABLE_INTERRUPTS();
+        }
+    }
+
+    AL_QueueCount = 0;
+
+    ENABLE_INTERRUPTS();
+}
+
+/*---------------------------------------------------------------------
+   Function: AL_SetQueueMode
+
+   Selects whether the writes made while the sequencer plays a tick
+   are queued and sent together at the end of the tick.
+---------------------------------------------------------------------*/
+
+void AL_SetQueueMode(
+    int queue)
+
+{
+    AL_QueueMode = queue;
+    if (!queue)
+    {
+        AL_FlushOutput();
+    }
+}
+
+/*---------------------------------------------------------------------
+   Function: AL_QueueOutput
+
+   Starts queueing register writes, if queue mode is on.
+---------------------------------------------------------------------*/
+
+void AL_QueueOutput(
+    void)
+
+{
+    if (AL_QueueMode && AL_ShadowActive)
+    {
+        AL_Queueing = TRUE;
+    }
+}
+
+/*---------------------------------------------------------------------
+   Function: AL_FlushOutput
+
+   Sends the queued register writes and stops queueing.
+---------------------------------------------------------------------*/
+
+void AL_FlushOutput(
+    void)
+
+{
+    DISABLE_INTERRUPTS();
+    AL_Queueing = FALSE;
+    ENABLE_INTERRUPTS();
+
+    AL_SendQueue();
+}
+
+/*---------------------------------------------------------------------
+   Function: AL_SendOutputToPort
+
+   Sends data to the Adlib using a specified port.  When there is no
+   FM chip, the data goes to the software emulator instead.  Writes
+   that match what the register already holds are skipped, and while
+   queueing the rest wait for AL_FlushOutput.
+---------------------------------------------------------------------*/
+
+void AL_SendOutputToPort(
+    int port,
+    int reg,
+    int data)
+
+{
+    int index;
+    int bank;
+
+    DISABLE_INTERRUPTS();
+
+    // Find the copy of the register, if this is one of our ports
+    bank = -1;
+    index = reg & 0xff;
+    data &= 0xff;
+    if (AL_ShadowActive && ((index < AL_FirstTimerRegister) ||
+                            (index > AL_LastTimerRegister)))
+    {
+        if (port == AL_LeftPort)
+        {
+            bank = 0;
+        }
+        else if (port == AL_RightPort)
+        {
+            bank = 1;
+        }
+    }
+
+    if (bank >= 0)
+    {
+        if (AL_Shadow[bank][index] == data)
+        {
+            AL_WritesSuppressed++;
+            ENABLE_INTERRUPTS();
+            return;
+        }
+        AL_Shadow[bank][index] = data;
+
+        if (AL_Queueing)
+        {
+            AL_QueueWrite(bank, index, data);
+            ENABLE_INTERRUPTS();
+            return;
+        }
+    }
+
+    AL_WriteRegister(port, reg, data);
+    ENABLE_INTERRUPTS();
+
+    AL_WaitForCard(port);
+}
+
+/*---------------------------------------------------------------------
+   Function: AL_ClearShadow
+
+   Forgets the contents of the registers, so that the next write to
+   each one goes to the card.  Any queued writes are dropped.
+---------------------------------------------------------------------*/
+
+static void AL_ClearShadow(
+    void)
+
+{
+    int port;
+    int reg;
+
+    for (port = 0; port < AL_NumPorts; port++)
+    {
+        for (reg = 0; reg < AL_NumRegisters; reg++)
+        {
+            AL_Shadow[port][reg] = AL_RegisterUnknown;
+            AL_QueueSlot[port][reg] = 0;
+        }
+    }
+
+    AL_Queueing = FALSE;
+    AL_QueueCount = 0;
+}
+
+/*---------------------------------------------------------------------
+   Function: AL_GetWriteCounts
+
+   Returns the number of register writes sent to the card and the
+   number skipped because the register already held the value.
+---------------------------------------------------------------------*/
+
+void AL_GetWriteCounts(
+    unsigned long *issued,
+    unsigned long *suppressed)
+
+{
+    DISABLE_INTERRUPTS();
+
+    if (issued != NULL)
+    {
+        *issued = AL_WritesIssued;
+    }
+
+    if (suppressed != NULL)
+    {
+        *suppressed = AL_WritesSuppressed;
+    }
+
+    ENABLE_INTERRUPTS();
+}
+
+/*---------------------------------------------------------------------
+   Function: AL_ClearWriteCounts
+
+   Resets the counts returned by AL_GetWriteCounts.
+---------------------------------------------------------------------*/
+
+void AL_ClearWriteCounts(
+    void)
+
+{
+    DISABLE_INTERRUPTS();
+    AL_WritesIssued = 0;
+    AL_WritesSuppressed = 0;
+    ENABLE_INTERRUPTS();
+}
+
 /*---------------------------------------------------------------------
    Function: AL_SendOutput
 
@@ -691,6 +997,9 @@ void AL_Shutdown(
         // Set card back to OPL2 operation
         AL_SendOutputToPort(AL_RightPort, 0x5, 0);
     }
+
+    AL_FlushOutput();
+    AL_ShadowActive = FALSE;
 }
 
 /*---------------------------------------------------------------------
@@ -708,11 +1017,25 @@ int AL_Init(
 
     AL_SendStereo = FALSE;
     AL_OPL3 = FALSE;
+    AL_Emulated = FALSE;
     AL_LeftPort = ADLIB_PORT;
     AL_RightPort = ADLIB_PORT;
 
+    // We don't know what the card was left holding
+    AL_ClearShadow();
+    AL_ShadowActive = TRUE;
+
     switch (soundcard)
     {
+    case SoftwareFM:
+        // The emulator behaves like an OPL3 at the Adlib address
+        AL_Emulated = TRUE;
+        AL_OPL3 = TRUE;
+        AL_SendStereo = TRUE;
+        AL_LeftPort = ADLIB_PORT;
+        AL_RightPort = ADLIB_PORT + 2;
+        break;
+
     case ProAudioSpectrum:
         AL_OPL3 = TRUE;
         AL_SendStereo = TRUE;
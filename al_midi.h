@@ -48,5 +48,10 @@ void AL_ControlChange(int channel, int type, int data);
 void AL_ProgramChange(int channel, int patch);
 void AL_SetPitchBend(int channel, int lsb, int msb);
 int AL_DetectFM(void);
+void AL_GetWriteCounts(unsigned long *issued, unsigned long *suppressed);
+void AL_ClearWriteCounts(void);
+void AL_SetQueueMode(int queue);
+void AL_QueueOutput(void);
+void AL_FlushOutput(void);
 
 #endif
\ No newline at end of file
@@ -30,13 +30,20 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <alloc.h>
 #include "sndcards.h"
 #include "multivoc.h"
 #include "blaster.h"
 #include "_blaster.h"
 #include "pas16.h"
 #include "sndsrc.h"
+#include "interrup.h"
+#include "task_man.h"
+#include "ll_man.h"
 #include "fx_man.h"
+#include "_fx_man.h"
 
 #define TRUE (1 == 1)
 #define FALSE (!TRUE)
@@ -46,6 +53,15 @@ int FX_SampleBits = 8;
 int FX_SoundDevice = 0;
 int FX_ErrorCode = FX_Ok;
 
+static unsigned long FX_FilterStep = 0;
+static short FX_FilterTable[FX_FilterPhases][FX_FilterTaps];
+static int FX_SampleHandle = FX_MinSampleHandle;
+static unsigned long FX_SampleBudget = 0;
+static unsigned long FX_SampleMemory = 0;
+static int FX_CoalesceWindow = 0;
+static task *FX_LoaderTask = NULL;
+static volatile fx_samplelist FX_SampleStore;
+
 #define FX_SetErrorCode(status) \
     FX_ErrorCode = (status);
 
@@ -104,6 +120,26 @@ char *FX_ErrorString(
         ErrorString = "Invalid VOC file.";
         break;
 
+    case FX_NoMemory:
+        ErrorString = "Out of memory in Fx.";
+        break;
+
+    case FX_InvalidSample:
+        ErrorString = "No sound with matching handle found.";
+        break;
+
+    case FX_SampleNotReady:
+        ErrorString = "Sound has not finished loading.";
+        break;
+
+    case FX_InstanceLimit:
+        ErrorString = "Sound is already playing its maximum number of times.";
+        break;
+
+    case FX_WAVFileError:
+        ErrorString = "Invalid WAV file.";
+        break;
+
     default:
         ErrorString = "Unknown Fx error code.";
         break;
@@ -223,13 +259,24 @@ int FX_Init(
             mode |= MONO_16BIT;
         }
         FX_NumVoices = numvoices;
-        devicestatus = MV_Init(SoundCard, 10000, numvoices, mode);
+        devicestatus = MV_Init(SoundCard, FX_MixRate, numvoices, mode);
         if (devicestatus != MV_Ok)
         {
             FX_SetErrorCode(FX_MultiVocError);
             status = FX_Error;
             break;
         }
+
+        // Sounds prepared for a previous device must be rebuilt,
+        // except those converted in place
+        FX_FreeSamples();
+
+        // The loader task resamples with this filter, which is too
+        // slow to build inside the interrupt.
+        if (SoundCard == TandySoundSource)
+        {
+            FX_CalcFilter(((unsigned long)FX_MixRate << 16) / SS_SampleRate);
+        }
         break;
 
     default:
@@ -266,6 +313,7 @@ int FX_Shutdown(
             status = FX_Error;
             break;
         }
+        FX_FreeSamples();
         break;
 
     default:
@@ -334,136 +382,1438 @@ int FX_GetVolume(
     return (volume);
 }
 
-unsigned long sub_2562C(
-    char *data,
-    unsigned long length,
-    unsigned int arg2,
-    unsigned int arg3)
+/*---------------------------------------------------------------------
+   Function: FX_CalcFilter
+
+   Builds the polyphase low-pass filter used to resample sounds with
+   the specified 16.16 fixed point step.  Uses floating point, so it
+   is only called from the foreground, before any sound is converted.
+---------------------------------------------------------------------*/
+
+static void FX_CalcFilter(
+    unsigned long step)
+
 {
-    unsigned long i;
-    unsigned long j;
-    char *ptr;
+    int phase;
+    int tap;
+    int sum;
+    double cutoff;
+    double t;
+    double total;
+    double coeff[FX_FilterTaps];
+
+    if (step == FX_FilterStep)
+    {
+        return;
+    }
 
-    i = ((long)arg2 << 16) / ((long)arg3);
-    if (i <= 0x10000)
+    FX_FilterStep = step;
+
+    // Cut off just below the Nyquist frequency of the slower rate
+    cutoff = 0.5 * FX_FilterCutoff;
+    if (step > 0x10000L)
+    {
+        cutoff = (cutoff * 65536.0) / (double)step;
+    }
+
+    for (phase = 0; phase < FX_FilterPhases; phase++)
     {
-        return length;
+        total = 0;
+        for (tap = 0; tap < FX_FilterTaps; tap++)
+        {
+            // Distance from the output sample to this input sample
+            t = (double)(tap - (FX_FilterTaps / 2 - 1)) -
+                (double)phase / FX_FilterPhases;
+
+            // Windowed sinc (Blackman window)
+            if (t == 0)
+            {
+                coeff[tap] = 2.0 * cutoff;
+            }
+            else
+            {
+                coeff[tap] = sin(2.0 * M_PI * cutoff * t) / (M_PI * t);
+            }
+
+            coeff[tap] *= 0.42 + 0.5 * cos(2.0 * M_PI * t / FX_FilterTaps) +
+                          0.08 * cos(4.0 * M_PI * t / FX_FilterTaps);
+            total += coeff[tap];
+        }
+
+        sum = 0;
+        for (tap = 0; tap < FX_FilterTaps; tap++)
+        {
+            FX_FilterTable[phase][tap] = (short)floor(
+                (coeff[tap] / total) * (1 << FX_FilterShift) + 0.5);
+            sum += FX_FilterTable[phase][tap];
+        }
+
+        // Put any rounding error in the center tap so DC passes unchanged
+        FX_FilterTable[phase][FX_FilterTaps / 2 - 1] += (1 << FX_FilterShift) - sum;
     }
+}
+
+/*---------------------------------------------------------------------
+   Function: FX_ResampledLength
+
+   Returns the number of samples FX_Resample will produce.
+---------------------------------------------------------------------*/
+
+static unsigned long FX_ResampledLength(
+    unsigned long length,
+    unsigned inrate,
+    unsigned outrate)
+
+{
+    unsigned long step;
+
+    step = ((unsigned long)inrate << 16) / outrate;
+
+    return ((unsigned long)ceil(((double)length * 65536.0) / (double)step));
+}
 
-    j = 0;
-    ptr = data;
-    length = length << 16;
+/*---------------------------------------------------------------------
+   Function: FX_Resample
+
+   Converts sound data from one sampling rate to another through a
+   band-limited polyphase filter.  8 bit data is unsigned, 16 bit data
+   is signed, and the output has the same format as the input.
+   Conversion starts at the source position held in index and
+   fraction, which are advanced so that a long sound can be converted
+   in pieces.  The source data is left untouched.  The filter for the
+   step must already be built by FX_CalcFilter.  Returns the number
+   of samples written.
+---------------------------------------------------------------------*/
+
+static unsigned long FX_Resample(
+    char huge *to,
+    char huge *from,
+    unsigned long length,
+    unsigned long step,
+    unsigned long *index,
+    unsigned long *fraction,
+    unsigned long count,
+    int bits)
 
-    for (; j < length; j += i)
+{
+    unsigned long written;
+    long offset;
+    long total;
+    short *coeff;
+    int tap;
+
+    written = 0;
+    while ((written < count) && (*index < length))
     {
-        *ptr++ = data[j >> 16];
+        coeff = FX_FilterTable[(unsigned)*fraction >> FX_FilterPhaseShift];
+        offset = (long)*index - (FX_FilterTaps / 2 - 1);
+
+        total = 0;
+        if ((offset >= 0) && (offset + FX_FilterTaps <= length))
+        {
+            for (tap = 0; tap < FX_FilterTaps; tap++)
+            {
+                total += (long)coeff[tap] *
+                         FX_SourceSample(from, offset + tap, bits);
+            }
+        }
+        else
+        {
+            // Treat anything beyond either end of the sound as silence
+            for (tap = 0; tap < FX_FilterTaps; tap++, offset++)
+            {
+                if ((offset >= 0) && ((unsigned long)offset < length))
+                {
+                    total += (long)coeff[tap] *
+                             FX_SourceSample(from, offset, bits);
+                }
+            }
+        }
+
+        total >>= FX_FilterShift;
+        total = max(-32768L, min(total, 32767L));
+        if (bits == 16)
+        {
+            ((short huge *)to)[written++] = (short)total;
+        }
+        else
+        {
+            to[written++] = (char)((total >> 8) + 0x80);
+        }
+
+        *fraction += step & 0xffffL;
+        *index += (step >> 16) + (*fraction >> 16);
+        *fraction &= 0xffffL;
     }
-    return ptr - data;
+
+    return (written);
 }
 
-int sub_256BD(fx_voc *data)
+/*---------------------------------------------------------------------
+   Function: FX_ParseVOC
+
+   Locates the sound data within a VOC file.  Both 8 bit sound data
+   blocks and the newer sound data blocks holding 8 or 16 bit mono
+   PCM are accepted.
+---------------------------------------------------------------------*/
+
+static int FX_ParseVOC(
+    fx_sample *sample)
+
 {
     char huge *ptr;
     unsigned long length;
-    unsigned long samplerate;
     unsigned int timeconstant;
-    unsigned int i;
+    int format;
 
-    if (data->unk0 == 'C')
+    ptr = (char *)sample->voc + *(int *)((char *)sample->voc + 20);
+    while ((*ptr != FX_VOCTerminator) && (*ptr != FX_VOCSoundData) &&
+           (*ptr != FX_VOCSoundDataNew))
     {
-        ptr = (char*)data + *(int *)((char*)data + 20);
-        while (*ptr > 1)
-        {
-            ptr++;
-            length = *((unsigned long *)ptr) & 0xFFFFFF;
-            ptr += (length + 3);
-        }
+        ptr++;
+        length = *((unsigned long *)ptr) & 0xFFFFFF;
+        ptr += (length + 3);
+    }
+
+    if (*ptr == FX_VOCTerminator)
+    {
+        FX_SetErrorCode(FX_VOCFileError);
+        return (FX_Error);
+    }
 
-        if (*ptr == 0)
+    if (*ptr == FX_VOCSoundDataNew)
+    {
+        ptr++;
+        length = (*((unsigned long *)ptr) & 0xFFFFFF) - 12;
+        format = *(int huge *)(ptr + 9);
+
+        // Only mono PCM can be mixed
+        if ((ptr[8] != 1) || ((format == FX_VOC8Bit) && (ptr[7] != 8)) ||
+            ((format == FX_VOC16Bit) && (ptr[7] != 16)) ||
+            ((format != FX_VOC8Bit) && (format != FX_VOC16Bit)))
         {
             FX_SetErrorCode(FX_VOCFileError);
-            return FX_Error;
+            return (FX_Error);
         }
 
+        sample->samplerate = *(unsigned long huge *)(ptr + 3);
+        sample->bits = ptr[7];
+        ptr += 15;
+    }
+    else
+    {
         ptr++;
         length = (*((unsigned long *)ptr) & 0xFFFFFF) - 2;
         timeconstant = ptr[3];
         ptr += 5;
-        samplerate = CalcSamplingRate(timeconstant);
 
-        if (FX_SoundDevice == TandySoundSource)
+        sample->samplerate = CalcSamplingRate(timeconstant);
+        sample->bits = 8;
+    }
+
+    sample->source = ptr;
+    sample->sourcelength = length / (sample->bits / 8);
+
+    return (FX_Ok);
+}
+
+/*---------------------------------------------------------------------
+   Function: FX_ParseWAV
+
+   Locates the sound data within a WAV file.  The file must hold 8 or
+   16 bit mono PCM.
+---------------------------------------------------------------------*/
+
+static int FX_ParseWAV(
+    fx_sample *sample)
+
+{
+    char huge *ptr;
+    char huge *end;
+    char huge *format;
+    unsigned long length;
+
+    ptr = (char huge *)sample->voc;
+    if ((memcmp(ptr, "RIFF", 4) != 0) || (memcmp(ptr + 8, "WAVE", 4) != 0))
+    {
+        FX_SetErrorCode(FX_WAVFileError);
+        return (FX_Error);
+    }
+
+    end = ptr + 8 + *(unsigned long huge *)(ptr + 4);
+    ptr += 12;
+
+    // Find the format and data chunks
+    format = NULL;
+    while (ptr + 8 <= end)
+    {
+        length = *(unsigned long huge *)(ptr + 4);
+        if (memcmp(ptr, "fmt ", 4) == 0)
+        {
+            format = ptr + 8;
+        }
+        else if (memcmp(ptr, "data", 4) == 0)
         {
-            length = sub_2562C((char *)ptr, length, 10000, 7000);
+            break;
         }
 
-        data->unk0 = 0;
-        data->data = (char*)ptr;
-        data->length = length;
-        data->samplerate = samplerate;
+        // Chunks are padded to an even length
+        ptr += 8 + ((length + 1) & ~1L);
+    }
 
-        if (FX_SampleBits == 16)
+    if ((format == NULL) || (ptr + 8 > end))
+    {
+        FX_SetErrorCode(FX_WAVFileError);
+        return (FX_Error);
+    }
+
+    // Only mono PCM can be mixed
+    sample->bits = *(short huge *)(format + 14);
+    if ((*(short huge *)format != 1) || (*(short huge *)(format + 2) != 1) ||
+        ((sample->bits != 8) && (sample->bits != 16)))
+    {
+        FX_SetErrorCode(FX_WAVFileError);
+        return (FX_Error);
+    }
+
+    sample->samplerate = *(unsigned long huge *)(format + 4);
+    sample->source = ptr + 8;
+    sample->sourcelength = length / (sample->bits / 8);
+
+    return (FX_Ok);
+}
+
+/*---------------------------------------------------------------------
+   Function: FX_GetSample
+
+   Locates the sound with the specified handle.
+---------------------------------------------------------------------*/
+
+static fx_sample *FX_GetSample(
+    int handle)
+
+{
+    fx_sample *sample;
+
+    sample = FX_SampleStore.start;
+    while (sample != NULL)
+    {
+        if (sample->handle == handle)
         {
-            for (i = 0; i < length; i++)
-            {
-                ptr[i] += 0x80;
-            }
+            break;
         }
-        else
+        sample = sample->next;
+    }
+
+    return (sample);
+}
+
+/*---------------------------------------------------------------------
+   Function: FX_FindVOC
+
+   Locates the sound that was created from the specified VOC file.
+---------------------------------------------------------------------*/
+
+static fx_sample *FX_FindVOC(
+    fx_voc *voc)
+
+{
+    fx_sample *sample;
+
+    sample = FX_SampleStore.start;
+    while (sample != NULL)
+    {
+        if (sample->voc == voc)
         {
-            for (i = 0; i < length; i++)
-            {
-                ptr[i] += 0x80;
-                ptr[i] /= FX_NumVoices;
-            }
+            break;
         }
+        sample = sample->next;
     }
-    FX_SetErrorCode(FX_Ok);
-    return 0;
+
+    return (sample);
 }
 
 /*---------------------------------------------------------------------
-   Function: FX_PlayVOC
+   Function: FX_NewSample
 
-   Begin playback of sound data with the given volume and priority.
+   Adds a sound to the prepared sample store without loading it.
 ---------------------------------------------------------------------*/
 
-int FX_PlayVOC(
-    fx_voc *ptr,
-    int unused1,
-    int unused2,
-    int priority)
+static fx_sample *FX_NewSample(
+    fx_voc *voc)
 
 {
-    int handle;
-    int ret;
+    fx_sample *sample;
+    int status;
 
-    (void)unused1;
-    (void)unused2;
-    if (ptr->unk0 == 'C')
+    if (!FX_Unprepared(voc))
     {
-        ret = sub_256BD(ptr);
-        if (ret)
-            return ret;
+        FX_SetErrorCode(FX_VOCFileError);
+        return (NULL);
     }
 
-    switch (FX_SoundDevice)
+    sample = farmalloc(sizeof(fx_sample));
+    if (sample == NULL)
     {
-    case SoundBlaster:
-    case ProAudioSpectrum:
-    case TandySoundSource:
-        handle = MV_PlayVOC(ptr->data, ptr->length, priority);
-        if (handle != MV_Error)
-            break;
-        FX_SetErrorCode(FX_MultiVocError);
-        handle = FX_Error;
-        break;
-    default:
-        FX_SetErrorCode(FX_InvalidCard);
-        handle = FX_Error;
-        break;
+        FX_SetErrorCode(FX_NoMemory);
+        return (NULL);
     }
 
-    return (handle);
+    sample->voc = voc;
+    if (voc->unk0 == 'R')
+    {
+        status = FX_ParseWAV(sample);
+    }
+    else
+    {
+        status = FX_ParseVOC(sample);
+    }
+
+    if (status != FX_Ok)
+    {
+        farfree(sample);
+        return (NULL);
+    }
+
+    // Remember the header so that the sound can be prepared again
+    memcpy(sample->header, voc, sizeof(fx_voc));
+
+    // Find a free sound handle
+    do
+    {
+        FX_SampleHandle++;
+        if (FX_SampleHandle < FX_MinSampleHandle)
+        {
+            FX_SampleHandle = FX_MinSampleHandle;
+        }
+    } while (FX_GetSample(FX_SampleHandle) != NULL);
+
+    sample->handle = FX_SampleHandle;
+    sample->status = SAMPLE_UNLOADED;
+    sample->data = NULL;
+    sample->length = 0;
+    sample->instances = 0;
+    sample->volume = MV_MaxVolume;
+    sample->maxinstances = 0;
+    sample->policy = FX_StealOldest;
+    sample->queued = FALSE;
+    sample->priority = 0;
+
+    DISABLE_INTERRUPTS();
+    LL_AddToTail(fx_sample, &FX_SampleStore, sample);
+    ENABLE_INTERRUPTS();
+
+    return (sample);
+}
+
+/*---------------------------------------------------------------------
+   Function: FX_EvictSamples
+
+   Unloads the least recently played sounds until the specified
+   amount of memory fits within the sample budget.
+---------------------------------------------------------------------*/
+
+static int FX_EvictSamples(
+    unsigned long length)
+
+{
+    fx_sample *sample;
+
+    if (FX_SampleBudget == 0)
+    {
+        return (TRUE);
+    }
+
+    // The store is kept in order of use, oldest first
+    sample = FX_SampleStore.start;
+    while ((sample != NULL) && (FX_SampleMemory + length > FX_SampleBudget))
+    {
+        if ((sample->status == SAMPLE_READY) && (!sample->queued) &&
+            (FX_CountInstances(sample) == 0))
+        {
+            FX_UnloadSampleData(sample);
+        }
+        sample = sample->next;
+    }
+
+    return (FX_SampleMemory + length <= FX_SampleBudget);
+}
+
+/*---------------------------------------------------------------------
+   Function: FX_LoadSampleData
+
+   Reserves space in the prepared sample store for the device ready
+   data of the specified sound and queues it for conversion.  Only the
+   Sound Source needs a copy of the sound to resample it.  Other
+   devices play it from the VOC file, converted in place.
+---------------------------------------------------------------------*/
+
+static int FX_LoadSampleData(
+    fx_sample *sample)
+
+{
+    unsigned long length;
+    unsigned long size;
+
+    length = sample->sourcelength;
+    if (FX_SoundDevice == TandySoundSource)
+    {
+        length = FX_ResampledLength(length, FX_MixRate, SS_SampleRate);
+
+        size = length * (sample->bits / 8);
+        if (!FX_EvictSamples(size))
+        {
+            FX_SetErrorCode(FX_NoMemory);
+            return (FX_Error);
+        }
+
+        sample->data = farmalloc(size);
+        if (sample->data == NULL)
+        {
+            FX_SetErrorCode(FX_NoMemory);
+            return (FX_Error);
+        }
+
+        FX_SampleMemory += size;
+    }
+    else
+    {
+        sample->data = sample->source;
+    }
+
+    sample->length = length;
+    sample->converted = 0;
+    sample->index = 0;
+    sample->fraction = 0;
+    sample->status = SAMPLE_LOADING;
+
+    return (FX_Ok);
+}
+
+/*---------------------------------------------------------------------
+   Function: FX_UnloadSampleData
+
+   Releases the device ready data of the specified sound and returns
+   its VOC file to the unprepared state.  A sound converted in place
+   can't be converted again, so it is finished and stays prepared.
+---------------------------------------------------------------------*/
+
+static void FX_UnloadSampleData(
+    fx_sample *sample)
+
+{
+    if ((sample->data != NULL) && (sample->data == sample->source))
+    {
+        FX_FinishSample(sample);
+
+        DISABLE_INTERRUPTS();
+        sample->queued = FALSE;
+        ENABLE_INTERRUPTS();
+        return;
+    }
+
+    DISABLE_INTERRUPTS();
+    if (sample->status == SAMPLE_READY)
+    {
+        memcpy(sample->voc, sample->header, sizeof(fx_voc));
+    }
+    sample->status = SAMPLE_UNLOADED;
+    sample->queued = FALSE;
+    ENABLE_INTERRUPTS();
+
+    if (sample->data != NULL)
+    {
+        farfree(sample->data);
+        sample->data = NULL;
+        FX_SampleMemory -= sample->length * (sample->bits / 8);
+    }
+    sample->length = 0;
+}
+
+/*---------------------------------------------------------------------
+   Function: FX_ConvertSample
+
+   Converts the next piece of a loading sound into the format used
+   by the current device.  Once the whole sound is converted, its VOC
+   file is updated to point to the prepared data.  A play request
+   waiting on it is left for FX_StartQueued to start.
+---------------------------------------------------------------------*/
+
+static void FX_ConvertSample(
+    fx_sample *sample,
+    unsigned long count)
+
+{
+    char huge *from;
+    char huge *to;
+    short huge *from16;
+    short huge *to16;
+    unsigned long i;
+    fx_voc *voc;
+
+    if (sample->status != SAMPLE_LOADING)
+    {
+        return;
+    }
+
+    to = sample->data + sample->converted * (sample->bits / 8);
+    if (FX_SoundDevice == TandySoundSource)
+    {
+        count = FX_Resample(to, sample->source, sample->sourcelength,
+                            ((unsigned long)FX_MixRate << 16) / SS_SampleRate,
+                            &sample->index, &sample->fraction, count,
+                            sample->bits);
+        from = to;
+    }
+    else
+    {
+        count = min(count, sample->length - sample->converted);
+        from = sample->source + sample->converted * (sample->bits / 8);
+    }
+
+    if (sample->bits == 16)
+    {
+        // 16 bit data is already signed
+        from16 = (short huge *)from;
+        to16 = (short huge *)to;
+        if (FX_SampleBits == 16)
+        {
+            for (i = 0; i < count; i++)
+            {
+                to16[i] = from16[i];
+            }
+        }
+        else
+        {
+            for (i = 0; i < count; i++)
+            {
+                to16[i] = from16[i] / FX_NumVoices;
+            }
+        }
+    }
+    else if (FX_SampleBits == 16)
+    {
+        for (i = 0; i < count; i++)
+        {
+            to[i] = from[i] + 0x80;
+        }
+    }
+    else
+    {
+        for (i = 0; i < count; i++)
+        {
+            to[i] = from[i] + 0x80;
+            to[i] /= FX_NumVoices;
+        }
+    }
+
+    sample->converted += count;
+    if ((count > 0) && (sample->converted < sample->length))
+    {
+        return;
+    }
+
+    sample->length = sample->converted;
+    sample->status = SAMPLE_READY;
+
+    voc = sample->voc;
+    voc->unk0 = (sample->bits == 16) ? FX_Prepared16Bit : FX_Prepared8Bit;
+    voc->data = (char *)sample->data;
+    voc->length = sample->length;
+    voc->samplerate = sample->samplerate;
+}
+
+/*---------------------------------------------------------------------
+   Function: FX_CountInstances
+
+   Drops the voices of the specified sound that have finished and
+   returns the number still playing.
+---------------------------------------------------------------------*/
+
+static int FX_CountInstances(
+    fx_sample *sample)
+
+{
+    int index;
+    int count;
+
+    DISABLE_INTERRUPTS();
+
+    count = 0;
+    for (index = 0; index < sample->instances; index++)
+    {
+        if (MV_VoicePlaying(sample->voices[index]))
+        {
+            sample->voices[count++] = sample->voices[index];
+        }
+    }
+    sample->instances = count;
+
+    ENABLE_INTERRUPTS();
+
+    return (count);
+}
+
+/*---------------------------------------------------------------------
+   Function: FX_AddInstance
+
+   Records a voice started for the specified sound.  Voices are kept
+   oldest first.
+---------------------------------------------------------------------*/
+
+static void FX_AddInstance(
+    fx_sample *sample,
+    int voice,
+    int volume)
+
+{
+    int index;
+
+    if (voice < MV_MinVoiceHandle)
+    {
+        return;
+    }
+
+    DISABLE_INTERRUPTS();
+
+    if (sample->instances >= FX_MaxInstances)
+    {
+        for (index = 1; index < FX_MaxInstances; index++)
+        {
+            sample->voices[index - 1] = sample->voices[index];
+        }
+        sample->instances--;
+    }
+    sample->voices[sample->instances++] = voice;
+    sample->volume = volume;
+
+    ENABLE_INTERRUPTS();
+}
+
+/*---------------------------------------------------------------------
+   Function: FX_CheckInstances
+
+   Applies the coalescing window and instance limit of the specified
+   sound to a new trigger at the given Multivoc volume.  pending is
+   the number of voices for the sound about to be started.  Returns
+   FX_Ok if a new voice may be started, the handle of the voice the
+   trigger was merged into, or FX_Warning if the trigger is rejected.
+---------------------------------------------------------------------*/
+
+static int FX_CheckInstances(
+    fx_sample *sample,
+    int volume,
+    int pending)
+
+{
+    int count;
+    int newest;
+    int position;
+
+    count = FX_CountInstances(sample);
+
+    // A trigger that follows the last one closely enough just makes
+    // the voice already playing louder.
+    if ((count > 0) && (FX_CoalesceWindow > 0))
+    {
+        newest = sample->voices[count - 1];
+        position = MV_VoicePosition(newest);
+        if ((position >= 0) && (position < FX_CoalesceWindow))
+        {
+            sample->volume = min(sample->volume + volume / 2, MV_MaxVolume);
+            MV_SetVoiceVolume(newest, sample->volume);
+            return (newest);
+        }
+    }
+
+    if ((sample->maxinstances > 0) && (count + pending >= sample->maxinstances))
+    {
+        if (sample->policy == FX_StealOldest)
+        {
+            // Stop the oldest voices until the new ones fit
+            while ((count > 0) && (count + pending >= sample->maxinstances))
+            {
+                MV_Kill(sample->voices[0]);
+                count = FX_CountInstances(sample);
+            }
+        }
+
+        if (count + pending >= sample->maxinstances)
+        {
+            FX_SetErrorCode(FX_InstanceLimit);
+            return (FX_Warning);
+        }
+    }
+
+    return (FX_Ok);
+}
+
+/*---------------------------------------------------------------------
+   Function: FX_StartQueued
+
+   Starts the play requests that were waiting on sounds which have
+   finished loading.  The loader task only marks the sounds as ready,
+   so the voices are started here from the foreground.
+---------------------------------------------------------------------*/
+
+static void FX_StartQueued(
+    void)
+
+{
+    fx_sample *sample;
+    fx_voc *voc;
+
+    for (sample = FX_SampleStore.start; sample != NULL; sample = sample->next)
+    {
+        if ((sample->status != SAMPLE_READY) || (!sample->queued))
+        {
+            continue;
+        }
+
+        // The waiting request is subject to the same limits as a sound
+        // started directly.
+        sample->queued = FALSE;
+        if (FX_CheckInstances(sample, MV_MaxVolume, 0) == FX_Ok)
+        {
+            voc = sample->voc;
+            FX_AddInstance(sample, MV_Play(voc->data, voc->length, sample->bits,
+                                           sample->priority), MV_MaxVolume);
+        }
+    }
+}
+
+/*---------------------------------------------------------------------
+   Function: FX_ServiceLoader
+
+   Task that converts loading sounds in the background.  The task
+   ends itself once there is nothing left to convert.
+---------------------------------------------------------------------*/
+
+static void FX_ServiceLoader(
+    task *Task)
+
+{
+    fx_sample *sample;
+
+    sample = FX_SampleStore.start;
+    while (sample != NULL)
+    {
+        if (sample->status == SAMPLE_LOADING)
+        {
+            FX_ConvertSample(sample, FX_LoaderChunk);
+            return;
+        }
+        sample = sample->next;
+    }
+
+    TS_Terminate(Task);
+    FX_LoaderTask = NULL;
+}
+
+/*---------------------------------------------------------------------
+   Function: FX_StartLoader
+
+   Schedules the background loader task if it isn't already running.
+   Call after marking the sound to convert as loading, so that a task
+   ending itself at the same time can't miss it.
+---------------------------------------------------------------------*/
+
+static void FX_StartLoader(
+    void)
+
+{
+    int running;
+
+    DISABLE_INTERRUPTS();
+    running = (FX_LoaderTask != NULL);
+    ENABLE_INTERRUPTS();
+
+    if (!running)
+    {
+        FX_LoaderTask = TS_ScheduleTask(FX_ServiceLoader, FX_LoaderRate, 1, NULL);
+        TS_Dispatch();
+    }
+}
+
+/*---------------------------------------------------------------------
+   Function: FX_StopLoader
+
+   Ends the background loader task.  Returns TRUE if it was running.
+---------------------------------------------------------------------*/
+
+static int FX_StopLoader(
+    void)
+
+{
+    int running;
+
+    DISABLE_INTERRUPTS();
+    running = (FX_LoaderTask != NULL);
+    if (running)
+    {
+        TS_Terminate(FX_LoaderTask);
+        FX_LoaderTask = NULL;
+    }
+    ENABLE_INTERRUPTS();
+
+    return (running);
+}
+
+/*---------------------------------------------------------------------
+   Function: FX_FinishSample
+
+   Converts the rest of a loading sound now.  The loader task is
+   stopped meanwhile so that it never sees a partly converted piece.
+---------------------------------------------------------------------*/
+
+static void FX_FinishSample(
+    fx_sample *sample)
+
+{
+    int loading;
+
+    if (sample->status != SAMPLE_LOADING)
+    {
+        return;
+    }
+
+    loading = FX_StopLoader();
+    while (sample->status == SAMPLE_LOADING)
+    {
+        FX_ConvertSample(sample, FX_LoaderChunk);
+    }
+
+    if (loading)
+    {
+        FX_StartLoader();
+    }
+}
+
+/*---------------------------------------------------------------------
+   Function: FX_FreeSamples
+
+   Stops the loader and releases the prepared sample store, restoring
+   the sounds that used it to their unprepared state.
+---------------------------------------------------------------------*/
+
+static void FX_FreeSamples(
+    void)
+
+{
+    fx_sample *sample;
+
+    FX_StopLoader();
+
+    while (FX_SampleStore.start != NULL)
+    {
+        sample = FX_SampleStore.start;
+        FX_UnloadSampleData(sample);
+        LL_Remove(fx_sample, &FX_SampleStore, sample);
+        farfree(sample);
+    }
+
+    FX_SampleMemory = 0;
+}
+
+int sub_256BD(fx_voc *data)
+{
+    fx_sample *sample;
+
+    if (FX_Unprepared(data))
+    {
+        sample = FX_FindVOC(data);
+        if (sample == NULL)
+        {
+            sample = FX_NewSample(data);
+            if (sample == NULL)
+            {
+                return (FX_Error);
+            }
+        }
+
+        if (sample->status == SAMPLE_UNLOADED)
+        {
+            if (FX_LoadSampleData(sample) != FX_Ok)
+            {
+                return (FX_Error);
+            }
+        }
+
+        FX_FinishSample(sample);
+    }
+    FX_SetErrorCode(FX_Ok);
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+   Function: FX_PlayVOC
+
+   Begin playback of sound data with the given volume and priority.
+---------------------------------------------------------------------*/
+
+int FX_PlayVOC(
+    fx_voc *ptr,
+    int unused1,
+    int unused2,
+    int priority)
+
+{
+    int handle;
+    int ret;
+    fx_sample *sample;
+
+    (void)unused1;
+    (void)unused2;
+    FX_StartQueued();
+
+    if (FX_Unprepared(ptr))
+    {
+        ret = sub_256BD(ptr);
+        if (ret)
+            return ret;
+    }
+
+    sample = FX_FindVOC(ptr);
+    if (sample != NULL)
+    {
+        handle = FX_CheckInstances(sample, MV_MaxVolume, 0);
+        if (handle != FX_Ok)
+        {
+            return (handle);
+        }
+    }
+
+    switch (FX_SoundDevice)
+    {
+    case SoundBlaster:
+    case ProAudioSpectrum:
+    case TandySoundSource:
+        handle = MV_Play(ptr->data, ptr->length,
+                         (ptr->unk0 == FX_Prepared16Bit) ? 16 : 8, priority);
+        if (handle != MV_Error)
+            break;
+        FX_SetErrorCode(FX_MultiVocError);
+        handle = FX_Error;
+        break;
+    default:
+        FX_SetErrorCode(FX_InvalidCard);
+        handle = FX_Error;
+        break;
+    }
+
+    if ((handle > FX_Ok) && (sample != NULL))
+    {
+        FX_AddInstance(sample, handle, MV_MaxVolume);
+
+        // Keep the store in order of use for the sample budget
+        DISABLE_INTERRUPTS();
+        LL_Remove(fx_sample, &FX_SampleStore, sample);
+        LL_AddToTail(fx_sample, &FX_SampleStore, sample);
+        ENABLE_INTERRUPTS();
+    }
+
+    return (handle);
+}
+
+/*---------------------------------------------------------------------
+   Function: FX_LoadVOC
+
+   Adds a VOC file to the prepared sample store and starts converting
+   it in the background.  Returns a handle to the sound immediately.
+---------------------------------------------------------------------*/
+
+int FX_LoadVOC(
+    fx_voc *ptr)
+
+{
+    fx_sample *sample;
+
+    sample = FX_FindVOC(ptr);
+    if (sample == NULL)
+    {
+        sample = FX_NewSample(ptr);
+        if (sample == NULL)
+        {
+            return (FX_Error);
+        }
+    }
+
+    if (sample->status == SAMPLE_UNLOADED)
+    {
+        if (FX_LoadSampleData(sample) != FX_Ok)
+        {
+            return (FX_Error);
+        }
+        FX_StartLoader();
+    }
+
+    FX_SetErrorCode(FX_Ok);
+    return (sample->handle);
+}
+
+/*---------------------------------------------------------------------
+   Function: FX_SampleLoaded
+
+   Tests if the specified sound is ready to play.
+---------------------------------------------------------------------*/
+
+int FX_SampleLoaded(
+    int handle)
+
+{
+    fx_sample *sample;
+
+    FX_StartQueued();
+
+    sample = FX_GetSample(handle);
+    if (sample == NULL)
+    {
+        FX_SetErrorCode(FX_InvalidSample);
+        return (FALSE);
+    }
+
+    return (sample->status == SAMPLE_READY);
+}
+
+/*---------------------------------------------------------------------
+   Function: FX_PlaySample
+
+   Begin playback of a sound loaded with FX_LoadVOC.  If the sound is
+   still loading, the request either waits for it to finish or fails
+   immediately, as selected by mode.  A waiting request starts on the
+   next call to FX_PlayVOC, FX_PlaySample, FX_PlayBatch or
+   FX_SampleLoaded after loading is done.  Returns the voice handle,
+   or FX_Ok when the request was queued.
+---------------------------------------------------------------------*/
+
+int FX_PlaySample(
+    int handle,
+    int priority,
+    int mode)
+
+{
+    fx_sample *sample;
+    int queued;
+
+    FX_StartQueued();
+
+    sample = FX_GetSample(handle);
+    if (sample == NULL)
+    {
+        FX_SetErrorCode(FX_InvalidSample);
+        return (FX_Error);
+    }
+
+    // An evicted sound is reloaded on demand
+    if (sample->status == SAMPLE_UNLOADED)
+    {
+        if (FX_LoadSampleData(sample) != FX_Ok)
+        {
+            return (FX_Error);
+        }
+        FX_StartLoader();
+    }
+
+    if (sample->status == SAMPLE_LOADING)
+    {
+        if (mode != FX_QueueIfLoading)
+        {
+            FX_SetErrorCode(FX_SampleNotReady);
+            return (FX_Warning);
+        }
+
+        queued = FALSE;
+        DISABLE_INTERRUPTS();
+        if (sample->status == SAMPLE_LOADING)
+        {
+            sample->queued = TRUE;
+            sample->priority = priority;
+            queued = TRUE;
+        }
+        ENABLE_INTERRUPTS();
+
+        if (queued)
+        {
+            FX_SetErrorCode(FX_Ok);
+            return (FX_Ok);
+        }
+    }
+
+    return (FX_PlayVOC(sample->voc, 0, 0, priority));
+}
+
+/*---------------------------------------------------------------------
+   Function: FX_UnloadSample
+
+   Stops the specified sound and removes it from the prepared sample
+   store.
+---------------------------------------------------------------------*/
+
+int FX_UnloadSample(
+    int handle)
+
+{
+    fx_sample *sample;
+
+    sample = FX_GetSample(handle);
+    if (sample == NULL)
+    {
+        FX_SetErrorCode(FX_InvalidSample);
+        return (FX_Warning);
+    }
+
+    while (FX_CountInstances(sample) > 0)
+    {
+        MV_Kill(sample->voices[0]);
+    }
+
+    FX_UnloadSampleData(sample);
+
+    DISABLE_INTERRUPTS();
+    LL_Remove(fx_sample, &FX_SampleStore, sample);
+    ENABLE_INTERRUPTS();
+
+    farfree(sample);
+
+    return (FX_Ok);
+}
+
+/*---------------------------------------------------------------------
+   Function: FX_SetSampleBudget
+
+   Limits the memory used by prepared sounds.  Sounds that haven't
+   been played recently are unloaded to stay within the budget.  A
+   budget of 0 removes the limit.
+---------------------------------------------------------------------*/
+
+void FX_SetSampleBudget(
+    unsigned long bytes)
+
+{
+    FX_SampleBudget = bytes;
+    FX_EvictSamples(0);
+}
+
+/*---------------------------------------------------------------------
+   Function: FX_PlayBatch
+
+   Begin playback of several loaded sounds in the same mix buffer.
+   Each request gives the sound handle, priority, gain (0 to
+   FX_MaxVolume) and pan.  Sounds are committed to Multivoc
+   FX_MaxBatch at a time, each group within a single critical
+   section.  Requests for the same sound are subject to its instance
+   limit and the coalescing window.  The voice handle of each request,
+   or an error, is stored in handles.  Sounds that are not loaded are
+   not queued.  The mixer is mono, so pan is currently ignored.
+   Returns the number of requests that are playing.
+---------------------------------------------------------------------*/
+
+int FX_PlayBatch(
+    fx_play *requests,
+    int count,
+    int *handles)
+
+{
+    mv_play batch[FX_MaxBatch];
+    fx_sample *samples[FX_MaxBatch];
+    int *results[FX_MaxBatch];
+    int slots[FX_MaxBatch];
+    fx_sample *sample;
+    int index;
+    int number;
+    int total;
+    int volume;
+    int pending;
+    int status;
+    int started;
+
+    switch (FX_SoundDevice)
+    {
+    case SoundBlaster:
+    case ProAudioSpectrum:
+    case TandySoundSource:
+        break;
+
+    default:
+        FX_SetErrorCode(FX_InvalidCard);
+        return (0);
+    }
+
+    FX_StartQueued();
+
+    started = 0;
+    while (count > 0)
+    {
+        total = 0;
+        for (number = 0; (count > 0) && (number < FX_MaxBatch);
+             number++, count--, requests++, handles++)
+        {
+            results[number] = handles;
+            slots[number] = -1;
+
+            sample = FX_GetSample(requests->sample);
+            if (sample == NULL)
+            {
+                FX_SetErrorCode(FX_InvalidSample);
+                *handles = FX_Error;
+                continue;
+            }
+
+            if (sample->status != SAMPLE_READY)
+            {
+                if (sample->status == SAMPLE_UNLOADED)
+                {
+                    // Bring evicted sounds back for the next trigger
+                    if (FX_LoadSampleData(sample) == FX_Ok)
+                    {
+                        FX_StartLoader();
+                    }
+                }
+
+                FX_SetErrorCode(FX_SampleNotReady);
+                *handles = FX_Warning;
+                continue;
+            }
+
+            volume = (max(0, min(requests->gain, FX_MaxVolume)) *
+                      MV_MaxVolume) / FX_MaxVolume;
+
+            // Look for requests for the same sound earlier in this group
+            pending = 0;
+            for (index = total - 1; index >= 0; index--)
+            {
+                if (samples[index] == sample)
+                {
+                    if (FX_CoalesceWindow > 0)
+                    {
+                        break;
+                    }
+                    pending++;
+                }
+            }
+
+            if (index >= 0)
+            {
+                batch[index].volume = min(batch[index].volume + volume / 2,
+                                          MV_MaxVolume);
+                slots[number] = index;
+                continue;
+            }
+
+            status = FX_CheckInstances(sample, volume, pending);
+            if (status != FX_Ok)
+            {
+                *handles = status;
+                if (status > FX_Ok)
+                {
+                    started++;
+                }
+                continue;
+            }
+
+            batch[total].ptr = sample->voc->data;
+            batch[total].length = sample->voc->length;
+            batch[total].priority = requests->priority;
+            batch[total].volume = volume;
+            batch[total].bits = sample->bits;
+            samples[total] = sample;
+            slots[number] = total;
+            total++;
+        }
+
+        if (total > 0)
+        {
+            MV_PlayBatch(batch, total);
+        }
+
+        for (index = 0; index < total; index++)
+        {
+            if (batch[index].handle == MV_Error)
+            {
+                FX_SetErrorCode(FX_MultiVocError);
+                batch[index].handle = FX_Error;
+                continue;
+            }
+
+            sample = samples[index];
+            FX_AddInstance(sample, batch[index].handle, batch[index].volume);
+
+            // Keep the store in order of use for the sample budget
+            DISABLE_INTERRUPTS();
+            LL_Remove(fx_sample, &FX_SampleStore, sample);
+            LL_AddToTail(fx_sample, &FX_SampleStore, sample);
+            ENABLE_INTERRUPTS();
+        }
+
+        for (index = 0; index < number; index++)
+        {
+            if (slots[index] >= 0)
+            {
+                *results[index] = batch[slots[index]].handle;
+                if (batch[slots[index]].handle > FX_Ok)
+                {
+                    started++;
+                }
+            }
+        }
+    }
+
+    return (started);
+}
+
+/*---------------------------------------------------------------------
+   Function: FX_SetSampleLimit
+
+   Sets the maximum number of voices that may play the specified
+   sound at once, and whether a trigger beyond the limit stops the
+   oldest voice (FX_StealOldest) or is rejected (FX_RejectNew).  A
+   limit of 0 removes the limit.  Only FX_MaxInstances voices of a
+   sound are tracked, so larger limits are reduced to that.
+---------------------------------------------------------------------*/
+
+int FX_SetSampleLimit(
+    int handle,
+    int maxinstances,
+    int policy)
+
+{
+    fx_sample *sample;
+
+    sample = FX_GetSample(handle);
+    if (sample == NULL)
+    {
+        FX_SetErrorCode(FX_InvalidSample);
+        return (FX_Warning);
+    }
+
+    sample->maxinstances = max(0, min(maxinstances, FX_MaxInstances));
+    sample->policy = policy;
+
+    return (FX_Ok);
+}
+
+/*---------------------------------------------------------------------
+   Function: FX_SetCoalesceWindow
+
+   Sets how soon after a sound starts another trigger of the same
+   sound is merged into the voice already playing instead of taking
+   a new voice.  The merged voice is raised by half the gain of the
+   new trigger.  A window of 0 turns coalescing off.
+---------------------------------------------------------------------*/
+
+void FX_SetCoalesceWindow(
+    int milliseconds)
+
+{
+    long rate;
+
+    rate = FX_MixRate;
+    if (FX_SoundDevice == TandySoundSource)
+    {
+        rate = SS_SampleRate;
+    }
+
+    FX_CoalesceWindow = (int)((max(0, milliseconds) * rate) / 1000);
 }
 
 /*---------------------------------------------------------------------
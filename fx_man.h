@@ -41,6 +41,16 @@ typedef struct
 #define MonoFx 1
 #define StereoFx 2
 
+#define FX_MinSampleHandle 1
+
+#define FX_FailIfLoading 0
+#define FX_QueueIfLoading 1
+
+#define FX_MaxVolume 255
+
+#define FX_StealOldest 0
+#define FX_RejectNew 1
+
 enum FX_ERRORS
 {
     FX_Warning = -2,
@@ -49,7 +59,12 @@ enum FX_ERRORS
     FX_SoundCardError,
     FX_InvalidCard,
     FX_MultiVocError,
-    FX_VOCFileError
+    FX_VOCFileError,
+    FX_NoMemory,
+    FX_InvalidSample,
+    FX_SampleNotReady,
+    FX_InstanceLimit,
+    FX_WAVFileError
 };
 
 enum fx_BLASTER_Types
@@ -69,6 +84,14 @@ typedef struct
    unsigned long samplerate;
 } fx_voc;
 
+typedef struct
+{
+    int sample;
+    int priority;
+    int gain;
+    int pan;
+} fx_play;
+
 char *FX_ErrorString(int ErrorNumber);
 int FX_SetupCard(int SoundCard, fx_device *device);
 int FX_Init(int SoundCard, int numvoices, int samplebits);
@@ -81,5 +104,13 @@ int FX_SoundsPlaying(void);
 int FX_StopSound(int handle);
 int FX_StopAllSounds(void);
 int sub_256BD(fx_voc *data);
+int FX_LoadVOC(fx_voc *ptr);
+int FX_SampleLoaded(int handle);
+int FX_PlaySample(int handle, int priority, int mode);
+int FX_UnloadSample(int handle);
+void FX_SetSampleBudget(unsigned long bytes);
+int FX_PlayBatch(fx_play *requests, int count, int *handles);
+int FX_SetSampleLimit(int handle, int maxinstances, int policy);
+void FX_SetCoalesceWindow(int milliseconds);
 
 #endif
\ No newline at end of file
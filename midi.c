@@ -32,9 +32,12 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define FALSE (!TRUE)
 
 #include <stdlib.h>
+#include <alloc.h>
 #include <time.h>
 #include <dos.h>
 #include <string.h>
+#include <ctype.h>
+#include "interrup.h"
 #include "task_man.h"
 #include "ll_man.h"
 #include "music.h"
@@ -45,18 +48,39 @@ static const int _MIDI_CommandLengths[NUM_MIDI_CHANNELS] =
     {
         0, 0, 0, 0, 0, 0, 0, 0, 2, 2, 2, 2, 1, 1, 2, 0};
 
-static int _MIDI_SongActive = FALSE;
-static int _MIDI_SongLoaded = FALSE;
-static int _MIDI_Loop = FALSE;
-static task *_MIDI_PlayRoutine = NULL;
-static void *_MIDI_TrackPtr = NULL;
+// The MIDI controllers that MUS controllers and system events map to.
+// MUS controller 0 is a program change.
+static const unsigned char _MIDI_MUSControllers[MUS_LAST_CONTROLLER + 1] =
+    {
+        0, MIDI_BANK_SELECT_MSB, MIDI_MODULATION, MIDI_VOLUME, MIDI_PAN,
+        MIDI_EXPRESSION, MIDI_REVERB, MIDI_CHORUS, MIDI_SUSTAIN, MIDI_SOFT_PEDAL};
+
+static const unsigned char _MIDI_MUSSystemEvents[MUS_LAST_SYSTEM_EVENT - MUS_FIRST_SYSTEM_EVENT + 1] =
+    {
+        MIDI_ALL_SOUNDS_OFF, MIDI_ALL_NOTES_OFF, MIDI_MONO_MODE_ON,
+        MIDI_POLY_MODE_ON, MIDI_RESET_ALL_CONTROLLERS};
+
+static sequence _MIDI_Sequences[MIDI_MaxSequences];
+static midisong _MIDI_PreparedSongs[MIDI_MaxPreparedSongs];
 static int _MIDI_TotalVolume = MIDI_MaxVolume;
+static int _MIDI_SentVolume[NUM_MIDI_CHANNELS];
+static midifade _MIDI_MasterFade;
+static sequence *_MIDI_FadeOwner = NULL;
+static int _MIDI_TempoScale = MIDI_NormalTempo;
+static int _MIDI_Transpose = 0;
+static int _MIDI_ThinResolution = MIDI_NoThinning;
+static long _MIDI_ThinnedEvents = 0;
+
+static songmeta _MIDI_MetaQueue[MIDI_MetaQueueSize];
+static volatile int _MIDI_MetaHead = 0;
+static volatile int _MIDI_MetaTail = 0;
+static void (*_MIDI_MetaCallBack)(songmeta *event) = NULL;
 static midifuncs *_MIDI_Funcs = NULL;
 
-static int _MIDI_ActiveTracks;
-static int _MIDI_DivisionRate;
-static int _MIDI_ChannelVolume[NUM_MIDI_CHANNELS];
-static list _MIDI_List;
+// Timer counts the sequencer has played, and the sequence being
+// serviced while it sends its events.
+static unsigned long _MIDI_Clock = 0;
+static sequence *_MIDI_ServicedSong = NULL;
 
 /*---------------------------------------------------------------------
    Function: _MIDI_ReadNumber
@@ -117,661 +141,4338 @@ static long _MIDI_ReadDelta(
 }
 
 /*---------------------------------------------------------------------
-   Function: _MIDI_ResetTracks
+   Function: _MIDI_ResetTrack
 
-   Sets the track pointers to the beginning of the song.
+   Sets the track pointer to the beginning of the track.
 ---------------------------------------------------------------------*/
 
-static void _MIDI_ResetTracks(
-    void)
+static void _MIDI_ResetTrack(
+    track *ptr)
 
 {
-    track *ptr;
+    ptr->pos = ptr->start;
+    ptr->time = ptr->base + _MIDI_ReadDelta(ptr);
+    ptr->active = TRUE;
+    ptr->pending = FALSE;
+    ptr->RunningStatus = 0;
+}
 
-    ptr = _MIDI_List.start;
-    _MIDI_ActiveTracks = 0;
-    while (ptr != NULL)
-    {
-        _MIDI_ActiveTracks++;
-        ptr->pos = ptr->start;
-        ptr->delay = _MIDI_ReadDelta(ptr);
-        ptr->active = 1;
-        ptr->RunningStatus = 0;
-        ptr = ptr->next;
-    }
+/*---------------------------------------------------------------------
+   Function: _MIDI_SysEx
+
+   Reads the length of a system exclusive message and stores where
+   its data is in the song into the track's event.  Returns FALSE if
+   the message is too long to be sent.
+---------------------------------------------------------------------*/
+
+static int _MIDI_SysEx(
+    midisong *Music,
+    track *Track)
+
+{
+    midievent *Event;
+    long length;
+
+    Event = &Track->event;
+    length = _MIDI_ReadDelta(Track);
+
+    Event->data1 = length & 0xff;
+    Event->data2 = (length >> 8) & 0xff;
+    Event->param = Track->pos - Music->data;
+
+    Track->pos += length;
+
+    return (length <= MIDI_MaxSysExLength);
 }
 
 /*---------------------------------------------------------------------
-   Function: _MIDI_ServiceRoutine
+   Function: _MIDI_ReadEvent
 
-   Task that interperates the MIDI data.
+   Decodes the next event from the track that is kept in the song
+   into the track's event.  Returns FALSE when the track is finished.
 ---------------------------------------------------------------------*/
-static void _MIDI_ServiceRoutine(
-    task *Task)
+
+static int _MIDI_ReadEvent(
+    midisong *Music,
+    track *Track)
 
 {
     int event;
-    int channel;
     int command;
-    int length;
-    long tempo;
-    track *Track;
-    int c1;
-    int c2;
+    long length;
+    int found;
+    midievent *Event;
 
-    if (!_MIDI_SongActive)
+    Event = &Track->event;
+    while (Track->active)
     {
-        return;
-    }
+        if (Track->pos >= Track->end)
+        {
+            Track->active = FALSE;
+            break;
+        }
 
-    Track = _MIDI_List.start;
-    while (Track != NULL)
-    {
-        while ((Track->active) && (Track->delay == 0))
+        found = FALSE;
+        Event->time = Track->time;
+        GET_NEXT_EVENT(Track, event);
+        if (event == MIDI_META_EVENT)
         {
-            GET_NEXT_EVENT(Track, event);
-            if (event == MIDI_META_EVENT)
+            GET_NEXT_EVENT(Track, command);
+            length = _MIDI_ReadDelta(Track);
+
+            switch (command)
             {
-                GET_NEXT_EVENT(Track, command);
-                GET_NEXT_EVENT(Track, length);
+            case MIDI_END_OF_TRACK:
+                Track->active = FALSE;
+                break;
 
-                switch (command)
-                {
-                case MIDI_END_OF_TRACK:
-                    Track->active = FALSE;
-                    _MIDI_ActiveTracks--;
-                    break;
+            case MIDI_TEMPO_CHANGE:
+                Event->status = MIDI_META_EVENT;
+                Event->data1 = command;
+                Event->data2 = 0;
+                Event->param = _MIDI_ReadNumber(Track->pos, 3);
+                found = TRUE;
+                break;
 
-                case MIDI_TEMPO_CHANGE:
-                    tempo = 60000000L / _MIDI_ReadNumber(Track->pos, 3);
-                    TS_SetTaskRate(Task, ((tempo * _MIDI_DivisionRate) / 60));
-                    break;
-                }
+            case MIDI_TIME_SIGNATURE:
+                // Keep the numerator and the power of two of the
+                // denominator
+                Event->status = MIDI_META_EVENT;
+                Event->data1 = command;
+                Event->data2 = Track->pos[0];
+                Event->param = Track->pos[1];
+                found = TRUE;
+                break;
+
+            case MIDI_TEXT:
+            case MIDI_LYRIC:
+            case MIDI_MARKER:
+            case MIDI_CUE_POINT:
+                // Keep where the text is in the song
+                Event->status = MIDI_META_EVENT;
+                Event->data1 = command;
+                Event->data2 = min(length, 0xffL);
+                Event->param = Track->pos - Music->data;
+                found = TRUE;
+                break;
+            }
 
-                Track->pos += length;
+            Track->pos += length;
+        }
+        else if ((event == MIDI_SYSEX) || (event == MIDI_SYSEX_CONTINUE))
+        {
+            Event->status = event;
+            found = _MIDI_SysEx(Music, Track);
+        }
+        else
+        {
+            if (event & MIDI_RUNNING_STATUS)
+            {
+                Track->RunningStatus = event;
             }
             else
             {
-                if (event & MIDI_RUNNING_STATUS)
-                {
-                    Track->RunningStatus = event;
-                }
-                else
-                {
-                    event = Track->RunningStatus;
-                    Track->pos--;
-                }
-
-                channel = GET_MIDI_CHANNEL(event);
-                command = GET_MIDI_COMMAND(event);
-                switch (command)
-                {
-                case MIDI_NOTE_OFF:
-                    GET_NEXT_EVENT(Track, c1);
-                    GET_NEXT_EVENT(Track, c2);
-                    if (_MIDI_Funcs->NoteOff)
-                    {
-                        _MIDI_Funcs->NoteOff(channel, c1, c2);
-                        break;
-                    }
-                    break;
-
-                case MIDI_NOTE_ON:
-                    GET_NEXT_EVENT(Track, c1);
-                    GET_NEXT_EVENT(Track, c2);
-                    if (_MIDI_Funcs->NoteOn)
-                    {
-                        _MIDI_Funcs->NoteOn(channel, c1, c2);
-                        break;
-                    }
-                    break;
-
-                case MIDI_POLY_AFTER_TCH:
-                    GET_NEXT_EVENT(Track, c1);
-                    GET_NEXT_EVENT(Track, c2);
-                    if (_MIDI_Funcs->PolyAftertouch)
-                    {
-                        _MIDI_Funcs->PolyAftertouch(channel, c1, c2);
-                        break;
-                    }
-                    break;
-
-                case MIDI_CONTROL_CHANGE:
-                    GET_NEXT_EVENT(Track, c1);
-                    GET_NEXT_EVENT(Track, c2);
-                    if (c1 == MIDI_MONO_MODE_ON)
-                    {
-                        Track->pos++;
-                    }
-                    if (c1 == MIDI_VOLUME)
-                    {
-                        _MIDI_SetChannelVolume(channel, c2);
-                    }
-                    else
-                    {
-                        if (_MIDI_Funcs->ControlChange)
-                        {
-                            _MIDI_Funcs->ControlChange(channel, c1, c2);
-                            break;
-                        }
-                    }
-                    break;
-
-                case MIDI_PROGRAM_CHANGE:
-                    GET_NEXT_EVENT(Track, c1);
-                    if (_MIDI_Funcs->ProgramChange)
-                    {
-                        _MIDI_Funcs->ProgramChange(channel, c1);
-                        break;
-                    }
-                    break;
+                event = Track->RunningStatus;
+                Track->pos--;
+            }
 
-                case MIDI_AFTER_TOUCH:
-                    GET_NEXT_EVENT(Track, c1);
-                    if (_MIDI_Funcs->ChannelAftertouch)
-                    {
-                        _MIDI_Funcs->ChannelAftertouch(channel, c1);
-                        break;
-                    }
-                    break;
+            command = GET_MIDI_COMMAND(event);
+            length = _MIDI_CommandLengths[command];
 
-                case MIDI_PITCH_BEND:
-                    GET_NEXT_EVENT(Track, c1);
-                    GET_NEXT_EVENT(Track, c2);
-                    if (_MIDI_Funcs->PitchBend)
-                    {
-                        _MIDI_Funcs->PitchBend(channel, c1, c2);
-                        break;
-                    }
-                    break;
+            Event->status = event;
+            Event->data1 = (length > 0) ? Track->pos[0] : 0;
+            Event->data2 = (length > 1) ? Track->pos[1] : 0;
+            Event->param = 0;
 
-                default:
-                    break;
-                }
+            if ((command == MIDI_CONTROL_CHANGE) &&
+                (Event->data1 == MIDI_MONO_MODE_ON))
+            {
+                length++;
             }
 
-            Track->delay = _MIDI_ReadDelta(Track);
+            Track->pos += length;
+            found = (command != MIDI_SPECIAL);
         }
 
-        Track->delay--;
-        Track = Track->next;
+        if (Track->active)
+        {
+            Track->time += _MIDI_ReadDelta(Track);
+        }
 
-        if (_MIDI_ActiveTracks == 0)
+        if (found)
         {
-            _MIDI_ResetTracks();
-            if (_MIDI_Loop)
-            {
-                Track = _MIDI_List.start;
-                for (channel = 0; channel < NUM_MIDI_CHANNELS; channel++)
-                {
-                    if (_MIDI_ChannelVolume[channel] != GENMIDI_DefaultVolume)
-                    {
-                        _MIDI_SetChannelVolume(channel, GENMIDI_DefaultVolume);
-                    }
-                }
-            }
-            else
-            {
-                _MIDI_SongActive = FALSE;
-                Track = NULL;
-                break;
-            }
+            return (TRUE);
         }
     }
+
+    return (FALSE);
 }
 
 /*---------------------------------------------------------------------
-   Function: MIDI_AllNotesOff
-
-   Sends all notes off commands on all midi channels.
+   Function: _MIDI_CompileSong
+
+   Merges the tracks of the song into a single list of events sorted
+   by time.  Events that occur at the same time are kept in track
+   order, so they are sent in the same order as when the tracks were
+   read during playback.  The list ends with an end of track event at
+   the time the last track finishes.  The tracks of a format 2 song
+   are separate patterns that play one after another.
 ---------------------------------------------------------------------*/
 
-int MIDI_AllNotesOff(
-    void)
+static int _MIDI_CompileSong(
+    midisong *Music,
+    track *tracks,
+    int numtracks,
+    int format)
 
 {
-    int channel;
+    track *Track;
+    track *next;
+    unsigned long songend;
+    long index;
+    int i;
+
+    // Count the events in the song
+    Music->numevents = 0;
+    Music->channels = 0;
+    songend = 0;
+    for (i = 0; i < numtracks; i++)
+    {
+        Track = &tracks[i];
+        Track->base = (format == 2) ? songend : 0;
+        _MIDI_ResetTrack(Track);
+        while (_MIDI_ReadEvent(Music, Track))
+        {
+            if (GET_MIDI_COMMAND(Track->event.status) != MIDI_SPECIAL)
+            {
+                Music->channels |= 1 << GET_MIDI_CHANNEL(Track->event.status);
+            }
+            Music->numevents++;
+        }
 
-    if (_MIDI_Funcs == NULL)
+        if (Track->time > songend)
+        {
+            songend = Track->time;
+        }
+    }
+
+    Music->Events = farmalloc((Music->numevents + 1) * sizeof(midievent));
+    if (Music->Events == NULL)
     {
-        return MIDI_Error;
+        return (MIDI_NoMemory);
     }
-    for (channel = 0; channel < NUM_MIDI_CHANNELS; channel++)
+
+    for (i = 0; i < numtracks; i++)
     {
-        _MIDI_Funcs->ControlChange(channel, MIDI_ALL_NOTES_OFF, 0);
+        _MIDI_ResetTrack(&tracks[i]);
+        tracks[i].pending = _MIDI_ReadEvent(Music, &tracks[i]);
+    }
+
+    // Take the earliest waiting event, lowest track first
+    for (index = 0; index < Music->numevents; index++)
+    {
+        next = NULL;
+        for (i = 0; i < numtracks; i++)
+        {
+            Track = &tracks[i];
+            if ((Track->pending) &&
+                ((next == NULL) || (Track->event.time < next->event.time)))
+            {
+                next = Track;
+            }
+        }
+
+        Music->Events[index] = next->event;
+        next->pending = _MIDI_ReadEvent(Music, next);
     }
 
+    _MIDI_EndSong(Music, songend);
+
     return (MIDI_Ok);
 }
 
 /*---------------------------------------------------------------------
-   Function: _MIDI_SetChannelVolume
+   Function: _MIDI_EndSong
 
-   Sets the volume of the specified midi channel.
+   Adds the end of track event that closes the event list of a song.
 ---------------------------------------------------------------------*/
 
-static void _MIDI_SetChannelVolume(
-    int channel,
-    int volume)
+static void _MIDI_EndSong(
+    midisong *Music,
+    unsigned long songend)
 
 {
-    _MIDI_ChannelVolume[channel] = volume;
-
-    if (_MIDI_Funcs->SetVolume == NULL)
-    {
-        volume *= _MIDI_TotalVolume;
-        volume /= MIDI_MaxVolume;
-    }
-
-    if (_MIDI_Funcs->ControlChange != NULL)
-    {
-        _MIDI_Funcs->ControlChange(channel, MIDI_VOLUME, volume);
-    }
+    midievent huge *Event;
+
+    Event = &Music->Events[Music->numevents];
+    Event->time = songend;
+    Event->status = MIDI_META_EVENT;
+    Event->data1 = MIDI_END_OF_TRACK;
+    Event->data2 = 0;
+    Event->param = 0;
 }
 
 /*---------------------------------------------------------------------
-   Function: _MIDI_SendChannelVolumes
+   Function: _MIDI_StoreEvent
 
-   Sets the volume on all the midi channels.
+   Adds an event to the song being compiled.  While the events are
+   being counted, the song has no event list yet and only the count
+   and the channels used are updated.
 ---------------------------------------------------------------------*/
 
-static void _MIDI_SendChannelVolumes(
-    void)
+static void _MIDI_StoreEvent(
+    midisong *Music,
+    midievent *Event)
 
 {
-    int channel;
+    if (Music->Events != NULL)
+    {
+        Music->Events[Music->numevents] = *Event;
+    }
 
-    for (channel = 0; channel < NUM_MIDI_CHANNELS; channel++)
+    if (GET_MIDI_COMMAND(Event->status) != MIDI_SPECIAL)
     {
-        _MIDI_SetChannelVolume(channel, _MIDI_ChannelVolume[channel]);
+        Music->channels |= 1 << GET_MIDI_CHANNEL(Event->status);
     }
+
+    Music->numevents++;
 }
 
 /*---------------------------------------------------------------------
-   Function: MIDI_Reset
+   Function: _MIDI_ReadMUS
 
-   Resets the MIDI device to General Midi defaults.
+   Converts the score of an id MUS file into MIDI events.  Returns the
+   time at which the score ends.
 ---------------------------------------------------------------------*/
 
-void MIDI_Reset(
-    void)
+static unsigned long _MIDI_ReadMUS(
+    midisong *Music,
+    track *Track)
 
 {
+    int data;
+    int type;
     int channel;
+    int controller;
+    int found;
+    unsigned char velocity[NUM_MIDI_CHANNELS];
+    midievent Event;
 
     for (channel = 0; channel < NUM_MIDI_CHANNELS; channel++)
     {
-        _MIDI_Funcs->ControlChange(channel, MIDI_RESET_ALL_CONTROLLERS, 0);
-        _MIDI_Funcs->ControlChange(channel, MIDI_RPN_MSB, MIDI_PITCHBEND_MSB);
-        _MIDI_Funcs->ControlChange(channel, MIDI_RPN_LSB, MIDI_PITCHBEND_LSB);
-        _MIDI_Funcs->ControlChange(channel, MIDI_DATAENTRY_MSB, 2); /* Pitch Bend Sensitivity MSB */
-        _MIDI_Funcs->ControlChange(channel, MIDI_DATAENTRY_LSB, 0); /* Pitch Bend Sensitivity LSB */
-        _MIDI_SetChannelVolume(channel, GENMIDI_DefaultVolume);
+        velocity[channel] = MUS_DefaultVelocity;
     }
-}
 
-static int sub_247F7(void)
-{
-    if (_MIDI_Funcs == NULL)
+    Music->numevents = 0;
+    Music->channels = 0;
+    Track->pos = Track->start;
+    Track->time = 0;
+    while (Track->pos < Track->end)
     {
-        return MIDI_Error;
-    }
-    MIDI_AllNotesOff();
-    MIDI_Reset();
+        GET_NEXT_EVENT(Track, data);
+        type = (data >> 4) & 0x7;
 
-    return MIDI_Ok;
-}
+        // MUS keeps percussion on its last channel
+        channel = GET_MIDI_CHANNEL(data);
+        if (channel == MUS_RHYTHM_CHANNEL)
+        {
+            channel = MIDI_RHYTHM_CHANNEL;
+        }
+        else if (channel >= MIDI_RHYTHM_CHANNEL)
+        {
+            channel++;
+        }
 
-/*---------------------------------------------------------------------
-   Function: MIDI_SetVolume
+        Event.time = Track->time;
+        Event.data1 = 0;
+        Event.data2 = 0;
+        Event.param = 0;
+        found = TRUE;
 
-   Sets the total volume of the music.
----------------------------------------------------------------------*/
+        switch (type)
+        {
+        case MUS_RELEASE_NOTE:
+            Event.status = (MIDI_NOTE_OFF << 4) | channel;
+            Event.data1 = *Track->pos++ & 0x7f;
+            break;
+
+        case MUS_PLAY_NOTE:
+            Event.status = (MIDI_NOTE_ON << 4) | channel;
+            Event.data1 = *Track->pos & 0x7f;
+            if (*Track->pos++ & 0x80)
+            {
+                velocity[channel] = *Track->pos++ & 0x7f;
+            }
+            Event.data2 = velocity[channel];
+            break;
+
+        case MUS_PITCH_BEND:
+            // The bend is 8 bits, centered on 128
+            Event.status = (MIDI_PITCH_BEND << 4) | channel;
+            Event.data1 = (*Track->pos << 6) & 0x7f;
+            Event.data2 = *Track->pos++ >> 1;
+            break;
+
+        case MUS_SYSTEM_EVENT:
+            controller = *Track->pos++;
+            found = ((controller >= MUS_FIRST_SYSTEM_EVENT) &&
+                     (controller <= MUS_LAST_SYSTEM_EVENT));
+            if (found)
+            {
+                Event.status = (MIDI_CONTROL_CHANGE << 4) | channel;
+                Event.data1 = _MIDI_MUSSystemEvents[controller - MUS_FIRST_SYSTEM_EVENT];
+            }
+            break;
 
-int MIDI_SetVolume(
-    int volume)
+        case MUS_CONTROLLER:
+            controller = *Track->pos++;
+            Event.data2 = *Track->pos++ & 0x7f;
+            found = (controller <= MUS_LAST_CONTROLLER);
+            if (controller == MUS_PROGRAM_CHANGE)
+            {
+                Event.status = (MIDI_PROGRAM_CHANGE << 4) | channel;
+                Event.data1 = Event.data2;
+                Event.data2 = 0;
+            }
+            else if (found)
+            {
+                Event.status = (MIDI_CONTROL_CHANGE << 4) | channel;
+                Event.data1 = _MIDI_MUSControllers[controller];
+            }
+            break;
 
-{
-    if (_MIDI_Funcs == NULL)
-    {
-        return (MIDI_NullMidiModule);
-    }
+        case MUS_MEASURE_END:
+            found = FALSE;
+            break;
 
-    volume = min(MIDI_MaxVolume, volume);
-    volume = max(0, volume);
+        default:
+            // End of the score
+            Track->pos = Track->end;
+            found = FALSE;
+            break;
+        }
 
-    _MIDI_TotalVolume = volume;
+        if (found)
+        {
+            _MIDI_StoreEvent(Music, &Event);
+        }
 
-    if (_MIDI_Funcs->SetVolume)
-    {
-        _MIDI_Funcs->SetVolume(volume);
-    }
-    else
-    {
-        _MIDI_SendChannelVolumes();
+        if ((data & MUS_DELAY_FOLLOWS) && (Track->pos < Track->end))
+        {
+            Track->time += _MIDI_ReadDelta(Track);
+        }
     }
 
-    return (MIDI_Ok);
+    return (Track->time);
 }
 
 /*---------------------------------------------------------------------
-   Function: MIDI_GetVolume
+   Function: _MIDI_CompileMUS
 
-   Returns the total volume of the music.
+   Compiles an id MUS file.  The score plays at 140 ticks a second,
+   which is a division of 70 at the default tempo.
 ---------------------------------------------------------------------*/
 
-int MIDI_GetVolume(
-    void)
+static int _MIDI_CompileMUS(
+    midisong *Music,
+    unsigned char *song)
 
 {
-    int volume;
+    track Score;
+    unsigned long songend;
 
-    if (_MIDI_Funcs == NULL)
-    {
-        return (MIDI_NullMidiModule);
-    }
+    Score.start = song + *(unsigned short *)(song + MUS_SCORE_START);
+    Score.end = Score.start + *(unsigned short *)(song + MUS_SCORE_LENGTH);
+    Music->division = MUS_DIVISION;
 
-    if (_MIDI_Funcs->GetVolume)
+    // Count the events, then convert them
+    _MIDI_ReadMUS(Music, &Score);
+    Music->Events = farmalloc((Music->numevents + 1) * sizeof(midievent));
+    if (Music->Events == NULL)
     {
-        volume = _MIDI_Funcs->GetVolume();
-    }
-    else
-    {
-        volume = _MIDI_TotalVolume;
+        return (MIDI_NoMemory);
     }
 
-    return (volume);
-}
-
-/*---------------------------------------------------------------------
-   Function: MIDI_SetLoopFlag
-
-   Sets whether the song should loop when finished or not.
----------------------------------------------------------------------*/
-
-void MIDI_SetLoopFlag(
-    int loopflag)
+    songend = _MIDI_ReadMUS(Music, &Score);
+    _MIDI_EndSong(Music, songend);
 
-{
-    _MIDI_Loop = loopflag;
+    return (MIDI_Ok);
 }
 
 /*---------------------------------------------------------------------
-   Function: MIDI_ContinueSong
+   Function: _MIDI_XMINoteOffs
 
-   Continues playback of a paused song.
+   Stores the note offs of an XMIDI song that are due by the specified
+   time.  The pending note offs are kept sorted by time.
 ---------------------------------------------------------------------*/
 
-void MIDI_ContinueSong(
-    void)
+static void _MIDI_XMINoteOffs(
+    midisong *Music,
+    xminote *Notes,
+    int *numnotes,
+    unsigned long time)
 
 {
-    if (_MIDI_SongLoaded)
+    int index;
+    midievent Event;
+
+    for (index = 0; index < *numnotes; index++)
     {
-        _MIDI_SongActive = TRUE;
+        if (Notes[index].time > time)
+        {
+            break;
+        }
+
+        Event.time = Notes[index].time;
+        Event.status = (MIDI_NOTE_OFF << 4) | Notes[index].channel;
+        Event.data1 = Notes[index].key;
+        Event.data2 = 0;
+        Event.param = 0;
+        _MIDI_StoreEvent(Music, &Event);
     }
+
+    *numnotes -= index;
+    memmove(Notes, &Notes[index], *numnotes * sizeof(xminote));
 }
 
 /*---------------------------------------------------------------------
-   Function: MIDI_PauseSong
+   Function: _MIDI_ReadXMI
 
-   Pauses playback of the current song.
+   Converts the events of an XMIDI song into MIDI events.  XMIDI notes
+   carry their duration, so a note off is added for each of them.
+   Returns the time at which the song ends.
 ---------------------------------------------------------------------*/
 
-void MIDI_PauseSong(
-    void)
+static unsigned long _MIDI_ReadXMI(
+    midisong *Music,
+    track *Track,
+    xminote *Notes)
 
 {
-    if (_MIDI_SongLoaded)
+    int event;
+    int command;
+    int numnotes;
+    int index;
+    long length;
+    unsigned long duration;
+    midievent *Event;
+
+    Music->numevents = 0;
+    Music->channels = 0;
+    numnotes = 0;
+    Event = &Track->event;
+    Track->pos = Track->start;
+    Track->time = 0;
+    while (Track->pos < Track->end)
     {
-        _MIDI_SongActive = FALSE;
-        MIDI_AllNotesOff();
-    }
-}
+        // The time between events is a sum of bytes below 0x80
+        GET_NEXT_EVENT(Track, event);
+        if (event < MIDI_RUNNING_STATUS)
+        {
+            Track->time += event;
+            continue;
+        }
 
-/*---------------------------------------------------------------------
-   Function: MIDI_SongPlaying
+        _MIDI_XMINoteOffs(Music, Notes, &numnotes, Track->time);
 
-   Returns whether a song is playing or not.
----------------------------------------------------------------------*/
+        Event->time = Track->time;
+        Event->status = event;
+        Event->data1 = 0;
+        Event->data2 = 0;
+        Event->param = 0;
 
-int MIDI_SongPlaying(
-    void)
+        if (event == MIDI_META_EVENT)
+        {
+            GET_NEXT_EVENT(Track, command);
+            length = _MIDI_ReadDelta(Track);
+            Event->data1 = command;
 
-{
-    return (_MIDI_SongActive);
-}
+            switch (command)
+            {
+            case MIDI_END_OF_TRACK:
+                Track->end = Track->pos;
+                break;
 
-/*---------------------------------------------------------------------
-   Function: MIDI_SetMidiFuncs
+            case MIDI_TIME_SIGNATURE:
+                Event->data2 = Track->pos[0];
+                Event->param = Track->pos[1];
+                _MIDI_StoreEvent(Music, Event);
+                break;
 
-   Selects the routines that send the MIDI data to the music device.
----------------------------------------------------------------------*/
+            case MIDI_TEXT:
+            case MIDI_LYRIC:
+            case MIDI_MARKER:
+            case MIDI_CUE_POINT:
+                Event->data2 = min(length, 0xffL);
+                Event->param = Track->pos - Music->data;
+                _MIDI_StoreEvent(Music, Event);
+                break;
+            }
 
-int MIDI_SetMidiFuncs(
-    midifuncs *funcs)
+            // The timing is fixed, so tempo changes are ignored
+            Track->pos += length;
+        }
+        else if ((event == MIDI_SYSEX) || (event == MIDI_SYSEX_CONTINUE))
+        {
+            if (_MIDI_SysEx(Music, Track))
+            {
+                _MIDI_StoreEvent(Music, Event);
+            }
+        }
+        else
+        {
+            command = GET_MIDI_COMMAND(event);
+            length = _MIDI_CommandLengths[command];
+            Event->data1 = (length > 0) ? Track->pos[0] : 0;
+            Event->data2 = (length > 1) ? Track->pos[1] : 0;
+            Track->pos += length;
 
-{
-    _MIDI_Funcs = funcs;
-    return MIDI_Ok;
+            // Make room by ending the note due to end soonest now,
+            // before this note starts in case it plays the same key.
+            if ((command == MIDI_NOTE_ON) && (numnotes == XMI_MaxNotes))
+            {
+                Notes[0].time = Track->time;
+                _MIDI_XMINoteOffs(Music, Notes, &numnotes, Track->time);
+            }
+
+            _MIDI_StoreEvent(Music, Event);
+
+            if (command == MIDI_NOTE_ON)
+            {
+                duration = _MIDI_ReadDelta(Track);
+
+                index = numnotes;
+                while ((index > 0) && (Notes[index - 1].time > Track->time + duration))
+                {
+                    Notes[index] = Notes[index - 1];
+                    index--;
+                }
+
+                Notes[index].time = Track->time + duration;
+                Notes[index].channel = GET_MIDI_CHANNEL(event);
+                Notes[index].key = Event->data1;
+                numnotes++;
+            }
+        }
+    }
+
+    if (numnotes > 0)
+    {
+        Track->time = max(Track->time, Notes[numnotes - 1].time);
+        _MIDI_XMINoteOffs(Music, Notes, &numnotes, Track->time);
+    }
+
+    return (Track->time);
 }
 
 /*---------------------------------------------------------------------
-   Function: MIDI_StopSong
+   Function: _MIDI_FindXMIEvents
 
-   Stops playback of the currently playing song.
+   Finds the events of the first song in an XMIDI file.  Returns FALSE
+   if the file has none.
 ---------------------------------------------------------------------*/
 
-void MIDI_StopSong(
-    void)
+static int _MIDI_FindXMIEvents(
+    unsigned char *song,
+    track *Track)
 
 {
-    if (_MIDI_SongLoaded)
+    unsigned char *ptr;
+    unsigned char *end;
+    long length;
+
+    // Skip the directory of songs, and the collection that holds them
+    ptr = song;
+    if (*(unsigned long *)(ptr + 8) == XMI_XDIR_SIGNATURE)
     {
-        TS_Terminate(_MIDI_PlayRoutine);
+        ptr += 8 + ((_MIDI_ReadNumber(ptr + 4, 4) + 1) & ~1L);
+        if (*(unsigned long *)ptr != XMI_CAT_SIGNATURE)
+        {
+            return (FALSE);
+        }
 
-        _MIDI_SongActive = FALSE;
-        _MIDI_SongLoaded = FALSE;
+        ptr += 12;
+    }
 
-        sub_247F7();
+    if ((*(unsigned long *)ptr != XMI_FORM_SIGNATURE) ||
+        (*(unsigned long *)(ptr + 8) != XMI_XMID_SIGNATURE))
+    {
+        return (FALSE);
+    }
 
-        if (_MIDI_Funcs->ReleasePatches)
+    end = ptr + 8 + _MIDI_ReadNumber(ptr + 4, 4);
+    ptr += 12;
+    while (ptr < end)
+    {
+        length = _MIDI_ReadNumber(ptr + 4, 4);
+        if (*(unsigned long *)ptr == XMI_EVNT_SIGNATURE)
         {
-            _MIDI_Funcs->ReleasePatches();
+            Track->start = ptr + 8;
+            Track->end = Track->start + length;
+            return (TRUE);
         }
 
-        _MIDI_List.start = NULL;
-        _MIDI_List.end = NULL;
-        farfree(_MIDI_TrackPtr);
-        _MIDI_TrackPtr = NULL;
+        ptr += 8 + ((length + 1) & ~1L);
     }
+
+    return (FALSE);
 }
 
 /*---------------------------------------------------------------------
-   Function: MIDI_PlaySong
+   Function: _MIDI_CompileXMI
 
-   Begins playback of a MIDI song.
+   Compiles the first song of an XMIDI file.  XMIDI plays at 120 ticks
+   a second, which is a division of 60 at the default tempo.
 ---------------------------------------------------------------------*/
 
-int MIDI_PlaySong(
-    unsigned char *song,
-    int loopflag)
+static int _MIDI_CompileXMI(
+    midisong *Music,
+    unsigned char *song)
 
 {
-    int numtracks;
-    int format;
-    long headersize;
-    long tracklength;
-    track *CurrentTrack;
-    unsigned char *ptr;
+    track Events;
+    xminote *Notes;
+    unsigned long songend;
 
-    if (_MIDI_SongLoaded)
+    if (!_MIDI_FindXMIEvents(song, &Events))
     {
-        MIDI_StopSong();
+        return (MIDI_InvalidMidiFile);
     }
 
-    if (_MIDI_Funcs == NULL)
+    Music->division = XMI_DIVISION;
+
+    Notes = malloc(XMI_MaxNotes * sizeof(xminote));
+    if (Notes == NULL)
     {
-        return (MIDI_NullMidiModule);
+        return (MIDI_NoMemory);
     }
 
-    if (*(unsigned long *)song != MIDI_HEADER_SIGNATURE)
+    // Count the events, then convert them
+    _MIDI_ReadXMI(Music, &Events, Notes);
+    Music->Events = farmalloc((Music->numevents + 1) * sizeof(midievent));
+    if (Music->Events == NULL)
     {
-        return (MIDI_InvalidMidiFile);
+        free(Notes);
+        return (MIDI_NoMemory);
     }
 
-    song += 4;
+    songend = _MIDI_ReadXMI(Music, &Events, Notes);
+    _MIDI_EndSong(Music, songend);
+    free(Notes);
 
-    headersize = _MIDI_ReadNumber(song, 4);
-    song += 4;
-    format = _MIDI_ReadNumber(song, 2);
-    numtracks = _MIDI_ReadNumber(song + 2, 2);
-    _MIDI_DivisionRate = _MIDI_ReadNumber(song + 4, 2);
+    return (MIDI_Ok);
+}
 
-    if (format > MAX_FORMAT)
+/*---------------------------------------------------------------------
+   Function: _MIDI_ThinControl
+
+   Returns the control changed by an event that the thinning pass may
+   remove, or -1 if the event must be kept.  Bank select, registered
+   and non-registered parameters, data entry, Extended MIDI and loop
+   controllers, and channel mode messages are never removed, since
+   they select or trigger something rather than set a level.
+---------------------------------------------------------------------*/
+
+static int _MIDI_ThinControl(
+    midievent huge *Event)
+
+{
+    int control;
+
+    switch (GET_MIDI_COMMAND(Event->status))
     {
-        return (MIDI_UnknownMidiFormat);
+    case MIDI_PITCH_BEND:
+        return (MIDI_BendControl);
+
+    case MIDI_CONTROL_CHANGE:
+        control = Event->data1;
+        switch (control)
+        {
+        case MIDI_BANK_SELECT_MSB:
+        case MIDI_BANK_SELECT_LSB:
+        case MIDI_DATAENTRY_MSB:
+        case MIDI_DATAENTRY_LSB:
+        case MIDI_DATA_INCREMENT:
+        case MIDI_DATA_DECREMENT:
+        case MIDI_NRPN_LSB:
+        case MIDI_NRPN_MSB:
+        case MIDI_RPN_LSB:
+        case MIDI_RPN_MSB:
+            return (-1);
+        }
+
+        if (((control >= EMIDI_FIRST_CONTROLLER) &&
+             (control <= EMIDI_LAST_CONTROLLER)) ||
+            (control >= MIDI_FIRST_MODE_MESSAGE))
+        {
+            return (-1);
+        }
+
+        return (control);
     }
 
-    ptr = song + headersize;
-    _MIDI_List.start = NULL;
-    _MIDI_List.end = NULL;
-    if (numtracks == 0)
+    return (-1);
+}
+
+/*---------------------------------------------------------------------
+   Function: _MIDI_RampSlot
+
+   Returns where the thinning pass keeps the ramp of a control, or -1
+   if only repeated values of the control are removed.
+---------------------------------------------------------------------*/
+
+static int _MIDI_RampSlot(
+    int control)
+
+{
+    switch (control)
     {
-        return (MIDI_NoTracks);
+    case MIDI_BendControl:
+        return (0);
+    case MIDI_MODULATION:
+        return (1);
+    case MIDI_BREATH:
+        return (2);
+    case MIDI_FOOT:
+        return (3);
+    case MIDI_VOLUME:
+        return (4);
+    case MIDI_BALANCE:
+        return (5);
+    case MIDI_PAN:
+        return (6);
+    case MIDI_EXPRESSION:
+        return (7);
+    }
+
+    return (-1);
+}
+
+/*---------------------------------------------------------------------
+   Function: _MIDI_KeepThinned
+
+   Puts back the last event removed from a ramp, so that the control
+   ends up at the value the song gives it.
+---------------------------------------------------------------------*/
+
+static void _MIDI_KeepThinned(
+    midisong *Music,
+    midithin *Thin,
+    int channel,
+    int slot)
+
+{
+    midievent huge *Event;
+
+    if (Thin->pending[channel][slot] < 0)
+    {
+        return;
     }
 
-    _MIDI_TrackPtr = malloc(numtracks * sizeof(track));
-    if (_MIDI_TrackPtr == NULL)
+    Event = &Music->Events[Thin->pending[channel][slot]];
+    Thin->pending[channel][slot] = -1;
+    Thin->kept[channel][slot] = Event->time;
+
+    if (slot == _MIDI_RampSlot(MIDI_BendControl))
+    {
+        Event->status = (MIDI_PITCH_BEND << 4) | channel;
+        Thin->value[channel][MIDI_BendControl] = Event->data1 + (Event->data2 << 7);
+    }
+    else
+    {
+        Event->status = (MIDI_CONTROL_CHANGE << 4) | channel;
+        Thin->value[channel][Event->data1] = Event->data2;
+    }
+}
+
+/*---------------------------------------------------------------------
+   Function: _MIDI_ThinEvents
+
+   Removes controller and pitch bend events that don't change what the
+   song sounds like, so that fewer of them reach the device.  Events
+   that repeat the current value of a control are removed.  Ramps of
+   pitch bend, modulation, breath, foot, volume, balance, pan and
+   expression are cut down to one event every 1/_MIDI_ThinResolution
+   of a beat, always keeping the last value of each ramp and the
+   value in effect when a note starts on the channel.
+---------------------------------------------------------------------*/
+
+static int _MIDI_ThinEvents(
+    midisong *Music)
+
+{
+    int channel;
+    int control;
+    int slot;
+    int value;
+    long index;
+    long count;
+    unsigned long spacing;
+    midievent huge *Event;
+    midithin *Thin;
+
+    Thin = malloc(sizeof(midithin));
+    if (Thin == NULL)
     {
         return (MIDI_NoMemory);
     }
 
-    CurrentTrack = _MIDI_TrackPtr;
-    while (numtracks--)
+    for (channel = 0; channel < NUM_MIDI_CHANNELS; channel++)
     {
-        if (*(unsigned long *)ptr != MIDI_TRACK_SIGNATURE)
+        for (control = 0; control < MIDI_NumControls; control++)
+        {
+            Thin->value[channel][control] = MIDI_NoValue;
+        }
+
+        for (slot = 0; slot < MIDI_NumRampControls; slot++)
         {
+            Thin->kept[channel][slot] = 0;
+            Thin->pending[channel][slot] = -1;
+        }
+    }
 
-            farfree(_MIDI_TrackPtr);
-            _MIDI_TrackPtr = NULL;
+    spacing = Music->division / _MIDI_ThinResolution;
 
-            return (MIDI_InvalidTrack);
+    for (index = 0; index < Music->numevents; index++)
+    {
+        Event = &Music->Events[index];
+        if (Event->status == MIDI_META_EVENT)
+        {
+            continue;
         }
 
-        tracklength = _MIDI_ReadNumber(ptr + 4, 4);
-        ptr += 8;
-        CurrentTrack->start = ptr;
-        ptr += tracklength;
-        LL_AddToTail(track, &_MIDI_List, CurrentTrack);
-        CurrentTrack++;
+        channel = GET_MIDI_CHANNEL(Event->status);
+
+        // A note starts with the controls at their real values
+        if ((GET_MIDI_COMMAND(Event->status) == MIDI_NOTE_ON) &&
+            (Event->data2 != 0))
+        {
+            for (slot = 0; slot < MIDI_NumRampControls; slot++)
+            {
+                _MIDI_KeepThinned(Music, Thin, channel, slot);
+            }
+            continue;
+        }
+
+        // After a controller reset, no value is known to repeat.
+        // Ramps waiting to end are put back before the reset.
+        if ((GET_MIDI_COMMAND(Event->status) == MIDI_CONTROL_CHANGE) &&
+            (Event->data1 == MIDI_RESET_ALL_CONTROLLERS))
+        {
+            for (slot = 0; slot < MIDI_NumRampControls; slot++)
+            {
+                _MIDI_KeepThinned(Music, Thin, channel, slot);
+            }
+
+            for (control = 0; control < MIDI_NumControls; control++)
+            {
+                Thin->value[channel][control] = MIDI_NoValue;
+            }
+            continue;
+        }
+
+        control = _MIDI_ThinControl(Event);
+        if (control < 0)
+        {
+            continue;
+        }
+
+        value = Event->data2;
+        if (control == MIDI_BendControl)
+        {
+            value = Event->data1 + (Event->data2 << 7);
+        }
+
+        // The last event removed from a ramp is put back once the
+        // ramp pauses.
+        slot = _MIDI_RampSlot(control);
+        if ((slot >= 0) && (Thin->pending[channel][slot] >= 0) &&
+            (Event->time - Music->Events[Thin->pending[channel][slot]].time > spacing))
+        {
+            _MIDI_KeepThinned(Music, Thin, channel, slot);
+        }
+
+        if (value == Thin->value[channel][control])
+        {
+            Event->status = MIDI_THINNED_EVENT;
+            if (slot >= 0)
+            {
+                Thin->pending[channel][slot] = -1;
+            }
+            continue;
+        }
+
+        if ((slot >= 0) && (Thin->value[channel][control] != MIDI_NoValue) &&
+            (Event->time - Thin->kept[channel][slot] < spacing))
+        {
+            Event->status = MIDI_THINNED_EVENT;
+            Thin->pending[channel][slot] = index;
+            continue;
+        }
+
+        Thin->value[channel][control] = value;
+        if (slot >= 0)
+        {
+            Thin->kept[channel][slot] = Event->time;
+            Thin->pending[channel][slot] = -1;
+        }
     }
 
-    if (_MIDI_Funcs->GetVolume != NULL)
+    for (channel = 0; channel < NUM_MIDI_CHANNELS; channel++)
     {
-        _MIDI_TotalVolume = _MIDI_Funcs->GetVolume();
+        for (slot = 0; slot < MIDI_NumRampControls; slot++)
+        {
+            _MIDI_KeepThinned(Music, Thin, channel, slot);
+        }
     }
-    _MIDI_ResetTracks();
 
-    if (_MIDI_Funcs->LoadPatch)
+    free(Thin);
+
+    // Pack the events that are left, followed by the end of the song
+    count = 0;
+    for (index = 0; index < Music->numevents; index++)
     {
-        MIDI_LoadTimbres();
+        if (Music->Events[index].status != MIDI_THINNED_EVENT)
+        {
+            Music->Events[count++] = Music->Events[index];
+        }
     }
-    sub_247F7();
 
-    _MIDI_Loop = loopflag;
-    _MIDI_PlayRoutine = TS_ScheduleTask(_MIDI_ServiceRoutine, _MIDI_DivisionRate * 120 / 60, 1, NULL);
-    TS_Dispatch();
-
-    _MIDI_SongActive = TRUE;
-    _MIDI_SongLoaded = TRUE;
+    Music->Events[count] = Music->Events[Music->numevents];
+    _MIDI_ThinnedEvents = Music->numevents - count;
+    Music->numevents = count;
 
     return (MIDI_Ok);
 }
 
 /*---------------------------------------------------------------------
-   Function: MIDI_LoadTimbres
+   Function: _MIDI_ServiceRoutine
 
-   Preloads the timbres on cards that use patch-caching.
+   Task that plays a sequence.  The task's rate is the time since it
+   last ran, and is set to the time until the sequence needs it again.
 ---------------------------------------------------------------------*/
+static void _MIDI_ServiceRoutine(
+    task *Task)
 
-void MIDI_LoadTimbres(
-    void)
+{
+    TS_SetTaskInterval(Task, _MIDI_ServiceSequence((sequence *)Task->data,
+                                                   Task->rate));
+}
+
+/*---------------------------------------------------------------------
+   Function: _MIDI_ServiceSequence
+
+   Sends the MIDI events of a sequence that are due on this tick.
+   Returns the number of timer counts until the next event is due.
+---------------------------------------------------------------------*/
+static unsigned long _MIDI_ServiceSequence(
+    sequence *Song,
+    unsigned long elapsed)
 
 {
-    int event;
-    int command;
     int channel;
-    int length;
-    int Finished;
-    track *Track;
+    int command;
+    int key;
+    unsigned long ticks;
+    unsigned long fraction;
+    midievent huge *Event;
+    midifuncs *Device;
+
+    // Sequences that started at different times still share one clock
+    Song->clock += elapsed;
+    if ((long)(Song->clock - _MIDI_Clock) > 0)
+    {
+        _MIDI_Clock = Song->clock;
+    }
+    _MIDI_ServicedSong = Song;
+
+    // Let the device send everything for this tick at once
+    Device = _MIDI_Funcs;
+    if (Device->QueueOutput != NULL)
+    {
+        Device->QueueOutput();
+    }
 
-    Track = _MIDI_List.start;
-    while (Track != NULL)
+    _MIDI_ServiceFade(Song, elapsed);
+
+    if ((Song->active) && (Song->Transition.active) &&
+        (Song->tick >= Song->Transition.tick))
+    {
+        _MIDI_Transition(Song);
+    }
+
+    Event = &Song->Music.Events[Song->eventindex];
+    while ((Song->active) && (Event->time == Song->tick))
     {
-        Finished = FALSE;
-        while (!Finished)
+        // Events on the loop end belong to the part after the loop
+        if ((Song->loop) && (Song->tick == Song->Music.loopend) &&
+            (Song->Music.loopend > Song->Music.loopstart))
         {
-            GET_NEXT_EVENT(Track, event);
+            if (Song->Transition.active)
+            {
+                _MIDI_Transition(Song);
+            }
+            else
+            {
+                _MIDI_LoopSong(Song, &Song->Music.LoopEnd);
+            }
+            Event = &Song->Music.Events[Song->eventindex];
+            continue;
+        }
 
-            if (event == MIDI_META_EVENT)
+        Song->eventindex++;
+
+        channel = GET_MIDI_CHANNEL(Event->status);
+        command = GET_MIDI_COMMAND(Event->status);
+        switch (command)
+        {
+        case MIDI_NOTE_OFF:
+            key = _MIDI_TransposeNote(Song, channel, Event->data1, FALSE);
+            if ((key >= 0) && (_MIDI_Funcs->NoteOff))
             {
-                GET_NEXT_EVENT(Track, command);
-                GET_NEXT_EVENT(Track, length);
+                _MIDI_Funcs->NoteOff(channel, key, Event->data2);
+            }
+            break;
 
-                if (command == MIDI_END_OF_TRACK)
-                {
-                    Finished = TRUE;
-                }
-                Track->pos += length;
-                _MIDI_ReadDelta(Track);
-                continue;
+        case MIDI_NOTE_ON:
+            // Muted channels don't start notes, but a note on with no
+            // velocity is a note off and always goes through.
+            if ((Event->data2 != 0) &&
+                (MIDI_SilentChannels(Song) & (1 << channel)))
+            {
+                break;
             }
 
-            if (event & MIDI_RUNNING_STATUS)
+            key = _MIDI_TransposeNote(Song, channel, Event->data1,
+                                      Event->data2 != 0);
+            if ((key >= 0) && (_MIDI_Funcs->NoteOn))
             {
-                Track->RunningStatus = event;
+                _MIDI_Funcs->NoteOn(channel, key, Event->data2);
             }
-            else
+            break;
+
+        case MIDI_POLY_AFTER_TCH:
+            key = _MIDI_TransposeNote(Song, channel, Event->data1, FALSE);
+            if ((key >= 0) && (_MIDI_Funcs->PolyAftertouch))
             {
-                event = Track->RunningStatus;
-                Track->pos--;
+                _MIDI_Funcs->PolyAftertouch(channel, key, Event->data2);
             }
+            break;
 
-            channel = GET_MIDI_CHANNEL(event);
-            command = GET_MIDI_COMMAND(event);
-            length = _MIDI_CommandLengths[command];
+        case MIDI_CONTROL_CHANGE:
+            if (Event->data1 == MIDI_VOLUME)
+            {
+                _MIDI_SetChannelVolume(Song, channel, Event->data2);
+            }
+            else if (_MIDI_Funcs->ControlChange)
+            {
+                _MIDI_Funcs->ControlChange(channel, Event->data1, Event->data2);
+            }
+            break;
 
-            if (command == MIDI_CONTROL_CHANGE)
+        case MIDI_PROGRAM_CHANGE:
+            if (_MIDI_Funcs->ProgramChange)
             {
-                if (*Track->pos == MIDI_MONO_MODE_ON)
-                {
-                    length++;
-                }
+                _MIDI_Funcs->ProgramChange(channel, Event->data1);
             }
+            break;
 
-            if (channel == MIDI_RHYTHM_CHANNEL)
+        case MIDI_AFTER_TOUCH:
+            if (_MIDI_Funcs->ChannelAftertouch)
             {
-                if (command == MIDI_NOTE_ON)
-                {
-                    _MIDI_Funcs->LoadPatch(128 + *Track->pos);
-                    goto label;
-                }
+                _MIDI_Funcs->ChannelAftertouch(channel, Event->data1);
             }
-            else
+            break;
+
+        case MIDI_PITCH_BEND:
+            if (_MIDI_Funcs->PitchBend)
             {
-                if (command == MIDI_PROGRAM_CHANGE)
+                _MIDI_Funcs->PitchBend(channel, Event->data1, Event->data2);
+            }
+            break;
+
+        case MIDI_SPECIAL:
+            if (Event->status != MIDI_META_EVENT)
+            {
+                if (_MIDI_Funcs->SysEx)
                 {
-                    _MIDI_Funcs->LoadPatch(*Track->pos);
+                    _MIDI_Funcs->SysEx(Event->status, Song->Music.data + Event->param,
+                                       Event->data1 + (Event->data2 << 8));
                 }
+                break;
             }
 
-        label:
-            Track->pos += length;
-            _MIDI_ReadDelta(Track);
-        }
-        Track = Track->next;
+            if (Event->data1 == MIDI_TEMPO_CHANGE)
+            {
+                _MIDI_SetTempo(Song, Event->param);
+                break;
+            }
+
+            switch (Event->data1)
+            {
+            case MIDI_TEXT:
+            case MIDI_LYRIC:
+            case MIDI_MARKER:
+            case MIDI_CUE_POINT:
+                _MIDI_QueueMeta(Song, Event);
+                break;
+            }
+
+            if (Event->data1 != MIDI_END_OF_TRACK)
+            {
+                break;
+            }
+
+            // A song waiting to be replaced switches at its end at the
+            // latest.
+            if (Song->Transition.active)
+            {
+                _MIDI_Transition(Song);
+                break;
+            }
+
+            // A looping song normally jumps back at its loop end before
+            // it gets here, unless it was moved past the loop end.  A
+            // song with no length can't loop.
+            if ((Song->loop) && (Event->time > 0))
+            {
+                _MIDI_LoopSong(Song, NULL);
+                break;
+            }
+
+            Song->eventindex = 0;
+            Song->tick = 0;
+            Song->active = FALSE;
+            break;
+        }
+
+        Event = &Song->Music.Events[Song->eventindex];
+    }
+
+    // Sleep until the next event.  A paused song sleeps until
+    // MIDI_ContinueSong wakes it.
+    ticks = MIDI_MaxSleepTicks;
+    if (Song->active)
+    {
+        ticks = min(Event->time - Song->tick, ticks);
+    }
+
+    if ((Song->active) && (Song->Transition.active))
+    {
+        ticks = min(ticks, Song->Transition.tick - Song->tick);
+    }
+
+    ticks = min(ticks, 0x7fffffffL / (Song->ticklength + 1));
+    if ((Song->fade.active) || (_MIDI_FadeOwner == Song))
+    {
+        ticks = min(ticks, max(MIDI_FadeStep / Song->ticklength, 1L));
+    }
+
+    Song->sleepticks = 0;
+    if (Song->active)
+    {
+        Song->tick += ticks;
+        Song->sleepticks = ticks;
+    }
+
+    // Carry the fraction of a timer count left over to the next wait
+    // so that the song doesn't drift.
+    fraction = ticks * Song->tickfraction + Song->timefraction;
+    Song->timefraction = fraction & 0xffff;
+
+    if (Device->FlushOutput != NULL)
+    {
+        Device->FlushOutput();
+    }
+
+    _MIDI_ServicedSong = NULL;
+
+    return (ticks * Song->ticklength + (fraction >> 16));
+}
+
+/*---------------------------------------------------------------------
+   Function: _MIDI_StartFade
+
+   Sets up a fade from one volume to another over the specified time.
+---------------------------------------------------------------------*/
+
+static void _MIDI_StartFade(
+    midifade *Fade,
+    int start,
+    int target,
+    int milliseconds,
+    int stopflag)
+
+{
+    Fade->start = start;
+    Fade->target = target;
+    Fade->length = _MIDI_MulDiv(max(milliseconds, 1), MIDI_TimerRate, 0, 1000, NULL);
+    Fade->elapsed = 0;
+    Fade->wait = 0;
+    Fade->stop = stopflag;
+    Fade->active = TRUE;
+}
+
+/*---------------------------------------------------------------------
+   Function: _MIDI_StepFade
+
+   Moves a fade along by the time that has passed, in timer counts.
+   Returns TRUE with the new volume when it is time to update it.
+---------------------------------------------------------------------*/
+
+static int _MIDI_StepFade(
+    midifade *Fade,
+    unsigned long elapsed,
+    int *volume)
+
+{
+    if (!Fade->active)
+    {
+        return (FALSE);
+    }
+
+    Fade->elapsed += elapsed;
+    if (Fade->elapsed >= Fade->length)
+    {
+        *volume = Fade->target;
+        Fade->active = FALSE;
+        return (TRUE);
+    }
+
+    if (elapsed < Fade->wait)
+    {
+        Fade->wait -= elapsed;
+        return (FALSE);
+    }
+
+    Fade->wait = MIDI_FadeStep;
+
+    if (Fade->target > Fade->start)
+    {
+        *volume = Fade->start +
+                  (int)_MIDI_MulDiv(Fade->target - Fade->start,
+                                    Fade->elapsed, 0, Fade->length, NULL);
+    }
+    else
+    {
+        *volume = Fade->start -
+                  (int)_MIDI_MulDiv(Fade->start - Fade->target,
+                                    Fade->elapsed, 0, Fade->length, NULL);
+    }
+
+    return (TRUE);
+}
+
+/*---------------------------------------------------------------------
+   Function: _MIDI_ServiceFade
+
+   Moves the fades run by a sequence's task along by the time that has
+   passed.  A sequence that fades out to be stopped is silenced at the
+   end of the fade.  One of the sequences also runs the fade of the
+   total music volume.
+---------------------------------------------------------------------*/
+
+static void _MIDI_ServiceFade(
+    sequence *Song,
+    unsigned long elapsed)
+
+{
+    int volume;
+
+    if ((_MIDI_StepFade(&Song->fade, elapsed, &volume)) &&
+        (volume != Song->volume))
+    {
+        Song->volume = volume;
+        _MIDI_SendChannelVolumes(Song);
+    }
+
+    if ((!Song->fade.active) && (Song->fade.stop))
+    {
+        Song->fade.stop = FALSE;
+        Song->active = FALSE;
+        _MIDI_NotesOff(Song->Music.channels);
+    }
+
+    if (_MIDI_FadeOwner == Song)
+    {
+        if ((_MIDI_StepFade(&_MIDI_MasterFade, elapsed, &volume)) &&
+            (volume != _MIDI_TotalVolume))
+        {
+            _MIDI_ApplyVolume(volume);
+        }
+
+        if (!_MIDI_MasterFade.active)
+        {
+            _MIDI_FadeOwner = NULL;
+        }
+    }
+}
+
+/*---------------------------------------------------------------------
+   Function: _MIDI_SetTempo
+
+   Sets the rate of the song in microseconds per quarter note, before
+   the tempo scale is applied.  The length of a tick is kept in timer
+   counts, with a 16 bit fraction.
+---------------------------------------------------------------------*/
+
+static void _MIDI_SetTempo(
+    sequence *Song,
+    unsigned long tempo)
+
+{
+    unsigned long quarter;
+    unsigned long remainder;
+    unsigned long divisor;
+
+    Song->tempo = tempo;
+
+    divisor = (1000000L / MIDI_NormalTempo) * _MIDI_TempoScale;
+    quarter = _MIDI_MulDiv(tempo, MIDI_TimerRate, 0, divisor, &remainder);
+
+    Song->ticklength = quarter / Song->Music.division;
+    Song->tickfraction = _MIDI_MulDiv(quarter % Song->Music.division, 0x10000L,
+                                      _MIDI_MulDiv(remainder, 0x10000L, 0, divisor, NULL),
+                                      Song->Music.division, NULL);
+
+    if (Song->ticklength == 0)
+    {
+        Song->ticklength = 1;
+        Song->tickfraction = 0;
+    }
+}
+
+/*---------------------------------------------------------------------
+   Function: _MIDI_TransposeNote
+
+   Returns the key to send for a note event, or -1 if the transposed
+   note is out of range.  A note on records the transposition it was
+   played with, and the events that follow for the same key use it,
+   so notes end properly when the transposition changes while they
+   play.  The rhythm channel is never transposed.
+---------------------------------------------------------------------*/
+
+static int _MIDI_TransposeNote(
+    sequence *Song,
+    int channel,
+    int key,
+    int noteon)
+
+{
+    if (channel == MIDI_RHYTHM_CHANNEL)
+    {
+        return (key);
+    }
+
+    if (noteon)
+    {
+        Song->NoteShift[channel][key] = _MIDI_Transpose;
+    }
+
+    key += Song->NoteShift[channel][key];
+    if ((key < 0) || (key >= MIDI_NumKeys))
+    {
+        return (-1);
+    }
+
+    return (key);
+}
+
+/*---------------------------------------------------------------------
+   Function: _MIDI_MulDiv
+
+   Returns (a * b + offset) / divisor without losing the high bits of
+   the product.  The result must fit in 32 bits.
+---------------------------------------------------------------------*/
+
+static unsigned long _MIDI_MulDiv(
+    unsigned long a,
+    unsigned long b,
+    long offset,
+    unsigned long divisor,
+    unsigned long *remainder)
+
+{
+    unsigned long high;
+    unsigned long low;
+    unsigned long middle;
+    unsigned long cross;
+    unsigned long result;
+    unsigned long rest;
+    int bit;
+
+    // Multiply the 16 bit halves
+    low = (a & 0xffff) * (b & 0xffff);
+    high = (a >> 16) * (b >> 16);
+    middle = (a & 0xffff) * (b >> 16);
+    cross = (a >> 16) * (b & 0xffff);
+
+    middle += cross;
+    if (middle < cross)
+    {
+        high += 0x10000L;
+    }
+
+    high += middle >> 16;
+    middle <<= 16;
+    low += middle;
+    if (low < middle)
+    {
+        high++;
+    }
+
+    if (offset >= 0)
+    {
+        low += offset;
+        if (low < (unsigned long)offset)
+        {
+            high++;
+        }
+    }
+    else
+    {
+        if (low < (unsigned long)-offset)
+        {
+            high--;
+        }
+        low -= (unsigned long)-offset;
+    }
+
+    // Long division, one bit at a time
+    result = 0;
+    rest = 0;
+    for (bit = 63; bit >= 0; bit--)
+    {
+        rest <<= 1;
+        if (bit >= 32)
+        {
+            rest |= (high >> (bit - 32)) & 1;
+        }
+        else
+        {
+            rest |= (low >> bit) & 1;
+        }
+
+        result <<= 1;
+        if (rest >= divisor)
+        {
+            rest -= divisor;
+            result |= 1;
+        }
+    }
+
+    if (remainder != NULL)
+    {
+        *remainder = rest;
+    }
+
+    return (result);
+}
+
+/*---------------------------------------------------------------------
+   Function: _MIDI_BuildTempoMap
+
+   Records the time of every tempo change in the song, so that ticks
+   can be converted to milliseconds and back without rounding errors
+   adding up.
+---------------------------------------------------------------------*/
+
+static int _MIDI_BuildTempoMap(
+    midisong *Music)
+
+{
+    midievent huge *Event;
+    tempoentry huge *Tempo;
+    unsigned long scale;
+    long count;
+    long index;
+
+    count = 1;
+    for (index = 0; index < Music->numevents; index++)
+    {
+        Event = &Music->Events[index];
+        if ((Event->status == MIDI_META_EVENT) &&
+            (Event->data1 == MIDI_TEMPO_CHANGE))
+        {
+            count++;
+        }
+    }
+
+    Music->TempoMap = farmalloc(count * sizeof(tempoentry));
+    if (Music->TempoMap == NULL)
+    {
+        return (MIDI_NoMemory);
+    }
+
+    scale = 1000L * Music->division;
+
+    Tempo = Music->TempoMap;
+    Tempo->tick = 0;
+    Tempo->tempo = MIDI_DefaultTempo;
+    Tempo->milliseconds = 0;
+    Tempo->remainder = 0;
+    Music->numtempos = 1;
+
+    for (index = 0; index < Music->numevents; index++)
+    {
+        Event = &Music->Events[index];
+        if ((Event->status != MIDI_META_EVENT) ||
+            (Event->data1 != MIDI_TEMPO_CHANGE))
+        {
+            continue;
+        }
+
+        // A later change on the same tick replaces the tempo
+        if (Event->time != Tempo->tick)
+        {
+            Tempo[1].tick = Event->time;
+            Tempo[1].milliseconds = Tempo->milliseconds +
+                                    _MIDI_MulDiv(Event->time - Tempo->tick, Tempo->tempo,
+                                                 Tempo->remainder, scale, &Tempo[1].remainder);
+            Tempo++;
+            Music->numtempos++;
+        }
+
+        Tempo->tempo = Event->param;
+    }
+
+    return (MIDI_Ok);
+}
+
+/*---------------------------------------------------------------------
+   Function: _MIDI_FindTempo
+
+   Returns the last tempo change at or before the specified tick.
+---------------------------------------------------------------------*/
+
+static tempoentry huge *_MIDI_FindTempo(
+    midisong *Music,
+    unsigned long tick)
+
+{
+    long low;
+    long high;
+    long middle;
+
+    low = 0;
+    high = Music->numtempos - 1;
+    while (low < high)
+    {
+        middle = (low + high + 1) / 2;
+        if (Music->TempoMap[middle].tick <= tick)
+        {
+            low = middle;
+        }
+        else
+        {
+            high = middle - 1;
+        }
+    }
+
+    return (&Music->TempoMap[low]);
+}
+
+/*---------------------------------------------------------------------
+   Function: _MIDI_TickToTime
+
+   Returns the time in milliseconds from the start of the song to the
+   specified tick.
+---------------------------------------------------------------------*/
+
+static unsigned long _MIDI_TickToTime(
+    midisong *Music,
+    unsigned long tick)
+
+{
+    tempoentry huge *Tempo;
+
+    Tempo = _MIDI_FindTempo(Music, tick);
+
+    return (Tempo->milliseconds +
+            _MIDI_MulDiv(tick - Tempo->tick, Tempo->tempo, Tempo->remainder,
+                         1000L * Music->division, NULL));
+}
+
+/*---------------------------------------------------------------------
+   Function: _MIDI_TimeToTick
+
+   Returns the tick the song reaches at the specified time in
+   milliseconds.
+---------------------------------------------------------------------*/
+
+static unsigned long _MIDI_TimeToTick(
+    midisong *Music,
+    unsigned long milliseconds)
+
+{
+    tempoentry huge *Tempo;
+    long index;
+
+    // Find the last tempo change at or before the time
+    index = Music->numtempos - 1;
+    while ((index > 0) &&
+           ((Music->TempoMap[index].milliseconds > milliseconds) ||
+            ((Music->TempoMap[index].milliseconds == milliseconds) &&
+             (Music->TempoMap[index].remainder > 0))))
+    {
+        index--;
+    }
+
+    Tempo = &Music->TempoMap[index];
+
+    return (Tempo->tick +
+            _MIDI_MulDiv(milliseconds - Tempo->milliseconds,
+                         1000L * Music->division, -(long)Tempo->remainder,
+                         Tempo->tempo, NULL));
+}
+
+/*---------------------------------------------------------------------
+   Function: _MIDI_CurrentTick
+
+   Returns the tick the song has reached.  The task's count holds the
+   time since it last ran, as of the last timer interrupt.  Call with
+   interrupts disabled.
+---------------------------------------------------------------------*/
+
+static unsigned long _MIDI_CurrentTick(
+    sequence *Song)
+
+{
+    unsigned long ticks;
+
+    if (!Song->active)
+    {
+        return (Song->tick);
+    }
+
+    ticks = min(Song->PlayRoutine->count / Song->ticklength, Song->sleepticks);
+
+    return (Song->tick - Song->sleepticks + ticks);
+}
+
+/*---------------------------------------------------------------------
+   Function: _MIDI_InitState
+
+   Sets the song state to how it is at the start of the song, after
+   MIDI_Reset.
+---------------------------------------------------------------------*/
+
+static void _MIDI_InitState(
+    midisong *Music,
+    midistate *state)
+
+{
+    int channel;
+    midichannel *Channel;
+
+    state->tick = 0;
+    state->event = 0;
+    state->tempo = MIDI_DefaultTempo;
+    state->measure = 1;
+    state->beat = 1;
+    state->beattick = 0;
+    state->beatspermeasure = 4;
+    state->ticksperbeat = Music->division;
+
+    for (channel = 0; channel < NUM_MIDI_CHANNELS; channel++)
+    {
+        Channel = &state->channel[channel];
+        Channel->program = MIDI_NoProgram;
+        Channel->volume = GENMIDI_DefaultVolume;
+        Channel->pan = 64;
+        Channel->bendlsb = 0;
+        Channel->bendmsb = 64;
+        Channel->rpnmsb = MIDI_PITCHBEND_MSB;
+        Channel->rpnlsb = MIDI_PITCHBEND_LSB;
+        Channel->rangemsb = 2;
+        Channel->rangelsb = 0;
+    }
+}
+
+/*---------------------------------------------------------------------
+   Function: _MIDI_AdvanceState
+
+   Moves the song position of the state forward to the specified tick
+   at the current tempo and time signature.
+---------------------------------------------------------------------*/
+
+static void _MIDI_AdvanceState(
+    midistate *state,
+    unsigned long tick)
+
+{
+    unsigned long ticks;
+    unsigned long beats;
+
+    if (tick <= state->tick)
+    {
+        return;
+    }
+
+    ticks = tick - state->tick + state->beattick;
+    beats = ticks / state->ticksperbeat + state->beat - 1;
+    state->beattick = ticks % state->ticksperbeat;
+    state->beat = beats % state->beatspermeasure + 1;
+    state->measure += beats / state->beatspermeasure;
+    state->tick = tick;
+}
+
+/*---------------------------------------------------------------------
+   Function: _MIDI_ApplyEvent
+
+   Updates the state with the effect of the specified event, without
+   sending it.
+---------------------------------------------------------------------*/
+
+static void _MIDI_ApplyEvent(
+    midisong *Music,
+    midistate *state,
+    midievent huge *Event)
+
+{
+    midichannel *Channel;
+
+    _MIDI_AdvanceState(state, Event->time);
+
+    Channel = &state->channel[GET_MIDI_CHANNEL(Event->status)];
+    switch (GET_MIDI_COMMAND(Event->status))
+    {
+    case MIDI_CONTROL_CHANGE:
+        switch (Event->data1)
+        {
+        case MIDI_VOLUME:
+            Channel->volume = Event->data2;
+            break;
+
+        case MIDI_PAN:
+            Channel->pan = Event->data2;
+            break;
+
+        case MIDI_RPN_MSB:
+            Channel->rpnmsb = Event->data2;
+            break;
+
+        case MIDI_RPN_LSB:
+            Channel->rpnlsb = Event->data2;
+            break;
+
+        case MIDI_DATAENTRY_MSB:
+        case MIDI_DATAENTRY_LSB:
+            if ((Channel->rpnmsb == MIDI_PITCHBEND_MSB) &&
+                (Channel->rpnlsb == MIDI_PITCHBEND_LSB))
+            {
+                if (Event->data1 == MIDI_DATAENTRY_MSB)
+                {
+                    Channel->rangemsb = Event->data2;
+                }
+                else
+                {
+                    Channel->rangelsb = Event->data2;
+                }
+            }
+            break;
+
+        case MIDI_RESET_ALL_CONTROLLERS:
+            // The reset also deselects the registered parameter
+            Channel->bendlsb = 0;
+            Channel->bendmsb = 64;
+            Channel->rpnmsb = MIDI_RPN_NULL;
+            Channel->rpnlsb = MIDI_RPN_NULL;
+            break;
+        }
+        break;
+
+    case MIDI_PROGRAM_CHANGE:
+        Channel->program = Event->data1;
+        break;
+
+    case MIDI_PITCH_BEND:
+        Channel->bendlsb = Event->data1;
+        Channel->bendmsb = Event->data2;
+        break;
+
+    case MIDI_SPECIAL:
+        if (Event->status != MIDI_META_EVENT)
+        {
+            break;
+        }
+
+        if (Event->data1 == MIDI_TEMPO_CHANGE)
+        {
+            state->tempo = Event->param;
+        }
+        else if (Event->data1 == MIDI_TIME_SIGNATURE)
+        {
+            // A new time signature starts a new measure
+            if ((state->beat > 1) || (state->beattick > 0))
+            {
+                state->measure++;
+            }
+            state->beat = 1;
+            state->beattick = 0;
+            state->beatspermeasure = max(Event->data2, 1);
+            state->ticksperbeat = max((Music->division * 4L) >> Event->param, 1);
+        }
+        break;
+    }
+}
+
+/*---------------------------------------------------------------------
+   Function: _MIDI_BuildCheckpoints
+
+   Records the state of the song every few beats, so that a seek only
+   has to look at the events after the nearest checkpoint.
+---------------------------------------------------------------------*/
+
+static int _MIDI_BuildCheckpoints(
+    midisong *Music)
+
+{
+    midistate state;
+    unsigned long tick;
+    long index;
+
+    Music->checkpointticks = max((long)Music->division * CHECKPOINT_BEATS, 1L);
+    Music->numcheckpoints = Music->Events[Music->numevents].time /
+                               Music->checkpointticks + 1;
+
+    Music->Checkpoints = farmalloc(Music->numcheckpoints * sizeof(midistate));
+    if (Music->Checkpoints == NULL)
+    {
+        return (MIDI_NoMemory);
+    }
+
+    _MIDI_InitState(Music, &state);
+    for (index = 0; index < Music->numcheckpoints; index++)
+    {
+        tick = index * Music->checkpointticks;
+        while ((state.event < Music->numevents) &&
+               (Music->Events[state.event].time < tick))
+        {
+            _MIDI_ApplyEvent(Music, &state, &Music->Events[state.event]);
+            state.event++;
+        }
+
+        _MIDI_AdvanceState(&state, tick);
+        Music->Checkpoints[index] = state;
+    }
+
+    return (MIDI_Ok);
+}
+
+/*---------------------------------------------------------------------
+   Function: _MIDI_GetState
+
+   Finds the state of the song at the specified tick, before any
+   events at that tick are sent.
+---------------------------------------------------------------------*/
+
+static void _MIDI_GetState(
+    midisong *Music,
+    midistate *state,
+    unsigned long tick)
+
+{
+    long index;
+
+    index = min(tick / Music->checkpointticks, Music->numcheckpoints - 1);
+    *state = Music->Checkpoints[index];
+
+    while ((state->event < Music->numevents) &&
+           (Music->Events[state->event].time < tick))
+    {
+        _MIDI_ApplyEvent(Music, state, &Music->Events[state->event]);
+        state->event++;
+    }
+
+    _MIDI_AdvanceState(state, tick);
+}
+
+/*---------------------------------------------------------------------
+   Function: _MIDI_SendState
+
+   Sends the channel settings of the state "to" to the music device.
+   When "from" is not NULL, it holds the settings the device has now,
+   and only the settings that differ are sent.
+---------------------------------------------------------------------*/
+
+static void _MIDI_SendState(
+    sequence *Song,
+    midistate *from,
+    midistate *to)
+
+{
+    int channel;
+    midichannel *Old;
+    midichannel *New;
+
+    for (channel = 0; channel < NUM_MIDI_CHANNELS; channel++)
+    {
+        if (!(Song->Music.channels & (1 << channel)))
+        {
+            continue;
+        }
+
+        New = &to->channel[channel];
+        Old = (from != NULL) ? &from->channel[channel] : NULL;
+
+        if ((New->program != MIDI_NoProgram) && (_MIDI_Funcs->ProgramChange) &&
+            ((Old == NULL) || (Old->program != New->program)))
+        {
+            _MIDI_Funcs->ProgramChange(channel, New->program);
+        }
+
+        if ((Old == NULL) || (Old->volume != New->volume))
+        {
+            _MIDI_SetChannelVolume(Song, channel, New->volume);
+        }
+
+        if (_MIDI_Funcs->ControlChange)
+        {
+            if ((Old == NULL) || (Old->pan != New->pan))
+            {
+                _MIDI_Funcs->ControlChange(channel, MIDI_PAN, New->pan);
+            }
+
+            if ((Old == NULL) || (Old->rangemsb != New->rangemsb) ||
+                (Old->rangelsb != New->rangelsb))
+            {
+                _MIDI_Funcs->ControlChange(channel, MIDI_RPN_MSB, MIDI_PITCHBEND_MSB);
+                _MIDI_Funcs->ControlChange(channel, MIDI_RPN_LSB, MIDI_PITCHBEND_LSB);
+                _MIDI_Funcs->ControlChange(channel, MIDI_DATAENTRY_MSB, New->rangemsb);
+                _MIDI_Funcs->ControlChange(channel, MIDI_DATAENTRY_LSB, New->rangelsb);
+                Old = NULL;
+            }
+
+            if ((Old == NULL) || (Old->rpnmsb != New->rpnmsb) ||
+                (Old->rpnlsb != New->rpnlsb))
+            {
+                _MIDI_Funcs->ControlChange(channel, MIDI_RPN_MSB, New->rpnmsb);
+                _MIDI_Funcs->ControlChange(channel, MIDI_RPN_LSB, New->rpnlsb);
+            }
+        }
+
+        if ((_MIDI_Funcs->PitchBend) &&
+            ((Old == NULL) || (Old->bendlsb != New->bendlsb) ||
+             (Old->bendmsb != New->bendmsb)))
+        {
+            _MIDI_Funcs->PitchBend(channel, New->bendlsb, New->bendmsb);
+        }
+    }
+}
+
+/*---------------------------------------------------------------------
+   Function: _MIDI_MatchText
+
+   Returns TRUE if the text from the song is the specified name,
+   ignoring case.
+---------------------------------------------------------------------*/
+
+static int _MIDI_MatchText(
+    unsigned char *text,
+    int length,
+    char *name)
+
+{
+    if (length != (int)strlen(name))
+    {
+        return (FALSE);
+    }
+
+    while (length--)
+    {
+        if (toupper(*text++) != toupper(*name++))
+        {
+            return (FALSE);
+        }
+    }
+
+    return (TRUE);
+}
+
+/*---------------------------------------------------------------------
+   Function: _MIDI_FindLoop
+
+   Finds the loop points of the song, and records the channel settings
+   at each of them.  The loop starts at a "loopStart" marker or a loop
+   start controller, and ends at a "loopEnd" marker or a loop end
+   controller after it.  Without them the whole song loops.
+---------------------------------------------------------------------*/
+
+static void _MIDI_FindLoop(
+    midisong *Music)
+
+{
+    midievent huge *Event;
+    long index;
+    int start;
+    int end;
+
+    Music->loopstart = 0;
+    Music->loopend = Music->Events[Music->numevents].time;
+
+    start = FALSE;
+    for (index = 0; index < Music->numevents; index++)
+    {
+        Event = &Music->Events[index];
+        if (Event->status == MIDI_META_EVENT)
+        {
+            if (Event->data1 != MIDI_MARKER)
+            {
+                continue;
+            }
+
+            end = _MIDI_MatchText(Music->data + Event->param, Event->data2,
+                                  MIDI_LoopEndMarker);
+            if ((!start) && (_MIDI_MatchText(Music->data + Event->param,
+                                             Event->data2, MIDI_LoopStartMarker)))
+            {
+                start = TRUE;
+                Music->loopstart = Event->time;
+            }
+        }
+        else if (GET_MIDI_COMMAND(Event->status) == MIDI_CONTROL_CHANGE)
+        {
+            end = (Event->data1 == EMIDI_SONG_LOOP_END);
+            if ((!start) && ((Event->data1 == MIDI_LOOP_START_ALT) ||
+                             (Event->data1 == EMIDI_SONG_LOOP_START)))
+            {
+                start = TRUE;
+                Music->loopstart = Event->time;
+            }
+        }
+        else
+        {
+            continue;
+        }
+
+        if ((end) && (Event->time > Music->loopstart))
+        {
+            Music->loopend = Event->time;
+            break;
+        }
+    }
+
+    _MIDI_GetState(Music, &Music->LoopStart, Music->loopstart);
+    _MIDI_GetState(Music, &Music->LoopEnd, Music->loopend);
+}
+
+/*---------------------------------------------------------------------
+   Function: _MIDI_LoopSong
+
+   Jumps back to the loop start of the song.  Notes still playing are
+   stopped, and the channel settings at the loop start are sent, so
+   the loop sounds the same each time around.  "from" holds the
+   settings the device has now, if they are known, so that only the
+   ones that differ are sent.
+---------------------------------------------------------------------*/
+
+static void _MIDI_LoopSong(
+    sequence *Song,
+    midistate *from)
+
+{
+    _MIDI_NotesOff(Song->Music.channels);
+    _MIDI_SendState(Song, from, &Song->Music.LoopStart);
+
+    if ((from == NULL) || (from->tempo != Song->Music.LoopStart.tempo))
+    {
+        _MIDI_SetTempo(Song, Song->Music.LoopStart.tempo);
+    }
+
+    Song->eventindex = Song->Music.LoopStart.event;
+    Song->tick = Song->Music.loopstart;
+}
+
+/*---------------------------------------------------------------------
+   Function: _MIDI_NotesOff
+
+   Sends all notes off commands on the specified midi channels.
+---------------------------------------------------------------------*/
+
+static void _MIDI_NotesOff(
+    unsigned channels)
+
+{
+    int channel;
+
+    for (channel = 0; channel < NUM_MIDI_CHANNELS; channel++)
+    {
+        if (channels & (1 << channel))
+        {
+            _MIDI_Funcs->ControlChange(channel, MIDI_ALL_NOTES_OFF, 0);
+        }
+    }
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDI_AllNotesOff
+
+   Sends all notes off commands on all midi channels.
+---------------------------------------------------------------------*/
+
+int MIDI_AllNotesOff(
+    void)
+
+{
+    if (_MIDI_Funcs == NULL)
+    {
+        return MIDI_Error;
+    }
+
+    _MIDI_NotesOff(MIDI_AllChannels);
+
+    return (MIDI_Ok);
+}
+
+/*---------------------------------------------------------------------
+   Function: _MIDI_SetChannelVolume
+
+   Sets the volume of the specified midi channel, scaled by the gain
+   of the channel and the volume of the sequence.
+---------------------------------------------------------------------*/
+
+static void _MIDI_SetChannelVolume(
+    sequence *Song,
+    int channel,
+    int volume)
+
+{
+    Song->ChannelVolume[channel] = volume;
+
+    volume = _MIDI_ScaleVolume(Song, channel, volume);
+
+    if (_MIDI_Funcs->ControlChange != NULL)
+    {
+        _MIDI_Funcs->ControlChange(channel, MIDI_VOLUME, volume);
+        _MIDI_SentVolume[channel] = volume;
+    }
+}
+
+/*---------------------------------------------------------------------
+   Function: _MIDI_SendChannelVolumes
+
+   Sets the volume on all the midi channels the sequence uses, after
+   the volume of the sequence or the music has changed.  Channels
+   whose volume comes out the same are left alone.
+---------------------------------------------------------------------*/
+
+static void _MIDI_SendChannelVolumes(
+    sequence *Song)
+
+{
+    int channel;
+    int volume;
+
+    for (channel = 0; channel < NUM_MIDI_CHANNELS; channel++)
+    {
+        if (!(Song->Music.channels & (1 << channel)))
+        {
+            continue;
+        }
+
+        volume = _MIDI_ScaleVolume(Song, channel, Song->ChannelVolume[channel]);
+        if (volume != _MIDI_SentVolume[channel])
+        {
+            _MIDI_SetChannelVolume(Song, channel, Song->ChannelVolume[channel]);
+        }
+    }
+}
+
+/*---------------------------------------------------------------------
+   Function: _MIDI_ScaleVolume
+
+   Returns the volume to send for a midi channel.  The volume from the
+   song is scaled by the gain of the channel, the volume of the
+   sequence and, when the device has no volume control of its own,
+   the music volume.
+---------------------------------------------------------------------*/
+
+static int _MIDI_ScaleVolume(
+    sequence *Song,
+    int channel,
+    int volume)
+
+{
+    volume *= Song->ChannelGain[channel];
+    volume /= MIDI_MaxVolume;
+
+    volume *= Song->volume;
+    volume /= MIDI_MaxVolume;
+
+    if (_MIDI_Funcs->SetVolume == NULL)
+    {
+        volume *= _MIDI_TotalVolume;
+        volume /= MIDI_MaxVolume;
+    }
+
+    return (volume);
+}
+
+/*---------------------------------------------------------------------
+   Function: _MIDI_ResetChannels
+
+   Resets the specified midi channels to General Midi defaults.
+---------------------------------------------------------------------*/
+
+static void _MIDI_ResetChannels(
+    sequence *Song,
+    unsigned channels)
+
+{
+    int channel;
+
+    for (channel = 0; channel < NUM_MIDI_CHANNELS; channel++)
+    {
+        if (channels & (1 << channel))
+        {
+            _MIDI_Funcs->ControlChange(channel, MIDI_RESET_ALL_CONTROLLERS, 0);
+            _MIDI_Funcs->ControlChange(channel, MIDI_RPN_MSB, MIDI_PITCHBEND_MSB);
+            _MIDI_Funcs->ControlChange(channel, MIDI_RPN_LSB, MIDI_PITCHBEND_LSB);
+            _MIDI_Funcs->ControlChange(channel, MIDI_DATAENTRY_MSB, 2); /* Pitch Bend Sensitivity MSB */
+            _MIDI_Funcs->ControlChange(channel, MIDI_DATAENTRY_LSB, 0); /* Pitch Bend Sensitivity LSB */
+            _MIDI_SetChannelVolume(Song, channel, GENMIDI_DefaultVolume);
+        }
+    }
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDI_Reset
+
+   Resets the MIDI device to General Midi defaults.
+---------------------------------------------------------------------*/
+
+void MIDI_Reset(
+    void)
+
+{
+    _MIDI_ResetChannels(&_MIDI_Sequences[MIDI_PrimarySequence], MIDI_AllChannels);
+}
+
+static int sub_247F7(sequence *Song)
+{
+    if (_MIDI_Funcs == NULL)
+    {
+        return MIDI_Error;
+    }
+    _MIDI_NotesOff(Song->Music.channels);
+    _MIDI_ResetChannels(Song, Song->Music.channels);
+
+    return MIDI_Ok;
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDI_SetVolume
+
+   Sets the total volume of the music.
+---------------------------------------------------------------------*/
+
+int MIDI_SetVolume(
+    int volume)
+
+{
+    if (_MIDI_Funcs == NULL)
+    {
+        return (MIDI_NullMidiModule);
+    }
+
+    volume = min(MIDI_MaxVolume, volume);
+    volume = max(0, volume);
+
+    DISABLE_INTERRUPTS();
+    _MIDI_MasterFade.active = FALSE;
+    _MIDI_FadeOwner = NULL;
+    _MIDI_ApplyVolume(volume);
+    ENABLE_INTERRUPTS();
+
+    return (MIDI_Ok);
+}
+
+/*---------------------------------------------------------------------
+   Function: _MIDI_ApplyVolume
+
+   Sets the total volume of the music on the music device.
+---------------------------------------------------------------------*/
+
+static void _MIDI_ApplyVolume(
+    int volume)
+
+{
+    int handle;
+
+    _MIDI_TotalVolume = volume;
+
+    if (_MIDI_Funcs->SetVolume)
+    {
+        _MIDI_Funcs->SetVolume(volume);
+    }
+    else
+    {
+        for (handle = 0; handle < MIDI_MaxSequences; handle++)
+        {
+            if (_MIDI_Sequences[handle].loaded)
+            {
+                _MIDI_SendChannelVolumes(&_MIDI_Sequences[handle]);
+            }
+        }
+    }
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDI_FadeVolume
+
+   Fades the total volume of the music to the specified level over the
+   specified time.  The fade runs in the task of a playing sequence,
+   which updates the volume at most MIDI_FadeRate times a second.
+---------------------------------------------------------------------*/
+
+int MIDI_FadeVolume(
+    int volume,
+    int milliseconds)
+
+{
+    int handle;
+    sequence *Song;
+
+    if (_MIDI_Funcs == NULL)
+    {
+        return (MIDI_NullMidiModule);
+    }
+
+    volume = min(MIDI_MaxVolume, volume);
+    volume = max(0, volume);
+
+    // Prefer the primary sequence to run the fade
+    Song = NULL;
+    for (handle = MIDI_MaxSequences - 1; handle >= 0; handle--)
+    {
+        if (_MIDI_Sequences[handle].loaded)
+        {
+            Song = &_MIDI_Sequences[handle];
+        }
+    }
+
+    // With nothing playing, there is nothing to hear fade
+    if (Song == NULL)
+    {
+        return (MIDI_SetVolume(volume));
+    }
+
+    DISABLE_INTERRUPTS();
+    _MIDI_StartFade(&_MIDI_MasterFade, _MIDI_TotalVolume, volume,
+                    milliseconds, FALSE);
+    _MIDI_FadeOwner = Song;
+    _MIDI_WakeSooner(Song, MIDI_FadeStep);
+    ENABLE_INTERRUPTS();
+
+    return (MIDI_Ok);
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDI_VolumeFading
+
+   Returns whether the total volume of the music is fading or not.
+---------------------------------------------------------------------*/
+
+int MIDI_VolumeFading(
+    void)
+
+{
+    return (_MIDI_MasterFade.active);
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDI_GetVolume
+
+   Returns the total volume of the music.
+---------------------------------------------------------------------*/
+
+int MIDI_GetVolume(
+    void)
+
+{
+    int volume;
+
+    if (_MIDI_Funcs == NULL)
+    {
+        return (MIDI_NullMidiModule);
+    }
+
+    if (_MIDI_Funcs->GetVolume)
+    {
+        volume = _MIDI_Funcs->GetVolume();
+    }
+    else
+    {
+        volume = _MIDI_TotalVolume;
+    }
+
+    return (volume);
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDI_SetLoopFlag
+
+   Sets whether the song should loop when finished or not.
+---------------------------------------------------------------------*/
+
+void MIDI_SetLoopFlag(
+    int loopflag)
+
+{
+    _MIDI_Sequences[MIDI_PrimarySequence].loop = loopflag;
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDI_ContinueSong
+
+   Continues playback of a paused song.
+---------------------------------------------------------------------*/
+
+void MIDI_ContinueSong(
+    void)
+
+{
+    sequence *Song;
+
+    Song = &_MIDI_Sequences[MIDI_PrimarySequence];
+    if ((Song->loaded) && (!Song->active))
+    {
+        // Wake the paused task on the next tick
+        DISABLE_INTERRUPTS();
+        TS_RestartTask(Song->PlayRoutine, Song->ticklength);
+        Song->active = TRUE;
+        ENABLE_INTERRUPTS();
+    }
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDI_PauseSong
+
+   Pauses playback of the current song.
+---------------------------------------------------------------------*/
+
+void MIDI_PauseSong(
+    void)
+
+{
+    sequence *Song;
+
+    Song = &_MIDI_Sequences[MIDI_PrimarySequence];
+    if (Song->loaded)
+    {
+        // Remember how far into the wait for the next event we were
+        DISABLE_INTERRUPTS();
+        Song->tick = _MIDI_CurrentTick(Song);
+        Song->sleepticks = 0;
+        Song->active = FALSE;
+        ENABLE_INTERRUPTS();
+
+        _MIDI_NotesOff(Song->Music.channels);
+    }
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDI_SongPlaying
+
+   Returns whether a song is playing or not.
+---------------------------------------------------------------------*/
+
+int MIDI_SongPlaying(
+    void)
+
+{
+    return (_MIDI_Sequences[MIDI_PrimarySequence].active);
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDI_SetMidiFuncs
+
+   Selects the routines that send the MIDI data to the music device.
+---------------------------------------------------------------------*/
+
+int MIDI_SetMidiFuncs(
+    midifuncs *funcs)
+
+{
+    int handle;
+    int channel;
+
+    _MIDI_Funcs = funcs;
+
+    for (handle = 0; handle < NUM_MIDI_CHANNELS; handle++)
+    {
+        _MIDI_SentVolume[handle] = MIDI_NoVolume;
+    }
+
+    // Sequences start at full volume with all channels playing
+    for (handle = 0; handle < MIDI_MaxSequences; handle++)
+    {
+        if (!_MIDI_Sequences[handle].loaded)
+        {
+            _MIDI_Sequences[handle].volume = MIDI_MaxVolume;
+            _MIDI_Sequences[handle].muted = 0;
+            _MIDI_Sequences[handle].solo = 0;
+            for (channel = 0; channel < NUM_MIDI_CHANNELS; channel++)
+            {
+                _MIDI_Sequences[handle].ChannelGain[channel] = MIDI_MaxVolume;
+            }
+        }
+    }
+
+    return MIDI_Ok;
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDI_ReplaceMidiFuncs
+
+   Switches the routines that send the MIDI data, without resetting
+   the volumes and channel settings of the sequences.  Used to pass
+   the data through another set of routines while songs play.
+   Returns the routines used until now.
+---------------------------------------------------------------------*/
+
+midifuncs *MIDI_ReplaceMidiFuncs(
+    midifuncs *funcs)
+
+{
+    midifuncs *previous;
+
+    DISABLE_INTERRUPTS();
+    previous = _MIDI_Funcs;
+    _MIDI_Funcs = funcs;
+    ENABLE_INTERRUPTS();
+
+    return (previous);
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDI_GetEventTime
+
+   Returns the time of the MIDI data being sent.  Called from the
+   MIDI routines, it tells which sequence sent the data and on which
+   tick of its song.  Data sent by calls from the game has no
+   sequence.  The clock counts the timer counts the sequencer has
+   played.  It is shared by all sequences and never runs backwards,
+   even when a song is paused or moved to another tick.
+---------------------------------------------------------------------*/
+
+void MIDI_GetEventTime(
+    miditime *time)
+
+{
+    DISABLE_INTERRUPTS();
+    time->clock = _MIDI_Clock;
+    time->sequence = MIDI_NoSequence;
+    time->tick = 0;
+    if (_MIDI_ServicedSong != NULL)
+    {
+        time->sequence = _MIDI_ServicedSong - _MIDI_Sequences;
+        time->tick = _MIDI_ServicedSong->tick;
+    }
+    ENABLE_INTERRUPTS();
+}
+
+/*---------------------------------------------------------------------
+   Function: _MIDI_GetSequence
+
+   Returns the sequence with the specified handle.
+---------------------------------------------------------------------*/
+
+static sequence *_MIDI_GetSequence(
+    int handle)
+
+{
+    if ((handle < 0) || (handle >= MIDI_MaxSequences))
+    {
+        return (NULL);
+    }
+
+    return (&_MIDI_Sequences[handle]);
+}
+
+/*---------------------------------------------------------------------
+   Function: _MIDI_GetPreparedSong
+
+   Returns the prepared song with the specified handle, or NULL if
+   there is none.
+---------------------------------------------------------------------*/
+
+static midisong *_MIDI_GetPreparedSong(
+    int handle)
+
+{
+    if ((handle < 0) || (handle >= MIDI_MaxPreparedSongs) ||
+        (!_MIDI_PreparedSongs[handle].loaded))
+    {
+        return (NULL);
+    }
+
+    return (&_MIDI_PreparedSongs[handle]);
+}
+
+/*---------------------------------------------------------------------
+   Function: _MIDI_FreeSong
+
+   Releases the memory used by a compiled song.
+---------------------------------------------------------------------*/
+
+static void _MIDI_FreeSong(
+    midisong *Music)
+
+{
+    farfree(Music->Events);
+    Music->Events = NULL;
+    farfree(Music->Checkpoints);
+    Music->Checkpoints = NULL;
+    farfree(Music->TempoMap);
+    Music->TempoMap = NULL;
+    Music->loaded = FALSE;
+}
+
+/*---------------------------------------------------------------------
+   Function: _MIDI_FreeSequence
+
+   Releases the compiled song of a sequence.  A prepared song is only
+   let go of, since it belongs to its handle.
+---------------------------------------------------------------------*/
+
+static void _MIDI_FreeSequence(
+    sequence *Song)
+
+{
+    if (Song->Prepared == NULL)
+    {
+        _MIDI_FreeSong(&Song->Music);
+    }
+
+    if (Song->Transition.Retired.loaded)
+    {
+        _MIDI_FreeSong(&Song->Transition.Retired);
+    }
+
+    Song->Prepared = NULL;
+    Song->Music.loaded = FALSE;
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDI_StopSequence
+
+   Stops playback of the song in the specified sequence.
+---------------------------------------------------------------------*/
+
+int MIDI_StopSequence(
+    int handle)
+
+{
+    sequence *Song;
+    int other;
+
+    Song = _MIDI_GetSequence(handle);
+    if (Song == NULL)
+    {
+        return (MIDI_InvalidSequence);
+    }
+
+    if (Song->loaded)
+    {
+        // A song being rendered has no task
+        if (Song->PlayRoutine != NULL)
+        {
+            TS_Terminate(Song->PlayRoutine);
+            Song->PlayRoutine = NULL;
+        }
+
+        DISABLE_INTERRUPTS();
+        Song->active = FALSE;
+        Song->loaded = FALSE;
+        Song->fade.active = FALSE;
+        Song->fade.stop = FALSE;
+        Song->Transition.active = FALSE;
+
+        // Hand the fade of the music volume to another sequence
+        if (_MIDI_FadeOwner == Song)
+        {
+            _MIDI_FadeOwner = NULL;
+            for (other = 0; other < MIDI_MaxSequences; other++)
+            {
+                if (_MIDI_Sequences[other].loaded)
+                {
+                    _MIDI_FadeOwner = &_MIDI_Sequences[other];
+                    break;
+                }
+            }
+
+            if (_MIDI_FadeOwner == NULL)
+            {
+                _MIDI_MasterFade.active = FALSE;
+                _MIDI_ApplyVolume(_MIDI_MasterFade.target);
+            }
+        }
+        ENABLE_INTERRUPTS();
+
+        sub_247F7(Song);
+
+        // Patches are shared by all the sequences
+        for (other = 0; other < MIDI_MaxSequences; other++)
+        {
+            if (_MIDI_Sequences[other].loaded)
+            {
+                break;
+            }
+        }
+
+        if ((other == MIDI_MaxSequences) && (_MIDI_Funcs->ReleasePatches))
+        {
+            _MIDI_Funcs->ReleasePatches();
+        }
+
+        _MIDI_FreeSequence(Song);
+    }
+
+    return (MIDI_Ok);
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDI_StopSong
+
+   Stops playback of the currently playing song.
+---------------------------------------------------------------------*/
+
+void MIDI_StopSong(
+    void)
+
+{
+    MIDI_StopSequence(MIDI_PrimarySequence);
+}
+
+/*---------------------------------------------------------------------
+   Function: _MIDI_CompileSMF
+
+   Compiles a Standard MIDI File.
+---------------------------------------------------------------------*/
+
+static int _MIDI_CompileSMF(
+    midisong *Music,
+    unsigned char *song)
+
+{
+    int numtracks;
+    int format;
+    int status;
+    long headersize;
+    long tracklength;
+    track *tracks;
+    track *CurrentTrack;
+    unsigned char *ptr;
+
+    song += 4;
+
+    headersize = _MIDI_ReadNumber(song, 4);
+    song += 4;
+    format = _MIDI_ReadNumber(song, 2);
+    numtracks = _MIDI_ReadNumber(song + 2, 2);
+    Music->division = _MIDI_ReadNumber(song + 4, 2);
+
+    if (format > MAX_FORMAT)
+    {
+        return (MIDI_UnknownMidiFormat);
+    }
+
+    ptr = song + headersize;
+    if (numtracks == 0)
+    {
+        return (MIDI_NoTracks);
+    }
+
+    tracks = malloc(numtracks * sizeof(track));
+    if (tracks == NULL)
+    {
+        return (MIDI_NoMemory);
+    }
+
+    CurrentTrack = tracks;
+    while (numtracks--)
+    {
+        if (*(unsigned long *)ptr != MIDI_TRACK_SIGNATURE)
+        {
+            farfree(tracks);
+            return (MIDI_InvalidTrack);
+        }
+
+        tracklength = _MIDI_ReadNumber(ptr + 4, 4);
+        ptr += 8;
+        CurrentTrack->start = ptr;
+        ptr += tracklength;
+        CurrentTrack->end = ptr;
+        CurrentTrack++;
+    }
+
+    status = _MIDI_CompileSong(Music, tracks, CurrentTrack - tracks, format);
+    farfree(tracks);
+
+    return (status);
+}
+
+/*---------------------------------------------------------------------
+   Function: _MIDI_PrepareSong
+
+   Compiles a song into a list of events that is ready to play.  The
+   song can be a Standard MIDI File, an id MUS file or an XMIDI file.
+   It must stay in memory while the compiled song is used, since text
+   and system exclusive events are read from it.
+---------------------------------------------------------------------*/
+
+static int _MIDI_PrepareSong(
+    midisong *Music,
+    unsigned char *song)
+
+{
+    int status;
+
+    Music->data = song;
+    Music->Events = NULL;
+    Music->TempoMap = NULL;
+    Music->Checkpoints = NULL;
+
+    // Convert the song into a list of events before it plays, so that
+    // the service routine only has to send the events that are due.
+    switch (*(unsigned long *)song)
+    {
+    case MIDI_HEADER_SIGNATURE:
+        status = _MIDI_CompileSMF(Music, song);
+        break;
+
+    case MUS_HEADER_SIGNATURE:
+        status = _MIDI_CompileMUS(Music, song);
+        break;
+
+    case XMI_FORM_SIGNATURE:
+        status = _MIDI_CompileXMI(Music, song);
+        break;
+
+    default:
+        return (MIDI_InvalidMidiFile);
+    }
+
+    _MIDI_ThinnedEvents = 0;
+    if ((status == MIDI_Ok) && (_MIDI_ThinResolution != MIDI_NoThinning))
+    {
+        status = _MIDI_ThinEvents(Music);
+    }
+
+    if (status == MIDI_Ok)
+    {
+        status = _MIDI_BuildTempoMap(Music);
+    }
+
+    if (status == MIDI_Ok)
+    {
+        status = _MIDI_BuildCheckpoints(Music);
+    }
+
+    if (status != MIDI_Ok)
+    {
+        _MIDI_FreeSong(Music);
+        return (status);
+    }
+
+    _MIDI_FindLoop(Music);
+    _MIDI_FindTimbres(Music);
+    Music->loaded = TRUE;
+
+    return (MIDI_Ok);
+}
+
+/*---------------------------------------------------------------------
+   Function: _MIDI_StartSequence
+
+   Starts playing the compiled song of a sequence from the top.
+---------------------------------------------------------------------*/
+
+static int _MIDI_StartSequence(
+    sequence *Song,
+    int loopflag)
+
+{
+    _MIDI_InitSequence(Song, loopflag);
+
+    Song->PlayRoutine = TS_ScheduleTask(_MIDI_ServiceRoutine, Song->Music.division * 120 / 60, 1, Song);
+    TS_SetTaskInterval(Song->PlayRoutine, Song->ticklength);
+    TS_Dispatch();
+
+    Song->active = TRUE;
+    Song->loaded = TRUE;
+
+    return (MIDI_Ok);
+}
+
+/*---------------------------------------------------------------------
+   Function: _MIDI_InitSequence
+
+   Resets the device and the position of a sequence for its song to
+   start from the top.
+---------------------------------------------------------------------*/
+
+static void _MIDI_InitSequence(
+    sequence *Song,
+    int loopflag)
+
+{
+    Song->eventindex = 0;
+    Song->tick = 0;
+    Song->sleepticks = 0;
+    Song->clock = _MIDI_Clock;
+    Song->fade.active = FALSE;
+    Song->fade.stop = FALSE;
+
+    if (_MIDI_Funcs->GetVolume != NULL)
+    {
+        _MIDI_TotalVolume = _MIDI_Funcs->GetVolume();
+    }
+
+    if (_MIDI_Funcs->LoadPatch)
+    {
+        _MIDI_LoadTimbres(&Song->Music);
+    }
+    sub_247F7(Song);
+
+    Song->loop = loopflag;
+    _MIDI_SetTempo(Song, MIDI_DefaultTempo);
+    Song->timefraction = 0;
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDI_PlaySequence
+
+   Begins playback of a MIDI song in the specified sequence.  Any song
+   already playing in the sequence is stopped.
+---------------------------------------------------------------------*/
+
+int MIDI_PlaySequence(
+    int handle,
+    unsigned char *song,
+    int loopflag)
+
+{
+    int status;
+    sequence *Song;
+
+    Song = _MIDI_GetSequence(handle);
+    if (Song == NULL)
+    {
+        return (MIDI_InvalidSequence);
+    }
+
+    if (Song->loaded)
+    {
+        MIDI_StopSequence(handle);
+    }
+
+    if (_MIDI_Funcs == NULL)
+    {
+        return (MIDI_NullMidiModule);
+    }
+
+    status = _MIDI_PrepareSong(&Song->Music, song);
+    if (status != MIDI_Ok)
+    {
+        return (status);
+    }
+
+    Song->Prepared = NULL;
+
+    return (_MIDI_StartSequence(Song, loopflag));
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDI_PrepareSong
+
+   Compiles a MIDI song ahead of time so that it can be started later
+   without delay.  Returns a handle for the song, or an error code
+   below zero.  The song must stay in memory until the handle is freed.
+---------------------------------------------------------------------*/
+
+int MIDI_PrepareSong(
+    unsigned char *song)
+
+{
+    int handle;
+    int status;
+
+    for (handle = 0; handle < MIDI_MaxPreparedSongs; handle++)
+    {
+        if (!_MIDI_PreparedSongs[handle].loaded)
+        {
+            break;
+        }
+    }
+
+    if (handle == MIDI_MaxPreparedSongs)
+    {
+        return (MIDI_NoFreeSong);
+    }
+
+    status = _MIDI_PrepareSong(&_MIDI_PreparedSongs[handle], song);
+    if (status != MIDI_Ok)
+    {
+        return (status);
+    }
+
+    return (handle);
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDI_FreePreparedSong
+
+   Releases a prepared song.  Sequences playing it are stopped.
+---------------------------------------------------------------------*/
+
+int MIDI_FreePreparedSong(
+    int handle)
+
+{
+    int other;
+    midisong *Music;
+
+    Music = _MIDI_GetPreparedSong(handle);
+    if (Music == NULL)
+    {
+        return (MIDI_InvalidSong);
+    }
+
+    for (other = 0; other < MIDI_MaxSequences; other++)
+    {
+        if ((_MIDI_Sequences[other].loaded) &&
+            (_MIDI_Sequences[other].Prepared == Music))
+        {
+            MIDI_StopSequence(other);
+        }
+
+        if (_MIDI_Sequences[other].Transition.Music == Music)
+        {
+            MIDI_CancelTransition(other);
+        }
+    }
+
+    _MIDI_FreeSong(Music);
+
+    return (MIDI_Ok);
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDI_PlayPrepared
+
+   Begins playback of a prepared song in the specified sequence.  The
+   song is already compiled, so it starts without parsing the file.
+---------------------------------------------------------------------*/
+
+int MIDI_PlayPrepared(
+    int handle,
+    int prepared,
+    int loopflag)
+
+{
+    sequence *Song;
+    midisong *Music;
+
+    Song = _MIDI_GetSequence(handle);
+    if (Song == NULL)
+    {
+        return (MIDI_InvalidSequence);
+    }
+
+    Music = _MIDI_GetPreparedSong(prepared);
+    if (Music == NULL)
+    {
+        return (MIDI_InvalidSong);
+    }
+
+    if (Song->loaded)
+    {
+        MIDI_StopSequence(handle);
+    }
+
+    if (_MIDI_Funcs == NULL)
+    {
+        return (MIDI_NullMidiModule);
+    }
+
+    Song->Music = *Music;
+    Song->Prepared = Music;
+
+    return (_MIDI_StartSequence(Song, loopflag));
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDI_RenderSong
+
+   Plays a prepared song through a software synthesizer as fast as
+   possible, and stores the specified number of samples it produces in
+   the buffer.  The song plays in the specified sequence, with the
+   sequence's volume and channel settings.  The music device is not
+   used, so no other sequence may be playing.  A song that ends before
+   the buffer is full is followed by the sound the synthesizer still
+   makes.
+---------------------------------------------------------------------*/
+
+int MIDI_RenderSong(
+    int handle,
+    int prepared,
+    midisynth *synth,
+    char huge *buffer,
+    unsigned long samples,
+    int loopflag)
+
+{
+    int other;
+    int channel;
+    int sentvolume[NUM_MIDI_CHANNELS];
+    int totalvolume;
+    unsigned count;
+    unsigned long frames;
+    unsigned long interval;
+    unsigned long remainder;
+    midifuncs *device;
+    sequence *Song;
+    midisong *Music;
+
+    Song = _MIDI_GetSequence(handle);
+    if (Song == NULL)
+    {
+        return (MIDI_InvalidSequence);
+    }
+
+    Music = _MIDI_GetPreparedSong(prepared);
+    if (Music == NULL)
+    {
+        return (MIDI_InvalidSong);
+    }
+
+    if ((synth == NULL) || (synth->Funcs == NULL) || (synth->Render == NULL))
+    {
+        return (MIDI_NullMidiModule);
+    }
+
+    for (other = 0; other < MIDI_MaxSequences; other++)
+    {
+        if (_MIDI_Sequences[other].loaded)
+        {
+            return (MIDI_MusicPlaying);
+        }
+    }
+
+    // Send the song to the synthesizer instead of the device, starting
+    // with nothing sent to it yet.
+    device = _MIDI_Funcs;
+    totalvolume = _MIDI_TotalVolume;
+    for (channel = 0; channel < NUM_MIDI_CHANNELS; channel++)
+    {
+        sentvolume[channel] = _MIDI_SentVolume[channel];
+        _MIDI_SentVolume[channel] = MIDI_NoVolume;
+    }
+
+    _MIDI_Funcs = synth->Funcs;
+    _MIDI_TotalVolume = MIDI_MaxVolume;
+
+    Song->Music = *Music;
+    Song->Prepared = Music;
+    Song->PlayRoutine = NULL;
+    _MIDI_InitSequence(Song, loopflag);
+    Song->active = TRUE;
+    Song->loaded = TRUE;
+
+    // Play the events that are due, then let the synthesizer fill the
+    // time until the next ones.  The fraction of a sample left over is
+    // carried to the next wait so that the song doesn't drift.
+    interval = 0;
+    remainder = 0;
+    while (samples > 0)
+    {
+        interval = _MIDI_ServiceSequence(Song, interval);
+        frames = _MIDI_MulDiv(interval, synth->samplerate, remainder,
+                              MIDI_TimerRate, &remainder);
+        frames = min(frames, samples);
+        samples -= frames;
+
+        while (frames > 0)
+        {
+            count = min(frames, (unsigned long)MIDI_RenderChunk);
+            synth->Render(buffer, count);
+            buffer += (unsigned long)count * synth->samplesize;
+            frames -= count;
+        }
+    }
+
+    MIDI_StopSequence(handle);
+
+    _MIDI_Funcs = device;
+    _MIDI_TotalVolume = totalvolume;
+    for (channel = 0; channel < NUM_MIDI_CHANNELS; channel++)
+    {
+        _MIDI_SentVolume[channel] = sentvolume[channel];
+    }
+
+    return (MIDI_Ok);
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDI_PlaySong
+
+   Begins playback of a MIDI song.
+---------------------------------------------------------------------*/
+
+int MIDI_PlaySong(
+    unsigned char *song,
+    int loopflag)
+
+{
+    return (MIDI_PlaySequence(MIDI_PrimarySequence, song, loopflag));
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDI_SequencePlaying
+
+   Returns whether the specified sequence is playing or not.
+---------------------------------------------------------------------*/
+
+int MIDI_SequencePlaying(
+    int handle)
+
+{
+    sequence *Song;
+
+    Song = _MIDI_GetSequence(handle);
+    if (Song == NULL)
+    {
+        return (FALSE);
+    }
+
+    return (Song->active);
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDI_SetSequenceVolume
+
+   Sets the volume of the specified sequence.  Any fade in progress
+   on the sequence is cancelled.
+---------------------------------------------------------------------*/
+
+int MIDI_SetSequenceVolume(
+    int handle,
+    int volume)
+
+{
+    sequence *Song;
+
+    Song = _MIDI_GetSequence(handle);
+    if (Song == NULL)
+    {
+        return (MIDI_InvalidSequence);
+    }
+
+    volume = min(MIDI_MaxVolume, volume);
+    volume = max(0, volume);
+
+    DISABLE_INTERRUPTS();
+    Song->fade.active = FALSE;
+    Song->volume = volume;
+    if ((Song->loaded) && (_MIDI_Funcs != NULL))
+    {
+        _MIDI_SendChannelVolumes(Song);
+    }
+    ENABLE_INTERRUPTS();
+
+    return (MIDI_Ok);
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDI_GetSequenceVolume
+
+   Returns the volume of the specified sequence.
+---------------------------------------------------------------------*/
+
+int MIDI_GetSequenceVolume(
+    int handle)
+
+{
+    sequence *Song;
+
+    Song = _MIDI_GetSequence(handle);
+    if (Song == NULL)
+    {
+        return (MIDI_InvalidSequence);
+    }
+
+    return (Song->volume);
+}
+
+/*---------------------------------------------------------------------
+   Function: _MIDI_SetSilence
+
+   Changes which channels of a sequence are muted and soloed.  Notes
+   still playing on channels that fall silent are stopped.
+---------------------------------------------------------------------*/
+
+static void _MIDI_SetSilence(
+    sequence *Song,
+    unsigned muted,
+    unsigned solo)
+
+{
+    unsigned silent;
+
+    DISABLE_INTERRUPTS();
+
+    silent = ~MIDI_SilentChannels(Song);
+    Song->muted = muted;
+    Song->solo = solo;
+    silent &= MIDI_SilentChannels(Song) & Song->Music.channels;
+
+    if ((silent) && (Song->loaded) && (_MIDI_Funcs != NULL))
+    {
+        _MIDI_NotesOff(silent);
+    }
+
+    ENABLE_INTERRUPTS();
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDI_SetChannelMute
+
+   Mutes or unmutes a midi channel of the specified sequence.  A muted
+   channel starts no new notes, but otherwise keeps playing, so that it
+   can be brought back in at any time.
+---------------------------------------------------------------------*/
+
+int MIDI_SetChannelMute(
+    int handle,
+    int channel,
+    int mute)
+
+{
+    sequence *Song;
+    unsigned muted;
+
+    Song = _MIDI_GetSequence(handle);
+    if (Song == NULL)
+    {
+        return (MIDI_InvalidSequence);
+    }
+
+    if ((channel < 0) || (channel >= NUM_MIDI_CHANNELS))
+    {
+        return (MIDI_InvalidChannel);
+    }
+
+    muted = Song->muted & ~(1 << channel);
+    if (mute)
+    {
+        muted |= 1 << channel;
+    }
+
+    _MIDI_SetSilence(Song, muted, Song->solo);
+
+    return (MIDI_Ok);
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDI_SetChannelSolo
+
+   Adds a midi channel of the specified sequence to its soloed channels
+   or removes it.  While any channel is soloed, the channels that
+   aren't start no new notes.
+---------------------------------------------------------------------*/
+
+int MIDI_SetChannelSolo(
+    int handle,
+    int channel,
+    int solo)
+
+{
+    sequence *Song;
+    unsigned soloed;
+
+    Song = _MIDI_GetSequence(handle);
+    if (Song == NULL)
+    {
+        return (MIDI_InvalidSequence);
+    }
+
+    if ((channel < 0) || (channel >= NUM_MIDI_CHANNELS))
+    {
+        return (MIDI_InvalidChannel);
+    }
+
+    soloed = Song->solo & ~(1 << channel);
+    if (solo)
+    {
+        soloed |= 1 << channel;
+    }
+
+    _MIDI_SetSilence(Song, Song->muted, soloed);
+
+    return (MIDI_Ok);
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDI_SetChannelGain
+
+   Scales the volume of a midi channel of the specified sequence.  A
+   gain of MIDI_MaxVolume plays the channel at the volume in the song.
+---------------------------------------------------------------------*/
+
+int MIDI_SetChannelGain(
+    int handle,
+    int channel,
+    int gain)
+
+{
+    sequence *Song;
+
+    Song = _MIDI_GetSequence(handle);
+    if (Song == NULL)
+    {
+        return (MIDI_InvalidSequence);
+    }
+
+    if ((channel < 0) || (channel >= NUM_MIDI_CHANNELS))
+    {
+        return (MIDI_InvalidChannel);
+    }
+
+    gain = min(MIDI_MaxVolume, gain);
+    gain = max(0, gain);
+
+    DISABLE_INTERRUPTS();
+    Song->ChannelGain[channel] = gain;
+    if ((Song->loaded) && (_MIDI_Funcs != NULL))
+    {
+        _MIDI_SendChannelVolumes(Song);
+    }
+    ENABLE_INTERRUPTS();
+
+    return (MIDI_Ok);
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDI_GetChannelGain
+
+   Returns the gain of a midi channel of the specified sequence.
+---------------------------------------------------------------------*/
+
+int MIDI_GetChannelGain(
+    int handle,
+    int channel)
+
+{
+    sequence *Song;
+
+    Song = _MIDI_GetSequence(handle);
+    if ((Song == NULL) || (channel < 0) || (channel >= NUM_MIDI_CHANNELS))
+    {
+        return (0);
+    }
+
+    return (Song->ChannelGain[channel]);
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDI_SetTempoScale
+
+   Plays all songs faster or slower than their tempo, in percent of
+   it.  The tempo events in the songs still apply on top of the scale.
+   Playing songs change speed from their next tick.
+---------------------------------------------------------------------*/
+
+void MIDI_SetTempoScale(
+    int percent)
+
+{
+    int handle;
+    sequence *Song;
+
+    percent = min(MIDI_MaxTempoScale, percent);
+    percent = max(MIDI_MinTempoScale, percent);
+
+    DISABLE_INTERRUPTS();
+
+    _MIDI_TempoScale = percent;
+
+    for (handle = 0; handle < MIDI_MaxSequences; handle++)
+    {
+        Song = &_MIDI_Sequences[handle];
+        if (Song->loaded)
+        {
+            // End the current wait at the old tempo
+            if (Song->active)
+            {
+                _MIDI_WakeSooner(Song, 0);
+            }
+
+            _MIDI_SetTempo(Song, Song->tempo);
+        }
+    }
+
+    ENABLE_INTERRUPTS();
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDI_GetTempoScale
+
+   Returns the tempo scale in percent.
+---------------------------------------------------------------------*/
+
+int MIDI_GetTempoScale(
+    void)
+
+{
+    return (_MIDI_TempoScale);
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDI_SetTranspose
+
+   Transposes all songs by the specified number of semitones.  Notes
+   that are already playing keep their pitch, and the rhythm channel
+   is left alone.
+---------------------------------------------------------------------*/
+
+void MIDI_SetTranspose(
+    int semitones)
+
+{
+    semitones = min(MIDI_MaxTranspose, semitones);
+    semitones = max(-MIDI_MaxTranspose, semitones);
+
+    _MIDI_Transpose = semitones;
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDI_GetTranspose
+
+   Returns the transposition in semitones.
+---------------------------------------------------------------------*/
+
+int MIDI_GetTranspose(
+    void)
+
+{
+    return (_MIDI_Transpose);
+}
+
+/*---------------------------------------------------------------------
+   Function: _MIDI_NextBoundary
+
+   Returns the first tick after the specified one at which a song
+   reaches the next beat, bar or marker.  A time signature starts a
+   new bar and beat wherever it falls.  Songs without another boundary
+   end at their last tick.
+---------------------------------------------------------------------*/
+
+static unsigned long _MIDI_NextBoundary(
+    midisong *Music,
+    unsigned long tick,
+    int boundary)
+
+{
+    midistate state;
+    unsigned long next;
+    unsigned long end;
+    long index;
+    midievent huge *Event;
+
+    end = Music->Events[Music->numevents].time;
+    _MIDI_GetState(Music, &state, tick);
+
+    switch (boundary)
+    {
+    case MIDI_AtBeat:
+        next = tick + state.ticksperbeat - state.beattick;
+        break;
+
+    case MIDI_AtBar:
+        next = tick + state.ticksperbeat - state.beattick +
+               (unsigned long)(state.beatspermeasure - state.beat) * state.ticksperbeat;
+        break;
+
+    default:
+        next = end;
+        break;
+    }
+
+    for (index = state.event; index < Music->numevents; index++)
+    {
+        Event = &Music->Events[index];
+        if (Event->time >= next)
+        {
+            break;
+        }
+
+        if ((Event->time <= tick) || (Event->status != MIDI_META_EVENT))
+        {
+            continue;
+        }
+
+        if (((boundary == MIDI_AtMarker) && (Event->data1 == MIDI_MARKER)) ||
+            ((boundary != MIDI_AtMarker) && (Event->data1 == MIDI_TIME_SIGNATURE)))
+        {
+            next = Event->time;
+            break;
+        }
+    }
+
+    return (min(next, end));
+}
+
+/*---------------------------------------------------------------------
+   Function: _MIDI_Transition
+
+   Replaces the song of a sequence with the song waiting for it.  The
+   notes of the old song are stopped and the channel settings at the
+   start of the new one are sent, then it plays on from this tick.
+   Called from the service routine.
+---------------------------------------------------------------------*/
+
+static void _MIDI_Transition(
+    sequence *Song)
+
+{
+    miditransition *Transition;
+
+    Transition = &Song->Transition;
+    Transition->active = FALSE;
+
+    _MIDI_NotesOff(Song->Music.channels);
+
+    if (Song->Prepared == NULL)
+    {
+        Transition->Retired = Song->Music;
+    }
+
+    Song->Music = *Transition->Music;
+    Song->Prepared = Transition->Music;
+    Song->loop = Transition->loop;
+
+    _MIDI_SendState(Song, NULL, &Transition->Start);
+    _MIDI_SetTempo(Song, Transition->Start.tempo);
+    Song->eventindex = Transition->Start.event;
+    Song->tick = Transition->Start.tick;
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDI_QueueTransition
+
+   Replaces the song playing in the specified sequence with a prepared
+   song when the playing song reaches its next beat, bar or marker.
+   The new song starts from the specified tick.  The switch takes
+   place in the timer interrupt, on the tick of the boundary.  A
+   looping song that reaches its loop end first switches there.
+---------------------------------------------------------------------*/
+
+int MIDI_QueueTransition(
+    int handle,
+    int prepared,
+    int boundary,
+    unsigned long starttick,
+    int loopflag)
+
+{
+    sequence *Song;
+    midisong *Music;
+    unsigned long tick;
+    unsigned long next;
+
+    Song = _MIDI_GetSequence(handle);
+    if (Song == NULL)
+    {
+        return (MIDI_InvalidSequence);
+    }
+
+    Music = _MIDI_GetPreparedSong(prepared);
+    if (Music == NULL)
+    {
+        return (MIDI_InvalidSong);
+    }
+
+    if (!Song->loaded)
+    {
+        return (MIDI_NoSong);
+    }
+
+    MIDI_CancelTransition(handle);
+
+    // The song replaced by the last transition is no longer used
+    if (Song->Transition.Retired.loaded)
+    {
+        _MIDI_FreeSong(&Song->Transition.Retired);
+    }
+
+    if (_MIDI_Funcs->LoadPatch)
+    {
+        _MIDI_LoadTimbres(Music);
+    }
+
+    starttick = min(starttick, Music->Events[Music->numevents].time);
+    _MIDI_GetState(Music, &Song->Transition.Start, starttick);
+    Song->Transition.Music = Music;
+    Song->Transition.loop = loopflag;
+
+    DISABLE_INTERRUPTS();
+    tick = _MIDI_CurrentTick(Song);
+    ENABLE_INTERRUPTS();
+
+    next = _MIDI_NextBoundary(&Song->Music, tick, boundary);
+
+    DISABLE_INTERRUPTS();
+    Song->Transition.tick = next;
+    Song->Transition.active = TRUE;
+
+    // Wake up on the tick of the boundary
+    tick = _MIDI_CurrentTick(Song);
+    if ((Song->active) && (next > tick))
+    {
+        _MIDI_WakeSooner(Song, (next - tick) * Song->ticklength);
+    }
+    ENABLE_INTERRUPTS();
+
+    return (MIDI_Ok);
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDI_CancelTransition
+
+   Cancels the transition waiting in the specified sequence.
+---------------------------------------------------------------------*/
+
+int MIDI_CancelTransition(
+    int handle)
+
+{
+    sequence *Song;
+
+    Song = _MIDI_GetSequence(handle);
+    if (Song == NULL)
+    {
+        return (MIDI_InvalidSequence);
+    }
+
+    DISABLE_INTERRUPTS();
+    Song->Transition.active = FALSE;
+    ENABLE_INTERRUPTS();
+
+    return (MIDI_Ok);
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDI_TransitionPending
+
+   Returns whether the specified sequence is waiting to switch songs.
+---------------------------------------------------------------------*/
+
+int MIDI_TransitionPending(
+    int handle)
+
+{
+    sequence *Song;
+
+    Song = _MIDI_GetSequence(handle);
+    if (Song == NULL)
+    {
+        return (FALSE);
+    }
+
+    return (Song->Transition.active);
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDI_SetThinning
+
+   Sets how finely controller and pitch bend ramps are kept in the
+   songs compiled from now on, in events per beat.  MIDI_NoThinning
+   keeps every event.  A resolution finer than the division of a song
+   only removes the events that repeat a value.
+---------------------------------------------------------------------*/
+
+void MIDI_SetThinning(
+    int resolution)
+
+{
+    _MIDI_ThinResolution = max(MIDI_NoThinning, resolution);
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDI_GetThinnedEvents
+
+   Returns the number of events removed from the last song compiled.
+---------------------------------------------------------------------*/
+
+long MIDI_GetThinnedEvents(
+    void)
+
+{
+    return (_MIDI_ThinnedEvents);
+}
+
+/*---------------------------------------------------------------------
+   Function: _MIDI_QueueMeta
+
+   Saves a text meta event for MIDI_ServiceMetaEvents to hand to the
+   game.  Events are dropped when no one is listening or the queue is
+   full.  Called from the service routine.
+---------------------------------------------------------------------*/
+
+static void _MIDI_QueueMeta(
+    sequence *Song,
+    midievent huge *Event)
+
+{
+    int next;
+    songmeta *Meta;
+
+    if (_MIDI_MetaCallBack == NULL)
+    {
+        return;
+    }
+
+    next = (_MIDI_MetaTail + 1) & (MIDI_MetaQueueSize - 1);
+    if (next == _MIDI_MetaHead)
+    {
+        return;
+    }
+
+    Meta = &_MIDI_MetaQueue[_MIDI_MetaTail];
+    Meta->sequence = Song - _MIDI_Sequences;
+    Meta->type = Event->data1;
+    Meta->tick = Event->time;
+    Meta->milliseconds = _MIDI_TickToTime(&Song->Music, Event->time);
+    Meta->text = Song->Music.data + Event->param;
+    Meta->length = Event->data2;
+
+    _MIDI_MetaTail = next;
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDI_SetMetaCallBack
+
+   Sets the function that receives the marker, cue point, lyric and
+   text events of the playing songs.  The function is only called from
+   MIDI_ServiceMetaEvents, never from the timer interrupt.  Events
+   already waiting are discarded.
+---------------------------------------------------------------------*/
+
+void MIDI_SetMetaCallBack(
+    void (*function)(songmeta *event))
+
+{
+    DISABLE_INTERRUPTS();
+    _MIDI_MetaCallBack = function;
+    _MIDI_MetaHead = _MIDI_MetaTail;
+    ENABLE_INTERRUPTS();
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDI_ServiceMetaEvents
+
+   Hands the meta events the songs have reached since the last call to
+   the meta callback, oldest first.  Call it regularly from the game
+   loop.  Returns the number of events delivered.
+---------------------------------------------------------------------*/
+
+int MIDI_ServiceMetaEvents(
+    void)
+
+{
+    int count;
+    songmeta Meta;
+
+    count = 0;
+    while ((_MIDI_MetaCallBack != NULL) && (_MIDI_MetaHead != _MIDI_MetaTail))
+    {
+        Meta = _MIDI_MetaQueue[_MIDI_MetaHead];
+        _MIDI_MetaHead = (_MIDI_MetaHead + 1) & (MIDI_MetaQueueSize - 1);
+
+        _MIDI_MetaCallBack(&Meta);
+        count++;
+    }
+
+    return (count);
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDI_FadeSequence
+
+   Fades the volume of the specified sequence to the specified level
+   over the specified time.  The fade runs in the sequence's task.  If
+   stopflag is TRUE, the sequence stops playing when the fade ends.
+---------------------------------------------------------------------*/
+
+int MIDI_FadeSequence(
+    int handle,
+    int volume,
+    int milliseconds,
+    int stopflag)
+
+{
+    sequence *Song;
+
+    Song = _MIDI_GetSequence(handle);
+    if (Song == NULL)
+    {
+        return (MIDI_InvalidSequence);
+    }
+
+    if (!Song->loaded)
+    {
+        return (MIDI_NoSong);
+    }
+
+    volume = min(MIDI_MaxVolume, volume);
+    volume = max(0, volume);
+
+    DISABLE_INTERRUPTS();
+    _MIDI_StartFade(&Song->fade, Song->volume, volume, milliseconds, stopflag);
+
+    // Don't wait for the next event to start the fade
+    _MIDI_WakeSooner(Song, MIDI_FadeStep);
+    ENABLE_INTERRUPTS();
+
+    return (MIDI_Ok);
+}
+
+/*---------------------------------------------------------------------
+   Function: _MIDI_WakeSooner
+
+   Shortens the wait of a sequence's task so that it runs again within
+   the specified number of timer counts.  A playing song still wakes
+   on a tick, with its position and timing kept exact.  Call with
+   interrupts disabled.
+---------------------------------------------------------------------*/
+
+static void _MIDI_WakeSooner(
+    sequence *Song,
+    unsigned long counts)
+
+{
+    task *Task;
+    unsigned long ticks;
+    unsigned long fraction;
+
+    Task = Song->PlayRoutine;
+    if (Task->rate - Task->count <= counts)
+    {
+        return;
+    }
+
+    if (!Song->active)
+    {
+        TS_SetTaskInterval(Task, Task->count + counts);
+        return;
+    }
+
+    ticks = min(Task->count / Song->ticklength, Song->sleepticks) +
+            max(counts / Song->ticklength, 1L);
+    if (ticks >= Song->sleepticks)
+    {
+        return;
+    }
+
+    // Take back the part of the wait that is no longer needed
+    fraction = (Song->timefraction - Song->sleepticks * Song->tickfraction) & 0xffff;
+    fraction += ticks * Song->tickfraction;
+    Song->timefraction = fraction & 0xffff;
+
+    Song->tick -= Song->sleepticks - ticks;
+    Song->sleepticks = ticks;
+    TS_SetTaskInterval(Task, ticks * Song->ticklength + (fraction >> 16));
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDI_CrossfadeSequences
+
+   Fades the sequence "to" in to full volume while the sequence "from"
+   fades out and stops.  Set the volume of "to" to 0 before starting
+   its song so that it starts silent.
+---------------------------------------------------------------------*/
+
+int MIDI_CrossfadeSequences(
+    int from,
+    int to,
+    int milliseconds)
+
+{
+    int status;
+
+    status = MIDI_FadeSequence(to, MIDI_MaxVolume, milliseconds, FALSE);
+    if (status == MIDI_Ok)
+    {
+        status = MIDI_FadeSequence(from, 0, milliseconds, TRUE);
+    }
+
+    return (status);
+}
+
+/*---------------------------------------------------------------------
+   Function: _MIDI_FindTimbres
+
+   Records which timbres a song uses, so that they can be loaded
+   without scanning the song each time it plays.
+---------------------------------------------------------------------*/
+
+static void _MIDI_FindTimbres(
+    midisong *Music)
+
+{
+    int command;
+    int channel;
+    int timbre;
+    long index;
+    midievent huge *Event;
+
+    memset(Music->timbres, 0, sizeof(Music->timbres));
+
+    for (index = 0; index < Music->numevents; index++)
+    {
+        Event = &Music->Events[index];
+        channel = GET_MIDI_CHANNEL(Event->status);
+        command = GET_MIDI_COMMAND(Event->status);
+
+        if (channel == MIDI_RHYTHM_CHANNEL)
+        {
+            if (command != MIDI_NOTE_ON)
+            {
+                continue;
+            }
+
+            timbre = 128 + Event->data1;
+        }
+        else if (command == MIDI_PROGRAM_CHANGE)
+        {
+            timbre = Event->data1;
+        }
+        else
+        {
+            continue;
+        }
+
+        Music->timbres[timbre >> 3] |= 1 << (timbre & 7);
+    }
+}
+
+/*---------------------------------------------------------------------
+   Function: _MIDI_LoadTimbres
+
+   Preloads the timbres used by a song on cards that use
+   patch-caching.
+---------------------------------------------------------------------*/
+
+static void _MIDI_LoadTimbres(
+    midisong *Music)
+
+{
+    int timbre;
+
+    if (!Music->loaded)
+    {
+        return;
+    }
+
+    for (timbre = 0; timbre < MIDI_NumTimbres; timbre++)
+    {
+        if (Music->timbres[timbre >> 3] & (1 << (timbre & 7)))
+        {
+            _MIDI_Funcs->LoadPatch(timbre);
+        }
+    }
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDI_LoadTimbres
+
+   Preloads the timbres on cards that use patch-caching.
+---------------------------------------------------------------------*/
+
+void MIDI_LoadTimbres(
+    void)
+
+{
+    _MIDI_LoadTimbres(&_MIDI_Sequences[MIDI_PrimarySequence].Music);
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDI_SetSongTick
+
+   Moves playback to the specified tick.  The channel settings at
+   that point are sent, but notes that started before it are not.
+---------------------------------------------------------------------*/
+
+int MIDI_SetSongTick(
+    unsigned long PositionInTicks)
+
+{
+    midistate state;
+    int active;
+    sequence *Song;
+
+    Song = &_MIDI_Sequences[MIDI_PrimarySequence];
+
+    if (!Song->loaded)
+    {
+        return (MIDI_NoSong);
+    }
+
+    active = Song->active;
+    Song->active = FALSE;
+    _MIDI_NotesOff(Song->Music.channels);
+
+    PositionInTicks = min(PositionInTicks, Song->Music.Events[Song->Music.numevents].time);
+    _MIDI_GetState(&Song->Music, &state, PositionInTicks);
+    _MIDI_SendState(Song, NULL, &state);
+
+    DISABLE_INTERRUPTS();
+    _MIDI_SetTempo(Song, state.tempo);
+    Song->timefraction = 0;
+    Song->eventindex = state.event;
+    Song->tick = PositionInTicks;
+    Song->sleepticks = 0;
+
+    // Play from the new position on the next tick
+    TS_RestartTask(Song->PlayRoutine, Song->ticklength);
+    Song->active = active;
+    ENABLE_INTERRUPTS();
+
+    return (MIDI_Ok);
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDI_SetSongTime
+
+   Moves playback to the specified time in milliseconds from the
+   start of the song.
+---------------------------------------------------------------------*/
+
+int MIDI_SetSongTime(
+    unsigned long milliseconds)
+
+{
+    sequence *Song;
+
+    Song = &_MIDI_Sequences[MIDI_PrimarySequence];
+
+    if (!Song->loaded)
+    {
+        return (MIDI_NoSong);
+    }
+
+    return (MIDI_SetSongTick(_MIDI_TimeToTick(&Song->Music, milliseconds)));
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDI_SetSongPosition
+
+   Moves playback to the specified measure, beat and tick.  Measures
+   and beats start at 1, ticks start at 0.
+---------------------------------------------------------------------*/
+
+int MIDI_SetSongPosition(
+    int measure,
+    int beat,
+    int tick)
+
+{
+    midistate state;
+    midievent huge *Event;
+    long index;
+    long pos;
+    long ticks;
+    sequence *Song;
+
+    Song = &_MIDI_Sequences[MIDI_PrimarySequence];
+
+    if (!Song->loaded)
+    {
+        return (MIDI_NoSong);
+    }
+
+    pos = RELATIVE_BEAT((long)measure, (long)beat, (long)tick);
+
+    // Find the last checkpoint before the position
+    index = 0;
+    while ((index + 1 < Song->Music.numcheckpoints) &&
+           (RELATIVE_BEAT((long)Song->Music.Checkpoints[index + 1].measure,
+                          (long)Song->Music.Checkpoints[index + 1].beat,
+                          (long)Song->Music.Checkpoints[index + 1].beattick) <= pos))
+    {
+        index++;
+    }
+
+    state = Song->Music.Checkpoints[index];
+    for (;;)
+    {
+        // Ticks from the state to the position in the current time
+        // signature
+        ticks = (((long)measure - state.measure) * state.beatspermeasure +
+                 ((long)beat - state.beat)) *
+                    state.ticksperbeat +
+                ((long)tick - state.beattick);
+        ticks = max(ticks, 0L);
+
+        Event = &Song->Music.Events[state.event];
+        if ((state.event >= Song->Music.numevents) ||
+            (state.tick + ticks < Event->time) ||
+            ((state.tick + ticks == Event->time) &&
+             (Event->status != MIDI_META_EVENT)))
+        {
+            break;
+        }
+
+        _MIDI_ApplyEvent(&Song->Music, &state, Event);
+        state.event++;
+    }
+
+    return (MIDI_SetSongTick(state.tick + ticks));
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDI_GetSongPosition
+
+   Returns the position of the song in ticks, milliseconds and
+   measures, beats and ticks.
+---------------------------------------------------------------------*/
+
+void MIDI_GetSongPosition(
+    songposition *pos)
+
+{
+    midistate state;
+    unsigned long tick;
+    sequence *Song;
+
+    Song = &_MIDI_Sequences[MIDI_PrimarySequence];
+
+    if (!Song->loaded)
+    {
+        memset(pos, 0, sizeof(songposition));
+        return;
+    }
+
+    DISABLE_INTERRUPTS();
+    tick = _MIDI_CurrentTick(Song);
+    ENABLE_INTERRUPTS();
+
+    _MIDI_GetState(&Song->Music, &state, tick);
+
+    // Tempo and time signature changes on this tick already apply
+    while ((state.event < Song->Music.numevents) &&
+           (Song->Music.Events[state.event].time == tick))
+    {
+        _MIDI_ApplyEvent(&Song->Music, &state, &Song->Music.Events[state.event]);
+        state.event++;
     }
 
-    _MIDI_ResetTracks();
+    pos->tickposition = tick;
+    pos->milliseconds = _MIDI_TickToTime(&Song->Music, tick);
+    pos->measure = state.measure;
+    pos->beat = state.beat;
+    pos->tick = state.beattick;
 }
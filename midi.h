@@ -41,7 +41,13 @@ enum MIDI_Errors
     MIDI_UnknownMidiFormat,
     MIDI_NoTracks,
     MIDI_InvalidTrack,
-    MIDI_NoMemory
+    MIDI_NoMemory,
+    MIDI_NoSong,
+    MIDI_InvalidSequence,
+    MIDI_InvalidChannel,
+    MIDI_NoFreeSong,
+    MIDI_InvalidSong,
+    MIDI_MusicPlaying
 };
 
 #define MIDI_PASS_THROUGH 1
@@ -49,6 +55,31 @@ enum MIDI_Errors
 
 #define MIDI_MaxVolume 255
 
+// Number of songs that can play at the same time
+#define MIDI_MaxSequences 4
+
+// Number of songs that can be kept prepared for playback
+#define MIDI_MaxPreparedSongs 8
+
+// Tempo scale in percent of the tempo of the song
+#define MIDI_NormalTempo 100
+#define MIDI_MinTempoScale 25
+#define MIDI_MaxTempoScale 400
+
+// Largest transposition in semitones
+#define MIDI_MaxTranspose 24
+
+// Songs are compiled without removing any events
+#define MIDI_NoThinning 0
+
+// Sequence of MIDI data sent by calls from the game
+#define MIDI_NoSequence -1
+
+// Points in a song where a queued transition can take place
+#define MIDI_AtBeat 0
+#define MIDI_AtBar 1
+#define MIDI_AtMarker 2
+
 typedef struct
 {
     void (*NoteOff)(int channel, int key, int velocity);
@@ -62,13 +93,43 @@ typedef struct
     void (*LoadPatch)(int number);
     void (*SetVolume)(int volume);
     int (*GetVolume)(void);
+    void (*SysEx)(int status, unsigned char *data, int length);
+
+    // Called before and after the events of each tick, so the device
+    // can hold its output and send it in one pass.  Either may be NULL.
+    void (*QueueOutput)(void);
+    void (*FlushOutput)(void);
 } midifuncs;
 
+// A software synthesizer that songs can be rendered through.  The
+// song's events go to Funcs, and Render makes the samples that play
+// until the next events.  Each sample takes samplesize bytes.
+typedef struct
+{
+    midifuncs *Funcs;
+    void (*Render)(char huge *buffer, unsigned samples);
+    unsigned samplerate;
+    int samplesize;
+} midisynth;
+
+// When MIDI data was sent, in ticks of the song of the sequence that
+// sent it and in timer counts the sequencer has played.
+typedef struct
+{
+    int sequence;
+    unsigned long tick;
+    unsigned long clock;
+} miditime;
+
 int MIDI_AllNotesOff(void);
 void MIDI_Reset(void);
 int MIDI_SetVolume(int volume);
 int MIDI_GetVolume(void);
+int MIDI_FadeVolume(int volume, int milliseconds);
+int MIDI_VolumeFading(void);
 int MIDI_SetMidiFuncs(midifuncs *funcs);
+midifuncs *MIDI_ReplaceMidiFuncs(midifuncs *funcs);
+void MIDI_GetEventTime(miditime *time);
 void MIDI_SetLoopFlag(int loopflag);
 void MIDI_ContinueSong(void);
 void MIDI_PauseSong(void);
@@ -76,5 +137,37 @@ int MIDI_SongPlaying(void);
 void MIDI_StopSong(void);
 int MIDI_PlaySong(unsigned char *song, int loopflag);
 void MIDI_LoadTimbres(void);
+int MIDI_SetSongTick(unsigned long PositionInTicks);
+int MIDI_SetSongTime(unsigned long milliseconds);
+int MIDI_SetSongPosition(int measure, int beat, int tick);
+void MIDI_GetSongPosition(songposition *pos);
+int MIDI_PlaySequence(int sequence, unsigned char *song, int loopflag);
+int MIDI_StopSequence(int sequence);
+int MIDI_SequencePlaying(int sequence);
+int MIDI_SetSequenceVolume(int sequence, int volume);
+int MIDI_GetSequenceVolume(int sequence);
+int MIDI_FadeSequence(int sequence, int volume, int milliseconds, int stopflag);
+int MIDI_CrossfadeSequences(int from, int to, int milliseconds);
+int MIDI_PrepareSong(unsigned char *song);
+int MIDI_FreePreparedSong(int handle);
+int MIDI_PlayPrepared(int sequence, int handle, int loopflag);
+int MIDI_RenderSong(int sequence, int handle, midisynth *synth,
+                    char huge *buffer, unsigned long samples, int loopflag);
+int MIDI_QueueTransition(int sequence, int handle, int boundary,
+                         unsigned long starttick, int loopflag);
+int MIDI_CancelTransition(int sequence);
+int MIDI_TransitionPending(int sequence);
+void MIDI_SetThinning(int resolution);
+long MIDI_GetThinnedEvents(void);
+void MIDI_SetMetaCallBack(void (*function)(songmeta *event));
+int MIDI_ServiceMetaEvents(void);
+int MIDI_SetChannelMute(int sequence, int channel, int mute);
+int MIDI_SetChannelSolo(int sequence, int channel, int solo);
+int MIDI_SetChannelGain(int sequence, int channel, int gain);
+int MIDI_GetChannelGain(int sequence, int channel);
+void MIDI_SetTempoScale(int percent);
+int MIDI_GetTempoScale(void);
+void MIDI_SetTranspose(int semitones);
+int MIDI_GetTranspose(void);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,938 @@
+/*
+Copyright (C) 1994-1995 Apogee Software, Ltd.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+/**********************************************************************
+   module: MIDIREC.C
+
+   Records the calls the MIDI sequencer makes to the music device, so
+   that they can be saved and replayed to any device.
+**********************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <dos.h>
+#include "interrup.h"
+#include "task_man.h"
+#include "music.h"
+#include "midi.h"
+#include "midirec.h"
+#include "_midirec.h"
+
+#define TRUE (1 == 1)
+#define FALSE (!TRUE)
+
+static midirecord MIDIREC_Buffer[MIDIREC_BufferSize];
+static volatile long MIDIREC_Count = 0;
+static int MIDIREC_Active = FALSE;
+
+// The device the recorded calls are passed on to
+static midifuncs *MIDIREC_Device = NULL;
+static midifuncs MIDIREC_Funcs;
+
+static task *MIDIREC_ReplayTask = NULL;
+static midifuncs *MIDIREC_ReplayFuncs;
+static unsigned char *MIDIREC_ReplayPos;
+static long MIDIREC_ReplayLeft;
+static unsigned long MIDIREC_ReplayClock;
+
+/*---------------------------------------------------------------------
+   Function: MIDIREC_AddRecord
+
+   Stores a call in the buffer, with the time the sequencer made it.
+   Once the buffer is full, the oldest call is overwritten.
+---------------------------------------------------------------------*/
+
+static void MIDIREC_AddRecord(
+    int call,
+    int channel,
+    int data1,
+    int data2,
+    unsigned char *data)
+
+{
+    miditime time;
+    midirecord *record;
+
+    MIDI_GetEventTime(&time);
+
+    DISABLE_INTERRUPTS();
+    record = &MIDIREC_Buffer[MIDIREC_Count & (MIDIREC_BufferSize - 1)];
+    MIDIREC_Count++;
+
+    record->clock = time.clock;
+    record->tick = time.tick;
+    record->sequence = time.sequence;
+    record->call = call;
+    record->channel = channel;
+    record->data1 = data1;
+    record->data2 = data2;
+    record->data = data;
+    ENABLE_INTERRUPTS();
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDIREC_RecordNoteOff
+
+   Records a note off and passes it on to the device.
+---------------------------------------------------------------------*/
+
+static void MIDIREC_RecordNoteOff(
+    int channel,
+    int key,
+    int velocity)
+
+{
+    MIDIREC_AddRecord(MIDIREC_NoteOff, channel, key, velocity, NULL);
+    MIDIREC_Device->NoteOff(channel, key, velocity);
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDIREC_RecordNoteOn
+
+   Records a note on and passes it on to the device.
+---------------------------------------------------------------------*/
+
+static void MIDIREC_RecordNoteOn(
+    int channel,
+    int key,
+    int velocity)
+
+{
+    MIDIREC_AddRecord(MIDIREC_NoteOn, channel, key, velocity, NULL);
+    MIDIREC_Device->NoteOn(channel, key, velocity);
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDIREC_RecordPolyAftertouch
+
+   Records a key pressure change and passes it on to the device.
+---------------------------------------------------------------------*/
+
+static void MIDIREC_RecordPolyAftertouch(
+    int channel,
+    int key,
+    int pressure)
+
+{
+    MIDIREC_AddRecord(MIDIREC_PolyAftertouch, channel, key, pressure, NULL);
+    MIDIREC_Device->PolyAftertouch(channel, key, pressure);
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDIREC_RecordControlChange
+
+   Records a controller change and passes it on to the device.
+---------------------------------------------------------------------*/
+
+static void MIDIREC_RecordControlChange(
+    int channel,
+    int number,
+    int value)
+
+{
+    MIDIREC_AddRecord(MIDIREC_ControlChange, channel, number, value, NULL);
+    MIDIREC_Device->ControlChange(channel, number, value);
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDIREC_RecordProgramChange
+
+   Records a program change and passes it on to the device.
+---------------------------------------------------------------------*/
+
+static void MIDIREC_RecordProgramChange(
+    int channel,
+    int program)
+
+{
+    MIDIREC_AddRecord(MIDIREC_ProgramChange, channel, program, 0, NULL);
+    MIDIREC_Device->ProgramChange(channel, program);
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDIREC_RecordChannelAftertouch
+
+   Records a channel pressure change and passes it on to the device.
+---------------------------------------------------------------------*/
+
+static void MIDIREC_RecordChannelAftertouch(
+    int channel,
+    int pressure)
+
+{
+    MIDIREC_AddRecord(MIDIREC_ChannelAftertouch, channel, pressure, 0, NULL);
+    MIDIREC_Device->ChannelAftertouch(channel, pressure);
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDIREC_RecordPitchBend
+
+   Records a pitch bend and passes it on to the device.
+---------------------------------------------------------------------*/
+
+static void MIDIREC_RecordPitchBend(
+    int channel,
+    int lsb,
+    int msb)
+
+{
+    MIDIREC_AddRecord(MIDIREC_PitchBend, channel, lsb, msb, NULL);
+    MIDIREC_Device->PitchBend(channel, lsb, msb);
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDIREC_RecordReleasePatches
+
+   Records the release of the patches and passes it on to the device.
+---------------------------------------------------------------------*/
+
+static void MIDIREC_RecordReleasePatches(
+    void)
+
+{
+    MIDIREC_AddRecord(MIDIREC_ReleasePatches, 0, 0, 0, NULL);
+    MIDIREC_Device->ReleasePatches();
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDIREC_RecordLoadPatch
+
+   Records the loading of a patch and passes it on to the device.
+---------------------------------------------------------------------*/
+
+static void MIDIREC_RecordLoadPatch(
+    int number)
+
+{
+    MIDIREC_AddRecord(MIDIREC_LoadPatch, 0, number & 0xff, number >> 8, NULL);
+    MIDIREC_Device->LoadPatch(number);
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDIREC_RecordSetVolume
+
+   Records a change of the device volume and passes it on.
+---------------------------------------------------------------------*/
+
+static void MIDIREC_RecordSetVolume(
+    int volume)
+
+{
+    MIDIREC_AddRecord(MIDIREC_SetVolume, 0, volume, 0, NULL);
+    MIDIREC_Device->SetVolume(volume);
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDIREC_RecordSysEx
+
+   Records a system exclusive message and passes it on to the device.
+---------------------------------------------------------------------*/
+
+static void MIDIREC_RecordSysEx(
+    int status,
+    unsigned char *data,
+    int length)
+
+{
+    MIDIREC_AddRecord(MIDIREC_SysEx, status, length & 0xff, length >> 8, data);
+    MIDIREC_Device->SysEx(status, data, length);
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDIREC_StartRecording
+
+   Starts recording the calls made to the MIDI routines in use.  The
+   calls recorded before are discarded.
+---------------------------------------------------------------------*/
+
+int MIDIREC_StartRecording(
+    void)
+
+{
+    midifuncs *device;
+
+    DISABLE_INTERRUPTS();
+    MIDIREC_Count = 0;
+
+    if (MIDIREC_Active)
+    {
+        ENABLE_INTERRUPTS();
+        return (MIDIREC_Ok);
+    }
+
+    device = MIDI_ReplaceMidiFuncs(&MIDIREC_Funcs);
+    if (device == NULL)
+    {
+        MIDI_ReplaceMidiFuncs(NULL);
+        ENABLE_INTERRUPTS();
+        return (MIDIREC_NullMidiModule);
+    }
+
+    // The sequencer skips the routines the device doesn't have
+    MIDIREC_Device = device;
+    MIDIREC_Funcs.NoteOff = (device->NoteOff != NULL) ? MIDIREC_RecordNoteOff : NULL;
+    MIDIREC_Funcs.NoteOn = (device->NoteOn != NULL) ? MIDIREC_RecordNoteOn : NULL;
+    MIDIREC_Funcs.PolyAftertouch = (device->PolyAftertouch != NULL) ? MIDIREC_RecordPolyAftertouch : NULL;
+    MIDIREC_Funcs.ControlChange = (device->ControlChange != NULL) ? MIDIREC_RecordControlChange : NULL;
+    MIDIREC_Funcs.ProgramChange = (device->ProgramChange != NULL) ? MIDIREC_RecordProgramChange : NULL;
+    MIDIREC_Funcs.ChannelAftertouch = (device->ChannelAftertouch != NULL) ? MIDIREC_RecordChannelAftertouch : NULL;
+    MIDIREC_Funcs.PitchBend = (device->PitchBend != NULL) ? MIDIREC_RecordPitchBend : NULL;
+    MIDIREC_Funcs.ReleasePatches = (device->ReleasePatches != NULL) ? MIDIREC_RecordReleasePatches : NULL;
+    MIDIREC_Funcs.LoadPatch = (device->LoadPatch != NULL) ? MIDIREC_RecordLoadPatch : NULL;
+    MIDIREC_Funcs.SetVolume = (device->SetVolume != NULL) ? MIDIREC_RecordSetVolume : NULL;
+    MIDIREC_Funcs.GetVolume = device->GetVolume;
+    MIDIREC_Funcs.SysEx = (device->SysEx != NULL) ? MIDIREC_RecordSysEx : NULL;
+    MIDIREC_Funcs.QueueOutput = device->QueueOutput;
+    MIDIREC_Funcs.FlushOutput = device->FlushOutput;
+
+    MIDIREC_Active = TRUE;
+    ENABLE_INTERRUPTS();
+
+    return (MIDIREC_Ok);
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDIREC_StopRecording
+
+   Stops recording the calls to the MIDI routines.  The calls recorded
+   are kept until recording starts again.
+---------------------------------------------------------------------*/
+
+void MIDIREC_StopRecording(
+    void)
+
+{
+    if (MIDIREC_Active)
+    {
+        MIDI_ReplaceMidiFuncs(MIDIREC_Device);
+        MIDIREC_Active = FALSE;
+    }
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDIREC_Recording
+
+   Returns whether the calls to the MIDI routines are being recorded.
+---------------------------------------------------------------------*/
+
+int MIDIREC_Recording(
+    void)
+
+{
+    return (MIDIREC_Active);
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDIREC_GetRecordCount
+
+   Returns the number of calls held in the buffer.
+---------------------------------------------------------------------*/
+
+long MIDIREC_GetRecordCount(
+    void)
+
+{
+    return (min(MIDIREC_Count, (long)MIDIREC_BufferSize));
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDIREC_GetLostRecords
+
+   Returns the number of calls that were overwritten because the
+   buffer was full.
+---------------------------------------------------------------------*/
+
+long MIDIREC_GetLostRecords(
+    void)
+
+{
+    return (max(MIDIREC_Count - MIDIREC_BufferSize, 0L));
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDIREC_GetRecord
+
+   Returns a call held in the buffer, counting from the oldest.
+---------------------------------------------------------------------*/
+
+static midirecord *MIDIREC_GetRecord(
+    long index)
+
+{
+    index += MIDIREC_GetLostRecords();
+
+    return (&MIDIREC_Buffer[index & (MIDIREC_BufferSize - 1)]);
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDIREC_WriteNumber
+
+   Writes a big endian number of the specified number of bytes.
+---------------------------------------------------------------------*/
+
+static unsigned char *MIDIREC_WriteNumber(
+    unsigned char *ptr,
+    unsigned long number,
+    int size)
+
+{
+    while (size--)
+    {
+        *ptr++ = (number >> (size * 8)) & 0xff;
+    }
+
+    return (ptr);
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDIREC_ReadNumber
+
+   Reads a big endian number of the specified number of bytes.
+---------------------------------------------------------------------*/
+
+static unsigned long MIDIREC_ReadNumber(
+    unsigned char *ptr,
+    int size)
+
+{
+    unsigned long number;
+
+    number = 0;
+    while (size--)
+    {
+        number = (number << 8) | *ptr++;
+    }
+
+    return (number);
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDIREC_WriteDelta
+
+   Writes a variable length number as used by MIDI files.  These are
+   at most four bytes long, so larger numbers are limited to that.
+---------------------------------------------------------------------*/
+
+static unsigned char *MIDIREC_WriteDelta(
+    unsigned char *ptr,
+    unsigned long delta)
+
+{
+    int size;
+
+    delta = min(delta, MIDIREC_MaxDelta);
+
+    size = 1;
+    while ((size < 4) && (delta >> (size * 7)))
+    {
+        size++;
+    }
+
+    while (size--)
+    {
+        *ptr++ = ((delta >> (size * 7)) & 0x7f) | (size ? 0x80 : 0);
+    }
+
+    return (ptr);
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDIREC_Output
+
+   Adds data to a file being saved.  Without a buffer, only the length
+   of the file is counted.
+---------------------------------------------------------------------*/
+
+static long MIDIREC_Output(
+    unsigned char *buffer,
+    long length,
+    unsigned char *data,
+    int count)
+
+{
+    if (buffer != NULL)
+    {
+        memcpy(buffer + length, data, count);
+    }
+
+    return (length + count);
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDIREC_WriteTrace
+
+   Writes the recorded calls as a trace.  Returns its length.
+---------------------------------------------------------------------*/
+
+static long MIDIREC_WriteTrace(
+    unsigned char *buffer)
+
+{
+    long index;
+    long count;
+    long length;
+    unsigned char data[MIDIREC_RecordSize];
+    unsigned char *ptr;
+    midirecord *record;
+
+    count = MIDIREC_GetRecordCount();
+    ptr = MIDIREC_WriteNumber(data, MIDIREC_TraceSignature, 4);
+    MIDIREC_WriteNumber(ptr, count, 4);
+    length = MIDIREC_Output(buffer, 0, data, MIDIREC_HeaderSize);
+
+    for (index = 0; index < count; index++)
+    {
+        record = MIDIREC_GetRecord(index);
+
+        ptr = MIDIREC_WriteNumber(data, record->clock, 4);
+        ptr = MIDIREC_WriteNumber(ptr, record->tick, 4);
+        *ptr++ = record->sequence;
+        *ptr++ = record->call;
+        *ptr++ = record->channel;
+        *ptr++ = record->data1;
+        *ptr++ = record->data2;
+        length = MIDIREC_Output(buffer, length, data, MIDIREC_RecordSize);
+
+        if (record->call == MIDIREC_SysEx)
+        {
+            length = MIDIREC_Output(buffer, length, record->data,
+                                    record->data1 + (record->data2 << 8));
+        }
+    }
+
+    return (length);
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDIREC_SaveTrace
+
+   Saves the recorded calls as a trace that can be replayed.  Returns
+   the length of the trace, or an error code below zero.  Without a
+   buffer, returns the size of buffer the trace needs.  Stop recording
+   before saving.
+---------------------------------------------------------------------*/
+
+long MIDIREC_SaveTrace(
+    unsigned char *buffer,
+    long size)
+
+{
+    long length;
+
+    length = MIDIREC_WriteTrace(NULL);
+    if (buffer == NULL)
+    {
+        return (length);
+    }
+
+    if (length > size)
+    {
+        return (MIDIREC_BufferTooSmall);
+    }
+
+    return (MIDIREC_WriteTrace(buffer));
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDIREC_WriteMidi
+
+   Writes the recorded MIDI messages as a format 0 MIDI file.  Returns
+   its length.
+---------------------------------------------------------------------*/
+
+static long MIDIREC_WriteMidi(
+    unsigned char *buffer)
+
+{
+    long index;
+    long count;
+    long length;
+    long start;
+    unsigned long tick;
+    unsigned long time;
+    unsigned char data[16];
+    unsigned char *ptr;
+    midirecord *record;
+
+    ptr = MIDIREC_WriteNumber(data, MIDIREC_MidiHeader, 4);
+    ptr = MIDIREC_WriteNumber(ptr, 6, 4);
+    ptr = MIDIREC_WriteNumber(ptr, 0, 2);
+    ptr = MIDIREC_WriteNumber(ptr, 1, 2);
+    ptr = MIDIREC_WriteNumber(ptr, MIDIREC_Division, 2);
+    length = MIDIREC_Output(buffer, 0, data, ptr - data);
+
+    // The length of the track is filled in at the end
+    ptr = MIDIREC_WriteNumber(data, MIDIREC_MidiTrack, 4);
+    ptr = MIDIREC_WriteNumber(ptr, 0, 4);
+    length = MIDIREC_Output(buffer, length, data, ptr - data);
+    start = length;
+
+    ptr = data;
+    *ptr++ = 0;
+    *ptr++ = MIDI_META_EVENT;
+    *ptr++ = MIDI_TEMPO_CHANGE;
+    *ptr++ = 3;
+    ptr = MIDIREC_WriteNumber(ptr, MIDIREC_Tempo, 3);
+    length = MIDIREC_Output(buffer, length, data, ptr - data);
+
+    count = MIDIREC_GetRecordCount();
+    tick = 0;
+    for (index = 0; index < count; index++)
+    {
+        record = MIDIREC_GetRecord(index);
+
+        // Patches and the device volume aren't MIDI messages
+        if ((record->call == MIDIREC_ReleasePatches) ||
+            (record->call == MIDIREC_LoadPatch) ||
+            (record->call == MIDIREC_SetVolume))
+        {
+            continue;
+        }
+
+        time = (record->clock - MIDIREC_GetRecord(0)->clock) / MIDIREC_CountsPerTick;
+
+        // Never step back in time, which would wrap the delta
+        if ((long)(time - tick) < 0)
+        {
+            time = tick;
+        }
+        ptr = MIDIREC_WriteDelta(data, time - tick);
+        tick = time;
+
+        if (record->call == MIDIREC_SysEx)
+        {
+            *ptr++ = record->channel;
+            ptr = MIDIREC_WriteDelta(ptr, record->data1 + (record->data2 << 8));
+            length = MIDIREC_Output(buffer, length, data, ptr - data);
+            length = MIDIREC_Output(buffer, length, record->data,
+                                    record->data1 + (record->data2 << 8));
+            continue;
+        }
+
+        // The calls that send MIDI messages are in the order of their
+        // status bytes, starting from the note off.
+        *ptr++ = ((record->call + 8) << 4) | record->channel;
+        *ptr++ = record->data1;
+        if ((record->call != MIDIREC_ProgramChange) &&
+            (record->call != MIDIREC_ChannelAftertouch))
+        {
+            *ptr++ = record->data2;
+        }
+        length = MIDIREC_Output(buffer, length, data, ptr - data);
+    }
+
+    ptr = data;
+    *ptr++ = 0;
+    *ptr++ = MIDI_META_EVENT;
+    *ptr++ = MIDI_END_OF_TRACK;
+    *ptr++ = 0;
+    length = MIDIREC_Output(buffer, length, data, ptr - data);
+
+    if (buffer != NULL)
+    {
+        MIDIREC_WriteNumber(buffer + start - 4, length - start, 4);
+    }
+
+    return (length);
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDIREC_SaveMidi
+
+   Saves the recorded MIDI messages as a MIDI file.  Patch and device
+   volume changes are left out.  Returns the length of the file, or an
+   error code below zero.  Without a buffer, returns the size of buffer
+   the file needs.  Stop recording before saving.
+---------------------------------------------------------------------*/
+
+long MIDIREC_SaveMidi(
+    unsigned char *buffer,
+    long size)
+
+{
+    long length;
+
+    length = MIDIREC_WriteMidi(NULL);
+    if (buffer == NULL)
+    {
+        return (length);
+    }
+
+    if (length > size)
+    {
+        return (MIDIREC_BufferTooSmall);
+    }
+
+    return (MIDIREC_WriteMidi(buffer));
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDIREC_ReadRecord
+
+   Reads a call from a trace.  Returns the position of the next call.
+---------------------------------------------------------------------*/
+
+static unsigned char *MIDIREC_ReadRecord(
+    unsigned char *ptr,
+    midirecord *record)
+
+{
+    record->clock = MIDIREC_ReadNumber(ptr, 4);
+    record->tick = MIDIREC_ReadNumber(ptr + 4, 4);
+    record->sequence = ptr[8];
+    record->call = ptr[9];
+    record->channel = ptr[10];
+    record->data1 = ptr[11];
+    record->data2 = ptr[12];
+    ptr += MIDIREC_RecordSize;
+
+    record->data = NULL;
+    if (record->call == MIDIREC_SysEx)
+    {
+        record->data = ptr;
+        ptr += record->data1 + (record->data2 << 8);
+    }
+
+    return (ptr);
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDIREC_SendRecord
+
+   Makes a recorded call to the specified MIDI routines.
+---------------------------------------------------------------------*/
+
+static void MIDIREC_SendRecord(
+    midifuncs *funcs,
+    midirecord *record)
+
+{
+    switch (record->call)
+    {
+    case MIDIREC_NoteOff:
+        if (funcs->NoteOff)
+        {
+            funcs->NoteOff(record->channel, record->data1, record->data2);
+        }
+        break;
+
+    case MIDIREC_NoteOn:
+        if (funcs->NoteOn)
+        {
+            funcs->NoteOn(record->channel, record->data1, record->data2);
+        }
+        break;
+
+    case MIDIREC_PolyAftertouch:
+        if (funcs->PolyAftertouch)
+        {
+            funcs->PolyAftertouch(record->channel, record->data1, record->data2);
+        }
+        break;
+
+    case MIDIREC_ControlChange:
+        if (funcs->ControlChange)
+        {
+            funcs->ControlChange(record->channel, record->data1, record->data2);
+        }
+        break;
+
+    case MIDIREC_ProgramChange:
+        if (funcs->ProgramChange)
+        {
+            funcs->ProgramChange(record->channel, record->data1);
+        }
+        break;
+
+    case MIDIREC_ChannelAftertouch:
+        if (funcs->ChannelAftertouch)
+        {
+            funcs->ChannelAftertouch(record->channel, record->data1);
+        }
+        break;
+
+    case MIDIREC_PitchBend:
+        if (funcs->PitchBend)
+        {
+            funcs->PitchBend(record->channel, record->data1, record->data2);
+        }
+        break;
+
+    case MIDIREC_ReleasePatches:
+        if (funcs->ReleasePatches)
+        {
+            funcs->ReleasePatches();
+        }
+        break;
+
+    case MIDIREC_LoadPatch:
+        if (funcs->LoadPatch)
+        {
+            funcs->LoadPatch(record->data1 + (record->data2 << 8));
+        }
+        break;
+
+    case MIDIREC_SetVolume:
+        if (funcs->SetVolume)
+        {
+            funcs->SetVolume(record->data1);
+        }
+        break;
+
+    case MIDIREC_SysEx:
+        if (funcs->SysEx)
+        {
+            funcs->SysEx(record->channel, record->data,
+                         record->data1 + (record->data2 << 8));
+        }
+        break;
+    }
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDIREC_ServiceReplay
+
+   Task that makes the calls of a trace that are due, then sleeps
+   until the next call is due.
+---------------------------------------------------------------------*/
+
+static void MIDIREC_ServiceReplay(
+    task *Task)
+
+{
+    midirecord record;
+    unsigned char *next;
+
+    while (MIDIREC_ReplayLeft > 0)
+    {
+        next = MIDIREC_ReadRecord(MIDIREC_ReplayPos, &record);
+        if ((long)(record.clock - MIDIREC_ReplayClock) > 0)
+        {
+            TS_SetTaskInterval(Task, record.clock - MIDIREC_ReplayClock);
+            MIDIREC_ReplayClock = record.clock;
+            return;
+        }
+
+        MIDIREC_SendRecord(MIDIREC_ReplayFuncs, &record);
+        MIDIREC_ReplayPos = next;
+        MIDIREC_ReplayLeft--;
+    }
+
+    TS_Terminate(Task);
+    MIDIREC_ReplayTask = NULL;
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDIREC_Replay
+
+   Makes the calls of a trace to the specified MIDI routines.  In real
+   time, the calls are made at the times they were recorded by a timer
+   task, and the trace must stay in memory until the replay ends.
+   Flat out, they are made as fast as possible before returning, for
+   timing the device.
+---------------------------------------------------------------------*/
+
+int MIDIREC_Replay(
+    unsigned char *trace,
+    midifuncs *funcs,
+    int mode)
+
+{
+    long count;
+    midirecord record;
+    unsigned char *ptr;
+
+    if (funcs == NULL)
+    {
+        return (MIDIREC_NullMidiModule);
+    }
+
+    if (MIDIREC_ReadNumber(trace, 4) != MIDIREC_TraceSignature)
+    {
+        return (MIDIREC_InvalidTrace);
+    }
+
+    if (MIDIREC_ReplayTask != NULL)
+    {
+        return (MIDIREC_ReplayBusy);
+    }
+
+    count = MIDIREC_ReadNumber(trace + 4, 4);
+    ptr = trace + MIDIREC_HeaderSize;
+
+    if (mode == MIDIREC_FlatOut)
+    {
+        while (count-- > 0)
+        {
+            ptr = MIDIREC_ReadRecord(ptr, &record);
+            MIDIREC_SendRecord(funcs, &record);
+        }
+
+        return (MIDIREC_Ok);
+    }
+
+    if (count == 0)
+    {
+        return (MIDIREC_Ok);
+    }
+
+    MIDIREC_ReadRecord(ptr, &record);
+    MIDIREC_ReplayFuncs = funcs;
+    MIDIREC_ReplayPos = ptr;
+    MIDIREC_ReplayLeft = count;
+    MIDIREC_ReplayClock = record.clock;
+
+    MIDIREC_ReplayTask = TS_ScheduleTask(MIDIREC_ServiceReplay, 100, 1, NULL);
+    TS_SetTaskInterval(MIDIREC_ReplayTask, 1);
+    TS_Dispatch();
+
+    return (MIDIREC_Ok);
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDIREC_ReplayPlaying
+
+   Returns whether a trace is being replayed in real time.
+---------------------------------------------------------------------*/
+
+int MIDIREC_ReplayPlaying(
+    void)
+
+{
+    return (MIDIREC_ReplayTask != NULL);
+}
+
+/*---------------------------------------------------------------------
+   Function: MIDIREC_StopReplay
+
+   Stops the replay of a trace.
+---------------------------------------------------------------------*/
+
+void MIDIREC_StopReplay(
+    void)
+
+{
+    DISABLE_INTERRUPTS();
+    if (MIDIREC_ReplayTask != NULL)
+    {
+        TS_Terminate(MIDIREC_ReplayTask);
+        MIDIREC_ReplayTask = NULL;
+    }
+    ENABLE_INTERRUPTS();
+}
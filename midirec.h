@@ -0,0 +1,68 @@
+/*
+Copyright (C) 1994-1995 Apogee Software, Ltd.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+/**********************************************************************
+   module: MIDIREC.H
+
+   Public header for MIDIREC.C
+**********************************************************************/
+
+#ifndef __MIDIREC_H
+#define __MIDIREC_H
+
+enum MIDIREC_Errors
+{
+    MIDIREC_Warning = -2,
+    MIDIREC_Error = -1,
+    MIDIREC_Ok = 0,
+    MIDIREC_NullMidiModule,
+    MIDIREC_BufferTooSmall,
+    MIDIREC_InvalidTrace,
+    MIDIREC_ReplayBusy
+};
+
+// How a trace is replayed
+#define MIDIREC_RealTime 0
+#define MIDIREC_FlatOut 1
+
+// The MIDI routines that are recorded
+#define MIDIREC_NoteOff 0
+#define MIDIREC_NoteOn 1
+#define MIDIREC_PolyAftertouch 2
+#define MIDIREC_ControlChange 3
+#define MIDIREC_ProgramChange 4
+#define MIDIREC_ChannelAftertouch 5
+#define MIDIREC_PitchBend 6
+#define MIDIREC_ReleasePatches 7
+#define MIDIREC_LoadPatch 8
+#define MIDIREC_SetVolume 9
+#define MIDIREC_SysEx 10
+
+int MIDIREC_StartRecording(void);
+void MIDIREC_StopRecording(void);
+int MIDIREC_Recording(void);
+long MIDIREC_GetRecordCount(void);
+long MIDIREC_GetLostRecords(void);
+long MIDIREC_SaveTrace(unsigned char *buffer, long size);
+long MIDIREC_SaveMidi(unsigned char *buffer, long size);
+int MIDIREC_Replay(unsigned char *trace, midifuncs *funcs, int mode);
+int MIDIREC_ReplayPlaying(void);
+void MIDIREC_StopReplay(void);
+
+#endif
@@ -43,6 +43,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define MIDI_PROGRAM_CHANGE 0xC0
 #define MIDI_AFTER_TOUCH 0xD0
 #define MIDI_PITCH_BEND 0xE0
+#define MIDI_SYSEX 0xF0
 #define MIDI_META_EVENT 0xFF
 #define MIDI_END_OF_TRACK 0x2F
 #define MIDI_TEMPO_CHANGE 0x51
@@ -341,3 +342,28 @@ void MPU_PitchBend(
     MPU_SendMidi(lsb);
     MPU_SendMidi(msb);
 }
+
+/*---------------------------------------------------------------------
+   Function: MPU_SysEx
+
+   Sends a system exclusive message out to the music device.  A
+   message that starts with MIDI_SYSEX has the status byte sent ahead
+   of the data.  Other messages are sent as they are.
+---------------------------------------------------------------------*/
+
+void MPU_SysEx(
+    int status,
+    unsigned char *data,
+    int length)
+
+{
+    if (status == MIDI_SYSEX)
+    {
+        MPU_SendMidi(MIDI_SYSEX);
+    }
+
+    while (length--)
+    {
+        MPU_SendMidi(*data++);
+    }
+}
@@ -54,6 +54,7 @@ static int MV_BufferSize = MixBufferSize;
 static int MV_MixMode = MONO_8BIT;
 static int MV_Silence = SILENCE_8BIT;
 static char *MV_Buffer = NULL;
+static short *MV_VolumeTable = NULL;
 static int MV_MixPage = 0;
 static int MV_PlayPage = 0;
 static int MV_VoiceHandle = MV_MinVoiceHandle;
@@ -147,6 +148,143 @@ char *MV_ErrorString(
     return (ErrorString);
 }
 
+/*---------------------------------------------------------------------
+   Function: MV_Mix8BitVolume
+
+   Adds or removes 8 bit sound data scaled through a volume table to
+   an 8 bit mix buffer.
+---------------------------------------------------------------------*/
+
+static void MV_Mix8BitVolume(
+    char *to,
+    char *from,
+    int len,
+    short *table,
+    int arg2)
+
+{
+    if (arg2 == 1)
+    {
+        while (len-- > 0)
+        {
+            *to++ += (char)table[(unsigned char)*from++];
+        }
+    }
+    else
+    {
+        while (len-- > 0)
+        {
+            *to++ -= (char)table[(unsigned char)*from++];
+        }
+    }
+}
+
+/*---------------------------------------------------------------------
+   Function: MV_Mix16BitVolume
+
+   Adds or removes 8 bit sound data scaled through a volume table to
+   a 16 bit mix buffer.
+---------------------------------------------------------------------*/
+
+static void MV_Mix16BitVolume(
+    short *to,
+    char *from,
+    int len,
+    short *table,
+    int arg2)
+
+{
+    if (arg2 == 1)
+    {
+        while (len-- > 0)
+        {
+            *to++ += table[(unsigned char)*from++];
+        }
+    }
+    else
+    {
+        while (len-- > 0)
+        {
+            *to++ -= table[(unsigned char)*from++];
+        }
+    }
+}
+
+/*---------------------------------------------------------------------
+   Function: MV_Mix8Bit16Source
+
+   Adds or removes signed 16 bit sound data at the given volume to an
+   8 bit mix buffer.
+---------------------------------------------------------------------*/
+
+static void MV_Mix8Bit16Source(
+    char *to,
+    short *from,
+    int len,
+    int volume,
+    int arg2)
+
+{
+    long level;
+
+    while (len-- > 0)
+    {
+        level = *from++;
+        if (volume < MV_MaxVolume)
+        {
+            level = (level * volume) / MV_MaxVolume;
+        }
+
+        if (arg2 == 1)
+        {
+            *to++ += (char)(level >> 8);
+        }
+        else
+        {
+            *to++ -= (char)(level >> 8);
+        }
+    }
+}
+
+/*---------------------------------------------------------------------
+   Function: MV_Mix16Bit16Source
+
+   Adds or removes signed 16 bit sound data at the given volume to a
+   16 bit mix buffer.  8 bit sounds are mixed in shifted left by
+   shift bits, so 16 bit sounds are shifted right by the remainder.
+---------------------------------------------------------------------*/
+
+static void MV_Mix16Bit16Source(
+    short *to,
+    short *from,
+    int len,
+    int volume,
+    int shift,
+    int arg2)
+
+{
+    long level;
+
+    shift = 8 - shift;
+    while (len-- > 0)
+    {
+        level = *from++;
+        if (volume < MV_MaxVolume)
+        {
+            level = (level * volume) / MV_MaxVolume;
+        }
+
+        if (arg2 == 1)
+        {
+            *to++ += (short)(level >> shift);
+        }
+        else
+        {
+            *to++ -= (short)(level >> shift);
+        }
+    }
+}
+
 /*---------------------------------------------------------------------
    Function: MV_Mix8bitMono
 
@@ -165,7 +303,17 @@ static void MV_Mix8bitMono(
     to = MV_MixBuffer[buffer];
     len = (voice->length > MV_BufferSize) ? MV_BufferSize : voice->length;
     from = voice->unk8 + voice->unk10[buffer];
-    if (arg2 == 1)
+    if (voice->flags & T_16BITSOURCE)
+    {
+        MV_Mix8Bit16Source(to, (short *)voice->unk8 + voice->unk10[buffer],
+                           len, voice->Volume[buffer], arg2);
+    }
+    else if (voice->Volume[buffer] < MV_MaxVolume)
+    {
+        MV_Mix8BitVolume(to, from, len,
+                         &MV_VolumeTable[voice->Volume[buffer] * 256], arg2);
+    }
+    else if (arg2 == 1)
     {
         sub_2A110(to, from, len);
     }
@@ -181,7 +329,7 @@ static void MV_Mix8bitMono(
 /*---------------------------------------------------------------------
    Function: MV_Mix16bitMono
 
-   Mixes the sound into the buffer as an 8 bit mono sample.
+   Mixes the sound into the buffer as a 16 bit mono sample.
 ---------------------------------------------------------------------*/
 
 static void MV_Mix16bitMono(
@@ -197,7 +345,17 @@ static void MV_Mix16bitMono(
     to = MV_MixBuffer[buffer];
     len = (voice->length > MV_BufferSize) ? MV_BufferSize : voice->length;
     from = voice->unk8 + voice->unk10[buffer];
-    if (arg2 == 1)
+    if (voice->flags & T_16BITSOURCE)
+    {
+        MV_Mix16Bit16Source((short *)to, (short *)voice->unk8 + voice->unk10[buffer],
+                            len, voice->Volume[buffer], word_2FDC2, arg2);
+    }
+    else if (voice->Volume[buffer] < MV_MaxVolume)
+    {
+        MV_Mix16BitVolume((short *)to, from, len,
+                          &MV_VolumeTable[voice->Volume[buffer] * 256], arg2);
+    }
+    else if (arg2 == 1)
     {
         sub_2A252(to, from, len, word_2FDC2);
     }
@@ -215,6 +373,16 @@ static void sub_29658(
     int buffer)
 
 {
+    if (voice->flags & T_STREAM)
+    {
+        // Streams are refilled for each buffer, each into its own
+        // part of the stream buffer so the mix can be undone.
+        voice->unkE = buffer * MV_BufferSize;
+        voice->length = MV_BufferSize;
+        voice->StreamFunction(voice->unk8 + voice->unkE * sizeof(short),
+                              MV_BufferSize);
+    }
+
     if (voice->length == 0)
     {
         voice->Active[buffer] = FALSE;
@@ -222,6 +390,9 @@ static void sub_29658(
     }
     voice->Active[buffer] = TRUE;
     voice->unk10[buffer] = voice->unkE;
+
+    // Remember the volume so the voice can be removed from the buffer
+    voice->Volume[buffer] = voice->volume;
     switch (MV_MixMode)
     {
     case MONO_8BIT:
@@ -403,13 +574,46 @@ int MV_VoicePlaying(
 }
 
 /*---------------------------------------------------------------------
-   Function: MV_StopPlayback
+   Function: MV_StreamPlaying
 
-   Stops the sound playback engine.
+   Checks if the voice associated with the specified handle is a
+   stream started by MV_PlayStream.  Handles are reused, so a caller
+   that kept the handle of a stream can use this to tell whether it
+   still refers to that stream.
 ---------------------------------------------------------------------*/
 
-int MV_StopPlayback(
-    void)
+int MV_StreamPlaying(
+    int handle)
+
+{
+    VoiceNode *voice;
+
+    if (!MV_Installed)
+    {
+        MV_SetErrorCode(MV_NotInstalled);
+        return (FALSE);
+    }
+
+    voice = MV_GetVoice(handle);
+
+    if ((voice == NULL) || !(voice->flags & T_STREAM))
+    {
+        return (FALSE);
+    }
+
+    return (TRUE);
+}
+
+/*---------------------------------------------------------------------
+   Function: MV_SetVoiceVolume
+
+   Sets the volume of the voice associated with the specified handle.
+   The change is heard from the next buffer mixed.
+---------------------------------------------------------------------*/
+
+int MV_SetVoiceVolume(
+    int handle,
+    int volume)
 
 {
     VoiceNode *voice;
@@ -419,6 +623,56 @@ int MV_StopPlayback(
         MV_SetErrorCode(MV_NotInstalled);
         return (MV_Error);
     }
+
+    voice = MV_GetVoice(handle);
+    if (voice == NULL)
+    {
+        return (MV_Error);
+    }
+
+    voice->volume = max(0, min(volume, MV_MaxVolume));
+
+    return (MV_Ok);
+}
+
+/*---------------------------------------------------------------------
+   Function: MV_VoicePosition
+
+   Returns the number of samples of the voice associated with the
+   specified handle that have been mixed so far.
+---------------------------------------------------------------------*/
+
+int MV_VoicePosition(
+    int handle)
+
+{
+    VoiceNode *voice;
+
+    if (!MV_Installed)
+    {
+        MV_SetErrorCode(MV_NotInstalled);
+        return (MV_Error);
+    }
+
+    voice = MV_GetVoice(handle);
+    if (voice == NULL)
+    {
+        return (MV_Error);
+    }
+
+    return (voice->unkE);
+}
+
+/*---------------------------------------------------------------------
+   Function: MV_StopEngine
+
+   Stops the sound card from playing the mix buffers.
+---------------------------------------------------------------------*/
+
+static void MV_StopEngine(
+    void)
+
+{
     // Stop sound playback
     switch (MV_SoundCard)
     {
@@ -437,13 +691,48 @@ int MV_StopPlayback(
 #endif
     }
     word_2FDD4 = 0;
-    while (VoiceList.start != NULL)
+}
+
+/*---------------------------------------------------------------------
+   Function: MV_StopPlayback
+
+   Stops the sound playback engine.  Streams are not stopped, since
+   their owner has no way of knowing; playback restarts for them.
+---------------------------------------------------------------------*/
+
+int MV_StopPlayback(
+    void)
+
+{
+    VoiceNode *voice;
+    VoiceNode *next;
+
+    if (!MV_Installed)
     {
-        voice = VoiceList.start;
-        LL_Remove(VoiceNode, &VoiceList, voice);
-        LL_AddToTail(VoiceNode, &VoicePool, voice);
-        word_2FDD6--;
+        MV_SetErrorCode(MV_NotInstalled);
+        return (MV_Error);
+    }
+
+    MV_StopEngine();
+
+    voice = VoiceList.start;
+    while (voice != NULL)
+    {
+        next = voice->next;
+        if (!(voice->flags & T_STREAM))
+        {
+            LL_Remove(VoiceNode, &VoiceList, voice);
+            LL_AddToTail(VoiceNode, &VoicePool, voice);
+            word_2FDD6--;
+        }
+        voice = next;
     }
+
+    if (VoiceList.start != NULL)
+    {
+        MV_StartPlayback();
+    }
+
     return (MV_Ok);
 }
 
@@ -589,6 +878,41 @@ VoiceNode *MV_AllocVoice(
     return (voice);
 }
 
+/*---------------------------------------------------------------------
+   Function: MV_CalcVolume
+
+   Builds the table used to scale samples by the voice volume for the
+   current mix mode.
+---------------------------------------------------------------------*/
+
+static void MV_CalcVolume(
+    void)
+
+{
+    int volume;
+    int sample;
+    long level;
+
+    if (MV_VolumeTable == NULL)
+    {
+        return;
+    }
+
+    for (volume = 0; volume <= MV_MaxVolume; volume++)
+    {
+        for (sample = -128; sample < 128; sample++)
+        {
+            level = sample;
+            if (MV_MixMode == MONO_16BIT)
+            {
+                level <<= word_2FDC2;
+            }
+            level = (level * volume) / MV_MaxVolume;
+            MV_VolumeTable[volume * 256 + (unsigned char)sample] = (short)level;
+        }
+    }
+}
+
 /*---------------------------------------------------------------------
    Function: MV_SetMixMode
 
@@ -605,6 +929,7 @@ int MV_SetMixMode(
     }
 
     MV_StopPlayback();
+    MV_StopEngine();
 
     switch (MV_SoundCard)
     {
@@ -637,6 +962,14 @@ int MV_SetMixMode(
         break;
     }
 
+    MV_CalcVolume();
+
+    // Restart any streams in the new mode
+    if (VoiceList.start != NULL)
+    {
+        MV_StartPlayback();
+    }
+
     return (MV_Ok);
 }
 
@@ -713,13 +1046,15 @@ void sub_29C4E(
 /*---------------------------------------------------------------------
    Function: MV_Play
 
-   Begin playback of sound data with the given sound levels and
-   priority.
+   Begin playback of sound data with the given sample size and
+   priority.  8 bit data is signed, 16 bit data is signed and in
+   Intel byte order.  The length is in samples.
 ---------------------------------------------------------------------*/
 
-int MV_PlayVOC(
+int MV_Play(
     char *ptr,
     int length,
+    int bits,
     int priority)
 
 {
@@ -758,12 +1093,200 @@ int MV_PlayVOC(
     }
 
     voice->priority = priority;
+    voice->volume = MV_MaxVolume;
+    voice->flags = (bits == 16) ? T_16BITSOURCE : 0;
+    voice->StreamFunction = NULL;
     sub_29C4E(voice);
 
     MV_SetErrorCode(MV_Ok);
     return (voice->handle);
 }
 
+/*---------------------------------------------------------------------
+   Function: MV_PlayVOC
+
+   Begin playback of 8 bit sound data with the given priority.
+---------------------------------------------------------------------*/
+
+int MV_PlayVOC(
+    char *ptr,
+    int length,
+    int priority)
+
+{
+    return (MV_Play(ptr, length, 8, priority));
+}
+
+/*---------------------------------------------------------------------
+   Function: MV_PlayBatch
+
+   Begin playback of several sounds at once.  All of the voices are
+   added to the play list within a single critical section, so they
+   all start in the same mix buffer.  The handle of each request is
+   set to the voice handle or MV_Error.  Returns the number of voices
+   started.
+---------------------------------------------------------------------*/
+
+int MV_PlayBatch(
+    mv_play *requests,
+    int count)
+
+{
+    VoiceNode *voice;
+    int buffer;
+    int page;
+    int started;
+
+    if (!MV_Installed)
+    {
+        MV_SetErrorCode(MV_NotInstalled);
+        return (0);
+    }
+
+    if (word_2FDD4 == 0)
+    {
+        MV_StartPlayback();
+    }
+
+    started = 0;
+
+    DISABLE_INTERRUPTS();
+
+    page = MV_PlayPage + 1;
+    if (page >= NumberOfBuffers)
+    {
+        page = 0;
+    }
+
+    for (; count > 0; count--, requests++)
+    {
+        // Request a voice from the voice pool
+        voice = MV_AllocVoice(requests->priority);
+        if (voice == NULL)
+        {
+            requests->handle = MV_Error;
+            continue;
+        }
+
+        voice->unk8 = requests->ptr;
+        voice->length = requests->length;
+        voice->next = NULL;
+        voice->prev = NULL;
+        voice->unkE = 0;
+
+        for (buffer = 0; buffer < NumberOfBuffers; buffer++)
+        {
+            voice->unk10[buffer] = 0;
+            voice->unk18[buffer] = 0;
+            voice->Active[buffer] = 0;
+        }
+
+        voice->priority = requests->priority;
+        voice->volume = max(0, min(requests->volume, MV_MaxVolume));
+        voice->flags = (requests->bits == 16) ? T_16BITSOURCE : 0;
+        voice->StreamFunction = NULL;
+
+        sub_29658(voice, page);
+        LL_AddToTail(VoiceNode, &VoiceList, voice);
+        word_2FDD6++;
+
+        requests->handle = voice->handle;
+        started++;
+    }
+
+    ENABLE_INTERRUPTS();
+
+    if (started == 0)
+    {
+        MV_SetErrorCode(MV_NoVoices);
+    }
+    else
+    {
+        MV_SetErrorCode(MV_Ok);
+    }
+
+    return (started);
+}
+
+/*---------------------------------------------------------------------
+   Function: MV_PlayStream
+
+   Begin playback of sound generated as it is needed.  The function is
+   called from the interrupt to fill each mix buffer with the
+   specified number of 16 bit signed samples at the mixing rate.  The
+   buffer must be MV_StreamBufferSize bytes and remain valid until the
+   voice is killed.  Streams play until killed.
+---------------------------------------------------------------------*/
+
+int MV_PlayStream(
+    char *buffer,
+    void (*function)(char *buffer, int length),
+    int priority)
+
+{
+    VoiceNode *voice;
+    int index;
+
+    if (!MV_Installed)
+    {
+        MV_SetErrorCode(MV_NotInstalled);
+        return (MV_Error);
+    }
+
+    // Request a voice from the voice pool
+    voice = MV_AllocVoice(priority);
+    if (voice == NULL)
+    {
+        MV_SetErrorCode(MV_NoVoices);
+        return (MV_Error);
+    }
+
+    if (word_2FDD4 == 0)
+    {
+        MV_StartPlayback();
+    }
+    voice->unk8 = buffer;
+    voice->length = 0;
+    voice->next = NULL;
+    voice->prev = NULL;
+    voice->unkE = 0;
+
+    for (index = 0; index < NumberOfBuffers; index++)
+    {
+        voice->unk10[index] = 0;
+        voice->unk18[index] = 0;
+        voice->Active[index] = 0;
+    }
+
+    voice->priority = priority;
+    voice->volume = MV_MaxVolume;
+    voice->flags = T_STREAM | T_16BITSOURCE;
+    voice->StreamFunction = function;
+    sub_29C4E(voice);
+
+    MV_SetErrorCode(MV_Ok);
+    return (voice->handle);
+}
+
+/*---------------------------------------------------------------------
+   Function: MV_GetMixRate
+
+   Returns the rate at which voices are mixed.  Until playback has
+   started this is the rate that was requested.
+---------------------------------------------------------------------*/
+
+int MV_GetMixRate(
+    void)
+
+{
+    if (word_2FDD4 == 0)
+    {
+        return (MV_RequestedMixRate);
+    }
+
+    return (MV_MixRate);
+}
+
 /*---------------------------------------------------------------------
    Function: MV_Init
 
@@ -801,6 +1324,14 @@ int MV_Init(
         return MV_Error;
     }
 
+    MV_VolumeTable = farmalloc((MV_MaxVolume + 1) * 256 * sizeof(short));
+    if (MV_VolumeTable == NULL)
+    {
+        farfree(ptr);
+        MV_SetErrorCode(MV_NoMem);
+        return MV_Error;
+    }
+
     // Initialize the sound card
     switch (soundcard)
     {
@@ -840,6 +1371,8 @@ int MV_Init(
     {
         farfree(MV_Buffer);
         MV_Buffer = NULL;
+        farfree(MV_VolumeTable);
+        MV_VolumeTable = NULL;
         return (MV_Error);
     }
 
@@ -892,6 +1425,8 @@ int MV_Init(
         word_2FDC2 = 0;
         break;
     }
+    MV_CalcVolume();
+
     VoiceList.start = NULL;
     VoiceList.end = NULL;
     VoicePool.start = NULL;
@@ -953,6 +1488,9 @@ int MV_Shutdown(
     farfree(MV_Buffer);
     MV_Buffer = NULL;
 
+    farfree(MV_VolumeTable);
+    MV_VolumeTable = NULL;
+
     for (buffer = 0; buffer < NumberOfBuffers; buffer++)
     {
         MV_MixBuffer[buffer] = NULL;
@@ -32,6 +32,20 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define __MULTIVOC_H
 
 #define MV_MinVoiceHandle 1
+#define MV_MaxVolume 63
+
+// Size in bytes of the buffer passed to MV_PlayStream
+#define MV_StreamBufferSize (128 * 4 * 2)
+
+typedef struct
+{
+    char *ptr;
+    int length;
+    int priority;
+    int volume;
+    int bits;
+    int handle;
+} mv_play;
 
 extern int MV_ErrorCode;
 
@@ -60,12 +74,20 @@ enum MV_Errors
 
 char *MV_ErrorString(int ErrorNumber);
 int MV_VoicePlaying(int handle);
+int MV_StreamPlaying(int handle);
 int MV_Kill(int handle);
 int MV_VoicesPlaying(void);
 int MV_SetMixMode(int mode);
 void MV_StartPlayback(void);
 int MV_StopPlayback(void);
 int MV_PlayVOC(char *ptr, int length, int priority);
+int MV_Play(char *ptr, int length, int bits, int priority);
+int MV_PlayBatch(mv_play *requests, int count);
+int MV_PlayStream(char *buffer, void (*function)(char *buffer, int length),
+                  int priority);
+int MV_GetMixRate(void);
+int MV_SetVoiceVolume(int handle, int volume);
+int MV_VoicePosition(int handle);
 int MV_Init(int soundcard, int MixRate, int Voices, int MixMode);
 int MV_Shutdown(void);
 
@@ -34,6 +34,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "music.h"
 #include "midi.h"
 #include "al_midi.h"
+#include "al_emu.h"
 #include "pas16.h"
 #include "blaster.h"
 #include "mpu401.h"
@@ -41,6 +42,9 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define TRUE (1 == 1)
 #define FALSE (!TRUE)
 
+// Priority of the emulator stream among the MultiVoc voices
+#define MUSIC_StreamPriority 0x7fff
+
 int MUSIC_SoundDevice = Adlib;
 int MUSIC_ErrorCode = MUSIC_Ok;
 
@@ -82,6 +86,7 @@ char *MUSIC_ErrorString(
         case SoundBlaster:
         case ProAudioSpectrum:
         case Adlib:
+        case SoftwareFM:
         case GenMidi:
         case WaveBlaster:
             ErrorString = "Music sound card error.";
@@ -109,6 +114,10 @@ char *MUSIC_ErrorString(
         ErrorString = "Could not detect FM chip.";
         break;
 
+    case MUSIC_FMStreamError:
+        ErrorString = "Could not play FM music through sound effects device.";
+        break;
+
     default:
         ErrorString = "Unknown Music error code.";
         break;
@@ -120,7 +129,10 @@ char *MUSIC_ErrorString(
 /*---------------------------------------------------------------------
    Function: MUSIC_Init
 
-   Selects which sound device to use.
+   Selects which sound device to use.  SoftwareFM plays through the
+   sound effects device, so FX_Init must be called first.  Without it,
+   MUSIC_Warning is returned and songs can only be rendered with
+   MUSIC_RenderSong.
 ---------------------------------------------------------------------*/
 
 int MUSIC_Init(
@@ -139,6 +151,7 @@ int MUSIC_Init(
     case SoundBlaster:
     case Adlib:
     case ProAudioSpectrum:
+    case SoftwareFM:
         status = MUSIC_InitFM(SoundCard, &MUSIC_MidiFunctions);
         break;
 
@@ -166,10 +179,20 @@ int MUSIC_Shutdown(
 
 {
     int status;
+    int sequence;
+    int handle;
 
     status = MUSIC_Ok;
 
-    MIDI_StopSong();
+    for (sequence = 0; sequence < MIDI_MaxSequences; sequence++)
+    {
+        MIDI_StopSequence(sequence);
+    }
+
+    for (handle = 0; handle < MIDI_MaxPreparedSongs; handle++)
+    {
+        MIDI_FreePreparedSong(handle);
+    }
 
     switch (MUSIC_SoundDevice)
     {
@@ -188,6 +211,11 @@ int MUSIC_Shutdown(
         AL_Shutdown();
         PAS_RestoreMusicVolume();
         break;
+
+    case SoftwareFM:
+        AL_Shutdown();
+        EMU_Shutdown();
+        break;
     }
 
     return (status);
@@ -222,6 +250,37 @@ int MUSIC_GetVolume(
     return (MIDI_GetVolume());
 }
 
+/*---------------------------------------------------------------------
+   Function: MUSIC_FadeVolume
+
+   Fades the volume of music playback to the specified level over the
+   specified time.
+---------------------------------------------------------------------*/
+
+void MUSIC_FadeVolume(
+    int volume,
+    int milliseconds)
+
+{
+    volume = max(0, volume);
+    volume = min(volume, 255);
+
+    MIDI_FadeVolume(volume, milliseconds);
+}
+
+/*---------------------------------------------------------------------
+   Function: MUSIC_FadeActive
+
+   Returns whether the volume of music playback is fading or not.
+---------------------------------------------------------------------*/
+
+int MUSIC_FadeActive(
+    void)
+
+{
+    return (MIDI_VolumeFading());
+}
+
 /*---------------------------------------------------------------------
    Function: MUSIC_SetLoopFlag
 
@@ -308,6 +367,7 @@ int MUSIC_PlaySong(
     case SoundBlaster:
     case Adlib:
     case ProAudioSpectrum:
+    case SoftwareFM:
     case GenMidi:
     case WaveBlaster:
 
@@ -328,6 +388,472 @@ int MUSIC_PlaySong(
     return (MUSIC_Ok);
 }
 
+/*---------------------------------------------------------------------
+   Function: MUSIC_SetSongTick
+
+   Sets the position of the song pointer.
+---------------------------------------------------------------------*/
+
+void MUSIC_SetSongTick(
+    unsigned long PositionInTicks)
+
+{
+    MIDI_SetSongTick(PositionInTicks);
+}
+
+/*---------------------------------------------------------------------
+   Function: MUSIC_SetSongTime
+
+   Sets the position of the song pointer.
+---------------------------------------------------------------------*/
+
+void MUSIC_SetSongTime(
+    unsigned long milliseconds)
+
+{
+    MIDI_SetSongTime(milliseconds);
+}
+
+/*---------------------------------------------------------------------
+   Function: MUSIC_SetSongPosition
+
+   Sets the position of the song pointer.
+---------------------------------------------------------------------*/
+
+void MUSIC_SetSongPosition(
+    int measure,
+    int beat,
+    int tick)
+
+{
+    MIDI_SetSongPosition(measure, beat, tick);
+}
+
+/*---------------------------------------------------------------------
+   Function: MUSIC_GetSongPosition
+
+   Returns the position of the song pointer.
+---------------------------------------------------------------------*/
+
+void MUSIC_GetSongPosition(
+    songposition *pos)
+
+{
+    MIDI_GetSongPosition(pos);
+}
+
+/*---------------------------------------------------------------------
+   Function: MUSIC_PlaySequence
+
+   Begins playback of a MIDI song in the specified sequence, alongside
+   the songs playing in the other sequences.
+---------------------------------------------------------------------*/
+
+int MUSIC_PlaySequence(
+    int sequence,
+    unsigned char *song,
+    int loopflag)
+
+{
+    int status;
+
+    switch (MUSIC_SoundDevice)
+    {
+    case SoundBlaster:
+    case Adlib:
+    case ProAudioSpectrum:
+    case SoftwareFM:
+    case GenMidi:
+    case WaveBlaster:
+
+        status = MIDI_PlaySequence(sequence, song, loopflag);
+        if (status != MIDI_Ok)
+        {
+            MUSIC_SetErrorCode(MUSIC_MidiError);
+            return (MUSIC_Warning);
+        }
+        break;
+
+    default:
+        MUSIC_SetErrorCode(MUSIC_InvalidCard);
+        return (MUSIC_Warning);
+    }
+
+    return (MUSIC_Ok);
+}
+
+/*---------------------------------------------------------------------
+   Function: MUSIC_StopSequence
+
+   Stops playback of the song in the specified sequence.
+---------------------------------------------------------------------*/
+
+int MUSIC_StopSequence(
+    int sequence)
+
+{
+    if (MIDI_StopSequence(sequence) != MIDI_Ok)
+    {
+        MUSIC_SetErrorCode(MUSIC_MidiError);
+        return (MUSIC_Warning);
+    }
+
+    MUSIC_SetErrorCode(MUSIC_Ok);
+    return (MUSIC_Ok);
+}
+
+/*---------------------------------------------------------------------
+   Function: MUSIC_SequencePlaying
+
+   Returns whether the specified sequence is playing or not.
+---------------------------------------------------------------------*/
+
+int MUSIC_SequencePlaying(
+    int sequence)
+
+{
+    return (MIDI_SequencePlaying(sequence));
+}
+
+/*---------------------------------------------------------------------
+   Function: MUSIC_SetSequenceVolume
+
+   Sets the volume of the specified sequence.
+---------------------------------------------------------------------*/
+
+void MUSIC_SetSequenceVolume(
+    int sequence,
+    int volume)
+
+{
+    MIDI_SetSequenceVolume(sequence, volume);
+}
+
+/*---------------------------------------------------------------------
+   Function: MUSIC_FadeSequence
+
+   Fades the volume of the specified sequence over time.
+---------------------------------------------------------------------*/
+
+void MUSIC_FadeSequence(
+    int sequence,
+    int volume,
+    int milliseconds,
+    int stopflag)
+
+{
+    MIDI_FadeSequence(sequence, volume, milliseconds, stopflag);
+}
+
+/*---------------------------------------------------------------------
+   Function: MUSIC_CrossfadeSequences
+
+   Fades one sequence in while another fades out and stops.
+---------------------------------------------------------------------*/
+
+void MUSIC_CrossfadeSequences(
+    int from,
+    int to,
+    int milliseconds)
+
+{
+    MIDI_CrossfadeSequences(from, to, milliseconds);
+}
+
+/*---------------------------------------------------------------------
+   Function: MUSIC_PrepareSong
+
+   Compiles a song ahead of time so that it can start without delay.
+   Returns a handle for the song, or MUSIC_Warning on failure.
+---------------------------------------------------------------------*/
+
+int MUSIC_PrepareSong(
+    unsigned char *song)
+
+{
+    int handle;
+
+    handle = MIDI_PrepareSong(song);
+    if (handle < 0)
+    {
+        MUSIC_SetErrorCode(MUSIC_MidiError);
+        return (MUSIC_Warning);
+    }
+
+    return (handle);
+}
+
+/*---------------------------------------------------------------------
+   Function: MUSIC_FreePreparedSong
+
+   Releases a prepared song, stopping any sequence playing it.
+---------------------------------------------------------------------*/
+
+void MUSIC_FreePreparedSong(
+    int handle)
+
+{
+    MIDI_FreePreparedSong(handle);
+}
+
+/*---------------------------------------------------------------------
+   Function: MUSIC_PlayPrepared
+
+   Begins playback of a prepared song in the specified sequence.
+---------------------------------------------------------------------*/
+
+int MUSIC_PlayPrepared(
+    int sequence,
+    int handle,
+    int loopflag)
+
+{
+    int status;
+
+    switch (MUSIC_SoundDevice)
+    {
+    case SoundBlaster:
+    case Adlib:
+    case ProAudioSpectrum:
+    case SoftwareFM:
+    case GenMidi:
+    case WaveBlaster:
+
+        status = MIDI_PlayPrepared(sequence, handle, loopflag);
+        if (status != MIDI_Ok)
+        {
+            MUSIC_SetErrorCode(MUSIC_MidiError);
+            return (MUSIC_Warning);
+        }
+        break;
+
+    default:
+        MUSIC_SetErrorCode(MUSIC_InvalidCard);
+        return (MUSIC_Warning);
+    }
+
+    return (MUSIC_Ok);
+}
+
+/*---------------------------------------------------------------------
+   Function: MUSIC_RenderSong
+
+   Renders a prepared song into a buffer of 16 bit signed mono
+   samples at the specified rate, using the FM emulator.  Only
+   available with the SoftwareFM device, and only while no song is
+   playing.
+---------------------------------------------------------------------*/
+
+int MUSIC_RenderSong(
+    int sequence,
+    int handle,
+    char huge *buffer,
+    unsigned long samples,
+    unsigned samplerate,
+    int loopflag)
+
+{
+    int status;
+    unsigned rate;
+    midisynth synth;
+
+    if (MUSIC_SoundDevice != SoftwareFM)
+    {
+        MUSIC_SetErrorCode(MUSIC_InvalidCard);
+        return (MUSIC_Warning);
+    }
+
+    // Keep the stream from running the emulator while we use it
+    EMU_PauseStream(TRUE);
+    rate = EMU_GetRate();
+    EMU_SetRate(samplerate);
+
+    synth.Funcs = &MUSIC_MidiFunctions;
+    synth.Render = EMU_Render;
+    synth.samplerate = EMU_GetRate();
+    synth.samplesize = sizeof(short);
+
+    status = MIDI_RenderSong(sequence, handle, &synth, buffer, samples,
+                             loopflag);
+
+    EMU_SetRate(rate);
+    EMU_PauseStream(FALSE);
+
+    if (status != MIDI_Ok)
+    {
+        MUSIC_SetErrorCode(MUSIC_MidiError);
+        return (MUSIC_Warning);
+    }
+
+    return (MUSIC_Ok);
+}
+
+/*---------------------------------------------------------------------
+   Function: MUSIC_QueueTransition
+
+   Switches the specified sequence to a prepared song at the next
+   beat, bar or marker of the song playing in it.
+---------------------------------------------------------------------*/
+
+int MUSIC_QueueTransition(
+    int sequence,
+    int handle,
+    int boundary,
+    unsigned long starttick,
+    int loopflag)
+
+{
+    int status;
+
+    status = MIDI_QueueTransition(sequence, handle, boundary, starttick, loopflag);
+    if (status != MIDI_Ok)
+    {
+        MUSIC_SetErrorCode(MUSIC_MidiError);
+        return (MUSIC_Warning);
+    }
+
+    return (MUSIC_Ok);
+}
+
+/*---------------------------------------------------------------------
+   Function: MUSIC_CancelTransition
+
+   Cancels the song switch waiting in the specified sequence.
+---------------------------------------------------------------------*/
+
+void MUSIC_CancelTransition(
+    int sequence)
+
+{
+    MIDI_CancelTransition(sequence);
+}
+
+/*---------------------------------------------------------------------
+   Function: MUSIC_SetChannelMute
+
+   Mutes or unmutes a channel of the specified sequence.
+---------------------------------------------------------------------*/
+
+void MUSIC_SetChannelMute(
+    int sequence,
+    int channel,
+    int mute)
+
+{
+    MIDI_SetChannelMute(sequence, channel, mute);
+}
+
+/*---------------------------------------------------------------------
+   Function: MUSIC_SetChannelSolo
+
+   Solos or unsolos a channel of the specified sequence.
+---------------------------------------------------------------------*/
+
+void MUSIC_SetChannelSolo(
+    int sequence,
+    int channel,
+    int solo)
+
+{
+    MIDI_SetChannelSolo(sequence, channel, solo);
+}
+
+/*---------------------------------------------------------------------
+   Function: MUSIC_SetChannelGain
+
+   Scales the volume of a channel of the specified sequence.
+---------------------------------------------------------------------*/
+
+void MUSIC_SetChannelGain(
+    int sequence,
+    int channel,
+    int gain)
+
+{
+    MIDI_SetChannelGain(sequence, channel, gain);
+}
+
+/*---------------------------------------------------------------------
+   Function: MUSIC_SetTempoScale
+
+   Plays the music faster or slower, in percent of its tempo.
+---------------------------------------------------------------------*/
+
+void MUSIC_SetTempoScale(
+    int percent)
+
+{
+    MIDI_SetTempoScale(percent);
+}
+
+/*---------------------------------------------------------------------
+   Function: MUSIC_SetTranspose
+
+   Transposes the music by the specified number of semitones.
+---------------------------------------------------------------------*/
+
+void MUSIC_SetTranspose(
+    int semitones)
+
+{
+    MIDI_SetTranspose(semitones);
+}
+
+/*---------------------------------------------------------------------
+   Function: MUSIC_SetThinning
+
+   Sets how many controller and pitch bend events per beat are kept
+   in the songs compiled from now on.
+---------------------------------------------------------------------*/
+
+void MUSIC_SetThinning(
+    int resolution)
+
+{
+    MIDI_SetThinning(resolution);
+}
+
+/*---------------------------------------------------------------------
+   Function: MUSIC_GetThinnedEvents
+
+   Returns the number of events removed from the last song compiled.
+---------------------------------------------------------------------*/
+
+long MUSIC_GetThinnedEvents(
+    void)
+
+{
+    return (MIDI_GetThinnedEvents());
+}
+
+/*---------------------------------------------------------------------
+   Function: MUSIC_SetMetaCallBack
+
+   Sets the function that receives the marker, cue point, lyric and
+   text events of the music.
+---------------------------------------------------------------------*/
+
+void MUSIC_SetMetaCallBack(
+    void (*function)(songmeta *event))
+
+{
+    MIDI_SetMetaCallBack(function);
+}
+
+/*---------------------------------------------------------------------
+   Function: MUSIC_ServiceMetaEvents
+
+   Delivers the meta events the music has reached to the meta
+   callback.  Call it regularly from the game loop.
+---------------------------------------------------------------------*/
+
+int MUSIC_ServiceMetaEvents(
+    void)
+
+{
+    return (MIDI_ServiceMetaEvents());
+}
+
 int MUSIC_InitFM(
     int card,
     midifuncs *Funcs)
@@ -337,7 +863,15 @@ int MUSIC_InitFM(
 
     status = MIDI_Ok;
 
-    if (!AL_DetectFM())
+    if (card == SoftwareFM)
+    {
+        if (EMU_Init() != EMU_Ok)
+        {
+            MUSIC_SetErrorCode(MUSIC_SoundCardError);
+            return (MUSIC_Error);
+        }
+    }
+    else if (!AL_DetectFM())
     {
         MUSIC_SetErrorCode(MUSIC_FMNotDetected);
         return (MUSIC_Error);
@@ -355,6 +889,9 @@ int MUSIC_InitFM(
     Funcs->PitchBend = AL_SetPitchBend;
     Funcs->ReleasePatches = NULL;
     Funcs->LoadPatch = NULL;
+    Funcs->SysEx = NULL;
+    Funcs->QueueOutput = AL_QueueOutput;
+    Funcs->FlushOutput = AL_FlushOutput;
 
     switch (card)
     {
@@ -377,6 +914,18 @@ int MUSIC_InitFM(
         Funcs->GetVolume = NULL;
         break;
 
+    case SoftwareFM:
+        // Without MultiVoc the emulator can still render songs with
+        // MUSIC_RenderSong, so a missing stream is only a warning.
+        if (EMU_StartStream(MUSIC_StreamPriority) != EMU_Ok)
+        {
+            MUSIC_SetErrorCode(MUSIC_FMStreamError);
+            status = MUSIC_Warning;
+        }
+        Funcs->SetVolume = NULL;
+        Funcs->GetVolume = NULL;
+        break;
+
     case ProAudioSpectrum:
         if (PAS_SaveMusicVolume() == PAS_Ok)
         {
@@ -420,8 +969,11 @@ int MUSIC_InitMidi(
     Funcs->PitchBend = MPU_PitchBend;
     Funcs->ReleasePatches = NULL;
     Funcs->LoadPatch = NULL;
+    Funcs->SysEx = MPU_SysEx;
     Funcs->SetVolume = NULL;
     Funcs->GetVolume = NULL;
+    Funcs->QueueOutput = NULL;
+    Funcs->FlushOutput = NULL;
 
     if (card == WaveBlaster)
     {
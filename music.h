@@ -43,6 +43,7 @@ enum MUSIC_ERRORS
     MUSIC_MidiError,
     MUSIC_TaskManError,
     MUSIC_FMNotDetected,
+    MUSIC_FMStreamError,
 };
 
 typedef struct
@@ -54,6 +55,25 @@ typedef struct
     unsigned int tick;
 } songposition;
 
+// Types of the meta events passed to the meta callback
+#define MUSIC_MetaText 0x01
+#define MUSIC_MetaLyric 0x05
+#define MUSIC_MetaMarker 0x06
+#define MUSIC_MetaCuePoint 0x07
+
+// A text meta event reached by a playing song.  The time is that of
+// the event in the song.  The text is not null terminated and stays
+// in the song.
+typedef struct
+{
+    int sequence;
+    int type;
+    unsigned long tick;
+    unsigned long milliseconds;
+    unsigned char *text;
+    int length;
+} songmeta;
+
 #define MUSIC_LoopSong (1 == 1)
 #define MUSIC_PlayOnce (!MUSIC_LoopSong)
 
@@ -62,11 +82,41 @@ int MUSIC_Init(int SoundCard, int Address);
 int MUSIC_Shutdown(void);
 void MUSIC_SetVolume(int volume);
 int MUSIC_GetVolume(void);
+void MUSIC_FadeVolume(int volume, int milliseconds);
+int MUSIC_FadeActive(void);
 void MUSIC_SetLoopFlag(int loopflag);
 int MUSIC_SongPlaying(void);
 void MUSIC_Continue(void);
 void MUSIC_Pause(void);
 int MUSIC_StopSong(void);
 int MUSIC_PlaySong(unsigned char *song, int loopflag);
+void MUSIC_SetSongTick(unsigned long PositionInTicks);
+void MUSIC_SetSongTime(unsigned long milliseconds);
+void MUSIC_SetSongPosition(int measure, int beat, int tick);
+void MUSIC_GetSongPosition(songposition *pos);
+int MUSIC_PlaySequence(int sequence, unsigned char *song, int loopflag);
+int MUSIC_StopSequence(int sequence);
+int MUSIC_SequencePlaying(int sequence);
+void MUSIC_SetSequenceVolume(int sequence, int volume);
+void MUSIC_FadeSequence(int sequence, int volume, int milliseconds, int stopflag);
+void MUSIC_CrossfadeSequences(int from, int to, int milliseconds);
+int MUSIC_PrepareSong(unsigned char *song);
+void MUSIC_FreePreparedSong(int handle);
+int MUSIC_PlayPrepared(int sequence, int handle, int loopflag);
+int MUSIC_RenderSong(int sequence, int handle, char huge *buffer,
+                     unsigned long samples, unsigned samplerate,
+                     int loopflag);
+int MUSIC_QueueTransition(int sequence, int handle, int boundary,
+                          unsigned long starttick, int loopflag);
+void MUSIC_CancelTransition(int sequence);
+void MUSIC_SetChannelMute(int sequence, int channel, int mute);
+void MUSIC_SetChannelSolo(int sequence, int channel, int solo);
+void MUSIC_SetChannelGain(int sequence, int channel, int gain);
+void MUSIC_SetTempoScale(int percent);
+void MUSIC_SetTranspose(int semitones);
+void MUSIC_SetThinning(int resolution);
+long MUSIC_GetThinnedEvents(void);
+void MUSIC_SetMetaCallBack(void (*function)(songmeta *event));
+int MUSIC_ServiceMetaEvents(void);
 
 #endif
\ No newline at end of file
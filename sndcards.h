@@ -42,6 +42,7 @@ typedef enum
     WaveBlaster,
     SoundSource,
     TandySoundSource,
+    SoftwareFM,
     NumSoundCards
 } soundcardnames;
 
@@ -45,6 +45,9 @@ typedef struct
     task *end;
 } tasklist;
 
+// Shortest time between timer interrupts, in timer counts
+#define TS_MinInterval 32
+
 /*---------------------------------------------------------------------
    Global variables
 ---------------------------------------------------------------------*/
@@ -66,6 +69,10 @@ static tasklist TaskList;
 
 static void TS_FreeTaskList(tasklist *head);
 static void TS_SetClockSpeed(long speed);
+static unsigned TS_ReadClock(void);
+static void TS_SetNextInterrupt(void);
+static int TS_CreditElapsed(void);
+static void TS_Reschedule(void);
 static int TS_SetTimer(int TickBase);
 static void interrupt far TS_ServiceSchedule(void);
 static void TS_AddTask(task *ptr);
@@ -103,7 +110,8 @@ static void TS_FreeTaskList(
 /*---------------------------------------------------------------------
    Function: TS_SetClockSpeed
 
-   Sets the rate of the 8253 timer.
+   Starts the 8253 timer counting down to the next interrupt.  The
+   timer runs in one-shot mode, so each interrupt sets up the next.
 ---------------------------------------------------------------------*/
 
 static void TS_SetClockSpeed(
@@ -120,17 +128,171 @@ static void TS_SetClockSpeed(
         TaskServiceRate = 0x10000L;
     }
 
-    outp(0x43, 0x36);
+    outp(0x43, 0x30);
     outp(0x40, TaskServiceRate);
     outp(0x40, TaskServiceRate >> 8);
     ENABLE_INTERRUPTS();
 }
 
+/*---------------------------------------------------------------------
+   Function: TS_ReadClock
+
+   Returns the current count of the 8253 timer.
+---------------------------------------------------------------------*/
+
+static unsigned TS_ReadClock(
+    void)
+
+{
+    unsigned count;
+
+    outp(0x43, 0x00);
+    count = inp(0x40);
+    count |= inp(0x40) << 8;
+
+    return (count);
+}
+
+/*---------------------------------------------------------------------
+   Function: TS_SetNextInterrupt
+
+   Sets the timer to interrupt when the next task is due, or after
+   the longest time the timer can count if no task is due before
+   then.  Called from the interrupt, once the tasks have been
+   serviced.
+---------------------------------------------------------------------*/
+
+static void TS_SetNextInterrupt(
+    void)
+
+{
+    task *ptr;
+    long next;
+    long late;
+    long count;
+
+    next = 0x10000L;
+    if (byte_2F426)
+    {
+        ptr = TaskList.start;
+        while (ptr != NULL)
+        {
+            if ((ptr->priority > 0) && (ptr->rate - ptr->count < next))
+            {
+                next = ptr->rate - ptr->count;
+            }
+            ptr = ptr->next;
+        }
+    }
+
+    next = max(next, TS_MinInterval);
+
+    // The timer keeps counting down after it reaches zero, which tells
+    // us how long ago the interrupt was requested.  Take that off the
+    // next count so the delay doesn't add up from one interrupt to the
+    // next.
+    late = (0x10000L - TS_ReadClock()) & 0xffffL;
+    count = max(next - late, TS_MinInterval);
+
+    TaskServiceRate = next;
+    outp(0x43, 0x30);
+    outp(0x40, count);
+    outp(0x40, count >> 8);
+}
+
+/*---------------------------------------------------------------------
+   Function: TS_CreditElapsed
+
+   Adds the time the timer has counted since the last interrupt to
+   the tasks and the BIOS clock, so that the timer can be set up again
+   from the foreground without losing it.  The interrupt then only
+   adds the time left on the timer.  Returns FALSE when the interrupt
+   is already due, in which case it will take care of everything.
+   Call with interrupts disabled, outside of the interrupt.
+---------------------------------------------------------------------*/
+
+static int TS_CreditElapsed(
+    void)
+
+{
+    task *ptr;
+    long remaining;
+    long elapsed;
+
+    remaining = TS_ReadClock();
+
+    // Once the count runs out the interrupt is waiting on the PIC
+    outp(0x20, 0x0a);
+    if ((inp(0x20) & 1) || (remaining == 0) || (remaining > TaskServiceRate))
+    {
+        return (FALSE);
+    }
+
+    elapsed = TaskServiceRate - remaining;
+    if (byte_2F426)
+    {
+        ptr = TaskList.start;
+        while (ptr != NULL)
+        {
+            if (ptr->priority > 0)
+            {
+                ptr->count += elapsed;
+            }
+            ptr = ptr->next;
+        }
+    }
+
+    TaskServiceCount += elapsed;
+    TaskServiceRate = remaining;
+
+    return (TRUE);
+}
+
+/*---------------------------------------------------------------------
+   Function: TS_Reschedule
+
+   Brings the timer interrupt forward if a task is now due before the
+   timer runs out.  Call with interrupts disabled, outside of the
+   interrupt, after TS_CreditElapsed.
+---------------------------------------------------------------------*/
+
+static void TS_Reschedule(
+    void)
+
+{
+    task *ptr;
+    long next;
+
+    if (!byte_2F426)
+    {
+        return;
+    }
+
+    next = TaskServiceRate;
+    ptr = TaskList.start;
+    while (ptr != NULL)
+    {
+        if ((ptr->priority > 0) && (ptr->rate - ptr->count < next))
+        {
+            next = ptr->rate - ptr->count;
+        }
+        ptr = ptr->next;
+    }
+
+    next = max(next, TS_MinInterval);
+    if (next < TaskServiceRate)
+    {
+        TaskServiceRate = next;
+        outp(0x43, 0x30);
+        outp(0x40, next);
+        outp(0x40, next >> 8);
+    }
+}
+
 /*---------------------------------------------------------------------
    Function: TS_SetTimer
 
-   Calculates the rate at which a task will occur and sets the clock
-   speed if necessary.
+   Calculates the rate at which a task will occur.
 ---------------------------------------------------------------------*/
 
 static int TS_SetTimer(
@@ -140,10 +302,6 @@ static int TS_SetTimer(
     int speed;
 
     speed = 1192030L / TickBase;
-    if (speed < TaskServiceRate)
-    {
-        TS_SetClockSpeed(speed);
-    }
 
     return (speed);
 }
@@ -158,14 +316,19 @@ static void interrupt far TS_ServiceSchedule(
     void)
 
 {
+    long elapsed;
+
     TS_InInterrupt = TRUE;
+    elapsed = TaskServiceRate;
     sub_24E08();
     sub_24EB7();
+    TS_SetNextInterrupt();
 
-    TaskServiceCount += TaskServiceRate;
+    TaskServiceCount += elapsed;
     if (TaskServiceCount > 0xffffL)
     {
         TaskServiceCount &= 0xffff;
+        TS_InInterrupt = FALSE;
         OldInt8();
     }
     else
@@ -212,14 +375,12 @@ static void sub_24EB7()
 {
     task *ptr;
     task *next;
-    long speed;
 
     if (byte_2F427 == FALSE)
     {
         return;
     }
 
-    speed = 0x10000L;
     ptr = TaskList.start;
     while (ptr != NULL)
     {
@@ -249,20 +410,9 @@ static void sub_24EB7()
             ptr->prev = NULL;
             farfree(ptr);
         }
-        else
-        {
-            if (ptr->rate < speed)
-            {
-                speed = ptr->rate;
-            }
-        }
         ptr = next;
     }
     byte_2F427 = FALSE;
-    if (TaskServiceRate != speed)
-    {
-        TS_SetClockSpeed(speed);
-    }
 }
 
 static void sub_24FE8(tasklist *head, task *node)
@@ -312,11 +462,11 @@ static void TS_Startup(
     byte_2F426 = FALSE;
     byte_2F427 = FALSE;
 
-    TaskServiceRate = 0x10000L;
     TaskServiceCount = 0;
 
     OldInt8 = getvect(0x08);
     setvect(0x08, TS_ServiceSchedule);
+    TS_SetClockSpeed(0);
 
     TS_Installed = TRUE;
 
@@ -339,7 +489,14 @@ void TS_Shutdown(
 {
     if (TS_Installed)
     {
-        TS_SetClockSpeed(0);
+        // Put the timer back in the periodic mode the BIOS uses
+        DISABLE_INTERRUPTS();
+        outp(0x43, 0x36);
+        outp(0x40, 0);
+        outp(0x40, 0);
+        TaskServiceRate = 0x10000L;
+        ENABLE_INTERRUPTS();
+
         setvect(0x08, OldInt8);
         TS_FreeTaskList(&TaskList);
         byte_2F426 = FALSE;
@@ -377,7 +534,18 @@ task *TS_ScheduleTask(
             ptr->count = 0;
             ptr->priority = priority;
 
-            TS_AddTask(ptr);
+            // The new task starts counting now
+            DISABLE_INTERRUPTS();
+            if (!TS_InInterrupt && TS_CreditElapsed())
+            {
+                TS_AddTask(ptr);
+                TS_Reschedule();
+            }
+            else
+            {
+                TS_AddTask(ptr);
+            }
+            ENABLE_INTERRUPTS();
         }
     }
     return (ptr);
@@ -434,7 +602,17 @@ void TS_Dispatch(
     void)
 
 {
-    byte_2F426 = TRUE;
+    DISABLE_INTERRUPTS();
+    if (!TS_InInterrupt && TS_CreditElapsed())
+    {
+        byte_2F426 = TRUE;
+        TS_Reschedule();
+    }
+    else
+    {
+        byte_2F426 = TRUE;
+    }
+    ENABLE_INTERRUPTS();
 }
 
 void TS_Stop(
@@ -455,25 +633,71 @@ void TS_SetTaskRate(
     int rate)
 
 {
-    task *ptr;
-    long MaxServiceRate;
+    DISABLE_INTERRUPTS();
+    if (!TS_InInterrupt && TS_CreditElapsed())
+    {
+        Task->rate = TS_SetTimer(rate);
+        TS_Reschedule();
+    }
+    else
+    {
+        Task->rate = TS_SetTimer(rate);
+    }
+    ENABLE_INTERRUPTS();
+}
 
-    Task->rate = TS_SetTimer(rate);
-    MaxServiceRate = 0x10000L;
+/*---------------------------------------------------------------------
+   Function: TS_SetTaskInterval
 
-    ptr = TaskList.start;
-    while (ptr != 0)
-    {
-        if (ptr->rate < MaxServiceRate)
-        {
-            MaxServiceRate = ptr->rate;
-        }
+   Sets the time between services of the specified task, in timer
+   counts.  The next service is that long after the last one.  A task
+   that only needs to run at certain times can set the time to its
+   next job each time it is serviced, so the timer doesn't interrupt
+   in between.
+---------------------------------------------------------------------*/
 
-        ptr = ptr->next;
+void TS_SetTaskInterval(
+    task *Task,
+    long interval)
+
+{
+    // The interrupt sets up the timer itself once the tasks are done
+    DISABLE_INTERRUPTS();
+    if (!TS_InInterrupt && TS_CreditElapsed())
+    {
+        Task->rate = max(interval, 1L);
+        TS_Reschedule();
     }
+    else
+    {
+        Task->rate = max(interval, 1L);
+    }
+    ENABLE_INTERRUPTS();
+}
+
+/*---------------------------------------------------------------------
+   Function: TS_RestartTask
+
+   Services the specified task the given number of timer counts from
+   now, and at that interval after.
+---------------------------------------------------------------------*/
 
-    if (TaskServiceRate != MaxServiceRate)
+void TS_RestartTask(
+    task *Task,
+    long interval)
+
+{
+    DISABLE_INTERRUPTS();
+    if (!TS_InInterrupt && TS_CreditElapsed())
     {
-        TS_SetClockSpeed(MaxServiceRate);
+        Task->count = 0;
+        Task->rate = max(interval, 1L);
+        TS_Reschedule();
     }
+    else
+    {
+        Task->count = 0;
+        Task->rate = max(interval, 1L);
+    }
+    ENABLE_INTERRUPTS();
 }
@@ -44,7 +44,7 @@ typedef struct task
     struct task *prev;
     void (*TaskService)(struct task *);
     void *data;
-    long rate;
+    long rate; // Timer counts between services
     volatile long count;
     char priority;
 } task;
@@ -61,5 +61,7 @@ task *TS_ScheduleTask(void (*Function)(task *), int rate,
 int TS_Terminate(task *ptr);
 void TS_Dispatch(void);
 void TS_SetTaskRate(task *Task, int rate);
+void TS_SetTaskInterval(task *Task, long interval);
+void TS_RestartTask(task *Task, long interval);
 
 #endif
\ No newline at end of file